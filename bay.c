@@ -0,0 +1,230 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bay.h"
+#include "gpio.h"
+
+double TimeSpecToSeconds(const struct timespec *ts)
+{
+    return (double)ts->tv_sec + (double)ts->tv_nsec / 1000000000.0;
+}
+
+double getElapsedTime(const struct timespec *start, const struct timespec *end, bool roundToMinute)
+{
+	double exact_total = TimeSpecToSeconds(end) - TimeSpecToSeconds(start);
+	if(!roundToMinute) {
+		return exact_total;
+	} else {
+		int total = round(exact_total);
+		int roundTo = 60;
+		int leftover = total % roundTo;
+		if(leftover > 30) {
+			return total + roundTo - (total % roundTo);
+		} else {
+			return total - leftover;
+		}
+	}
+}
+
+/*
+	TRANSITIONS
+	LAYOUT: table[state][input level]
+*/
+enum relay_action {
+	RELAY_HOLD,             // input agrees with the state
+	RELAY_COUNT_START,
+	RELAY_COUNT_STOP,
+};
+
+static const uint8_t relayTable[2][2] = {
+	// stopped: pulled low is the relay closing
+	{[GPIO_LOW] = RELAY_COUNT_START, [GPIO_HIGH] = RELAY_HOLD},
+	// running: back high is the relay opening
+	{[GPIO_LOW] = RELAY_HOLD, [GPIO_HIGH] = RELAY_COUNT_STOP},
+};
+
+enum coin_action {
+	COIN_IDLE,
+	COIN_PRESS,             // held low: arm, start counting again
+	COIN_COUNT,             // released: count towards the insert
+};
+
+static const uint8_t coinTable[2][2] = {
+	// not held
+	{[GPIO_LOW] = COIN_PRESS, [GPIO_HIGH] = COIN_IDLE},
+	// held
+	{[GPIO_LOW] = COIN_PRESS, [GPIO_HIGH] = COIN_COUNT},
+};
+
+static void session_so_far(const struct bay_table *bays, int b, const struct timespec *t, double *timerTime, double *pumpTime) {
+	*timerTime = bays->running[b][BAY_TIMER] ? getElapsedTime(&bays->started[b][BAY_TIMER], t, false) : 0;
+	*pumpTime = bays->pumpSessionElapsed[b] + (bays->running[b][BAY_PUMP] ? getElapsedTime(&bays->started[b][BAY_PUMP], t, false) : 0);
+}
+
+static struct bay_event *emit(const struct bay_table *bays, int b, int kind, const struct timespec *t, struct bay_event *out) {
+	memset(out, 0, sizeof(*out));
+	out->kind = kind;
+	out->timer_running = bays->running[b][BAY_TIMER];
+	out->pump_running = bays->running[b][BAY_PUMP];
+	out->time = *t;
+	session_so_far(bays, b, t, &out->timer_time, &out->pump_time);
+	return out;
+}
+
+static int start_relay(struct bay_table *bays, int b, int relay, const struct timespec *t, struct bay_event *out) {
+	bays->running[b][relay] = true;
+	bays->started[b][relay] = *t;
+	// a pump already running counts towards the new session from its start, not from its own
+	if(relay == BAY_TIMER) bays->pumpSessionElapsed[b] = bays->running[b][BAY_PUMP] ? -getElapsedTime(&bays->started[b][BAY_PUMP], t, false) : 0;
+	emit(bays, b, relay == BAY_TIMER ? BAY_TIMER_STARTED : BAY_PUMP_STARTED, t, out);
+	return 1;
+}
+
+static int stop_timer(struct bay_table *bays, int b, const struct timespec *t, struct bay_event *out) {
+	double timerTime, pumpTime;
+	session_so_far(bays, b, t, &timerTime, &pumpTime);
+	bays->running[b][BAY_TIMER] = false;
+
+	// the pump so far went to the session that just ended, whatever it runs on for goes to the next one
+	bays->pumpSessionElapsed[b] = bays->running[b][BAY_PUMP] ? -getElapsedTime(&bays->started[b][BAY_PUMP], t, false) : 0;
+
+	struct bay_event *event = emit(bays, b, BAY_TIMER_STOPPED, t, out);
+	event->started = bays->started[b][BAY_TIMER];
+	event->run_time = timerTime;
+	event->session_timer = getElapsedTime(&bays->started[b][BAY_TIMER], t, true);
+	event->session_pump = (pumpTime < 1) ? 0 : pumpTime;
+	return 1;
+}
+
+static int stop_pump(struct bay_table *bays, int b, const struct timespec *t, struct bay_event *out) {
+	double runTime = getElapsedTime(&bays->started[b][BAY_PUMP], t, false);
+	bays->running[b][BAY_PUMP] = false;
+
+	// outside a timer session the pump time is not kept
+	bays->pumpSessionElapsed[b] = bays->running[b][BAY_TIMER] ? bays->pumpSessionElapsed[b] + runTime : 0;
+
+	struct bay_event *event = emit(bays, b, BAY_PUMP_STOPPED, t, out);
+	event->started = bays->started[b][BAY_PUMP];
+	event->run_time = runTime;
+	return 1;
+}
+
+static void reject(struct bay_table *bays, int b, int input) {
+	atomic_fetch_add_explicit(&bays->rejected[b][input], 1, memory_order_relaxed);
+}
+
+static int relay_input(struct bay_table *bays, int b, int relay, int level, const struct timespec *t, int window, struct bay_event *out) {
+	switch(relayTable[bays->running[b][relay]][level]) {
+		case RELAY_HOLD:
+			if(bays->disagreeing[b][relay]) {
+				bays->disagreeing[b][relay] = false;
+				reject(bays, b, relay);
+			}
+			return 0;
+		case RELAY_COUNT_START:
+			if(bays->startCount[b][relay] < window) {
+				bays->startCount[b][relay]++;
+				bays->disagreeing[b][relay] = true;
+				return 0;
+			}
+			bays->startCount[b][relay] = 0;
+			bays->disagreeing[b][relay] = false;
+			return start_relay(bays, b, relay, t, out);
+		case RELAY_COUNT_STOP:
+			if(bays->stopCount[b][relay] < window) {
+				bays->stopCount[b][relay]++;
+				bays->disagreeing[b][relay] = true;
+				return 0;
+			}
+			bays->stopCount[b][relay] = 0;
+			bays->disagreeing[b][relay] = false;
+			return (relay == BAY_TIMER) ? stop_timer(bays, b, t, out) : stop_pump(bays, b, t, out);
+	}
+	return 0;
+}
+
+static int coin_input(struct bay_table *bays, int b, int level, const struct timespec *t, int window, struct bay_event *out) {
+	switch(coinTable[bays->insertHeld[b]][level]) {
+		case COIN_PRESS:
+			// released, but not for long enough to count
+			if(bays->insertHeld[b] && bays->insertCounter[b] > 0) reject(bays, b, BAY_MAINTENANCE);
+			bays->insertCounter[b] = 0;
+			bays->insertHeld[b] = true;
+			break;
+		case COIN_COUNT:
+			if(bays->insertCounter[b] < window) {
+				bays->insertCounter[b]++;
+				break;
+			}
+			bays->insertCounter[b] = 0;
+			bays->insertHeld[b] = false;
+			emit(bays, b, BAY_INSERT, t, out);
+			return 1;
+	}
+	return 0;
+}
+
+int bay_table_init(struct bay_table *bays, int count) {
+	memset(bays, 0, sizeof(*bays));
+	bays->count = count;
+	bays->running = calloc(count, sizeof(*bays->running));
+	bays->disagreeing = calloc(count, sizeof(*bays->disagreeing));
+	bays->startCount = calloc(count, sizeof(*bays->startCount));
+	bays->stopCount = calloc(count, sizeof(*bays->stopCount));
+	bays->started = calloc(count, sizeof(*bays->started));
+	bays->pumpSessionElapsed = calloc(count, sizeof(*bays->pumpSessionElapsed));
+	bays->insertHeld = calloc(count, sizeof(*bays->insertHeld));
+	bays->insertCounter = calloc(count, sizeof(*bays->insertCounter));
+	bays->rejected = calloc(count, sizeof(*bays->rejected));
+	if(bays->running == NULL || bays->disagreeing == NULL || bays->startCount == NULL || bays->stopCount == NULL || bays->started == NULL
+		|| bays->pumpSessionElapsed == NULL || bays->insertHeld == NULL || bays->insertCounter == NULL || bays->rejected == NULL) {
+		bay_table_free(bays);
+		return -1;
+	}
+	return 0;
+}
+
+void bay_table_free(struct bay_table *bays) {
+	free(bays->running);
+	free(bays->disagreeing);
+	free(bays->startCount);
+	free(bays->stopCount);
+	free(bays->started);
+	free(bays->pumpSessionElapsed);
+	free(bays->insertHeld);
+	free(bays->insertCounter);
+	free(bays->rejected);
+	memset(bays, 0, sizeof(*bays));
+}
+
+int bay_step(struct bay_table *bays, int b, unsigned levels, const struct timespec *t, const struct bay_windows *windows, struct bay_event *out) {
+	// nearly every sample: both relays agree with their state, neither was disagreeing, no coin held
+	bool timerLow = ((levels >> BAY_TIMER) & 1) == GPIO_LOW;
+	bool pumpLow = ((levels >> BAY_PUMP) & 1) == GPIO_LOW;
+	if(bays->running[b][BAY_TIMER] == timerLow && bays->running[b][BAY_PUMP] == pumpLow
+		&& !bays->disagreeing[b][BAY_TIMER] && !bays->disagreeing[b][BAY_PUMP]
+		&& !bays->insertHeld[b] && ((levels >> BAY_MAINTENANCE) & 1) == GPIO_HIGH) {
+		return 0;
+	}
+
+	int n = 0;
+	n += relay_input(bays, b, BAY_TIMER, (levels >> BAY_TIMER) & 1, t, windows->relay, &out[n]);
+	n += relay_input(bays, b, BAY_PUMP, (levels >> BAY_PUMP) & 1, t, windows->relay, &out[n]);
+	n += coin_input(bays, b, (levels >> BAY_MAINTENANCE) & 1, t, windows->maintenance, &out[n]);
+	return n;
+}
+
+int bay_edge(struct bay_table *bays, int b, int input, int level, const struct timespec *t, struct bay_event *out) {
+	switch(input) {
+		case BAY_TIMER:
+		case BAY_PUMP:
+			return relay_input(bays, b, input, level, t, 0, out);
+		case BAY_MAINTENANCE:
+			return coin_input(bays, b, level, t, 0, out);
+	}
+	return 0;
+}
+
+void bay_runtime(const struct bay_table *bays, int b, const struct timespec *now, double *timerTime, double *pumpTime) {
+	session_so_far(bays, b, now, timerTime, pumpTime);
+}
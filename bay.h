@@ -0,0 +1,112 @@
+#ifndef CARWASH_BAY_H
+#define CARWASH_BAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <stdatomic.h>
+
+/*
+	BAY STATE MACHINE
+	the timer/pump/maintenance logic of a table of bays with no I/O and no
+	clock of its own: every step takes one bay's input levels and the time they were
+	sampled at, and returns what happened as events. the monitor turns the
+	events into queued rows and status updates, the replay prints them and
+	cw-baybench drives thousands of these against a made up clock.
+
+	relays are debounced by counting samples that disagree with the current
+	state (the count is not reset by chatter in between, as it always was),
+	the maintenance coin counts once its input has been released for long
+	enough. event driven input is already debounced and goes through the
+	same tables with zero length windows.
+*/
+
+// input bits of one bay, in slot order (monitor's BAY_SLOT)
+#define BAY_TIMER 0
+#define BAY_PUMP 1
+#define BAY_COIN_RELAY 2        // an output, never read
+#define BAY_MAINTENANCE 3
+#define BAY_INPUTS 4
+
+// debounce windows in samples
+struct bay_windows {
+	int relay;
+	int maintenance;
+};
+
+/*
+	BAY STATE
+	one array per field, indexed by bay, so a sweep over every bay walks
+	each field front to back: a quiet sample only reads running, disagreeing
+	and insertHeld, a couple of bytes a bay. LAYOUT: field[bay] or
+	field[bay][BAY_TIMER or BAY_PUMP]
+*/
+struct bay_table {
+	int count;
+	bool (*running)[2];
+	// the last sample disagreed with the relay without switching it
+	bool (*disagreeing)[2];
+	// samples the relay has disagreed with running
+	int (*startCount)[2];
+	int (*stopCount)[2];
+	struct timespec (*started)[2];
+	// pump time from earlier pump runs in the current timer session, less
+	// whatever a pump already running when the session started had run before it
+	double *pumpSessionElapsed;
+
+	// maintenance coin: true while the input is held low
+	bool *insertHeld;
+	int *insertCounter;
+
+	/*
+		debounce rejections by input (BAY_TIMER, BAY_PUMP, BAY_MAINTENANCE):
+		a relay that went back to agreeing before its window was up, a coin
+		pressed again before its release counted. only the bay's own step
+		writes them, anything may read them (the metrics endpoint does)
+	*/
+	_Atomic uint64_t (*rejected)[BAY_INPUTS];
+};
+
+enum bay_event_kind {
+	BAY_TIMER_STARTED,
+	BAY_TIMER_STOPPED,      // session_timer/session_pump: the session to record (when session_timer > 0)
+	BAY_PUMP_STARTED,
+	BAY_PUMP_STOPPED,
+	BAY_INSERT,
+};
+
+struct bay_event {
+	uint8_t kind;
+	bool timer_running;
+	bool pump_running;
+	struct timespec time;
+	// session so far once the event is applied, what dashboards show
+	double timer_time;
+	double pump_time;
+	// stops: when the timer session or pump run that ended started, and how long it lasted
+	struct timespec started;
+	double run_time;
+	double session_timer;   // BAY_TIMER_STOPPED: rounded to the minute, as billed
+	double session_pump;
+};
+
+// a timer stop, a pump start or stop and a coin can all land on one sample
+#define BAY_MAX_EVENTS 3
+
+// count bays, all stopped, -1 when out of memory
+int bay_table_init(struct bay_table *bays, int count);
+void bay_table_free(struct bay_table *bays);
+/*
+	one polling sample of bay b: levels holds its inputs as bits (GPIO_LOW
+	is active), t is when they were read. events go to out, returns how many
+*/
+int bay_step(struct bay_table *bays, int b, unsigned levels, const struct timespec *t, const struct bay_windows *windows, struct bay_event *out);
+// one debounced edge on input (BAY_TIMER, ...) of bay b
+int bay_edge(struct bay_table *bays, int b, int input, int level, const struct timespec *t, struct bay_event *out);
+// bay b's running session at now
+void bay_runtime(const struct bay_table *bays, int b, const struct timespec *now, double *timerTime, double *pumpTime);
+
+double TimeSpecToSeconds(const struct timespec *ts);
+double getElapsedTime(const struct timespec *start, const struct timespec *end, bool roundToMinute);
+
+#endif
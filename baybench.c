@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "bay.h"
+#include "gpio.h"
+
+/*
+	BAY STATE MACHINE BENCHMARK
+	drives thousands of virtual bays through the monitor's bay state machine
+	(bay.c) on a made up clock and reports ns per bay-step and events/sec.
+	every bay runs its own random but plausible pattern: coin pulses while
+	idle, a timer session with the pump on for part of it, now and then a
+	pump left on across the end of one session into the next, one sample
+	glitches on the timer relay while idle and bounces on the pump relay
+	while it runs.
+
+	every event is also checked, and any of these failing exits 1:
+		starts and stops of the timer and pump alternate
+		a session's timer time is whole minutes
+		a session's pump time is never more than its timer time plus one
+			debounce window
+		no clock runs backwards
+		every coin pulse is one insert
+
+	usage: cw-baybench [-n bays] [-c cycles] [-r relay window] [-m coin window] [-s seed]
+	(windows in cycles, the defaults are carwash.conf's at 100 Hz)
+*/
+
+#define SAMPLE_PERIOD_NS 10000000L
+
+static double now_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+static uint64_t rngState = 88172645463325252ULL;
+
+static uint64_t xorshift(void) {
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 7;
+	rngState ^= rngState << 17;
+	return rngState;
+}
+
+// lo to hi inclusive
+static long rand_between(long lo, long hi) {
+	return lo + (long)(xorshift() % (uint64_t)(hi - lo + 1));
+}
+
+/*
+	VIRTUAL BAY
+	what the relays are doing (phase, until which cycle) and a shadow of
+	what the state machine under test should be saying about it
+*/
+enum phase {
+	PHASE_IDLE,
+	PHASE_COIN_LOW,
+	PHASE_COIN_GAP,         // released, long enough for the coin to count
+	PHASE_TIMER_LEAD,       // timer on, pump not yet
+	PHASE_PUMP,
+	PHASE_PUMP_HELD,        // timer off with the pump left on, the next session starts with it running
+	PHASE_TIMER_TAIL,       // pump off again, timer still on
+};
+
+struct virtual_bay {
+	int phase;
+	long until;
+	unsigned levels;
+
+	bool running[2];
+	long pulses;
+	long inserts;
+};
+
+static int relayWindow = 20;
+static int coinWindow = 5;
+static long cycles = 20000;
+
+static long violations = 0;
+static long sessions = 0;
+
+static void violation(int b, long cycle, const char *what) {
+	if(violations < 10) fprintf(stderr, "VIOLATION bay %d cycle %ld: %s\n", b, cycle, what);
+	violations++;
+}
+
+static void enter(struct virtual_bay *v, int phase, long cycle) {
+	v->phase = phase;
+	switch(phase) {
+		case PHASE_IDLE:
+			v->until = cycle + rand_between(50, 2000);
+			break;
+		case PHASE_COIN_LOW:
+			v->until = cycle + rand_between(1, 20);
+			v->pulses++;
+			break;
+		case PHASE_COIN_GAP:
+			v->until = cycle + coinWindow + rand_between(2, 50);
+			break;
+		case PHASE_TIMER_LEAD:
+			v->until = cycle + rand_between(0, 300);
+			break;
+		case PHASE_PUMP:
+			v->until = cycle + rand_between(1, 9000);
+			break;
+		case PHASE_PUMP_HELD:
+			v->until = cycle + rand_between(1, 6000);
+			break;
+		case PHASE_TIMER_TAIL:
+			v->until = cycle + rand_between(0, 3000);
+			break;
+	}
+}
+
+// the bay's input levels for this cycle, GPIO_LOW is a relay on
+static unsigned next_levels(struct virtual_bay *v, long cycle) {
+	while(cycle >= v->until) {
+		switch(v->phase) {
+			case PHASE_IDLE:
+				// no coin that could still be counting when the run ends
+				if(xorshift() % 3 == 0 && cycle + 100 + coinWindow < cycles) enter(v, PHASE_COIN_LOW, cycle);
+				else enter(v, PHASE_TIMER_LEAD, cycle);
+				break;
+			case PHASE_COIN_LOW: enter(v, PHASE_COIN_GAP, cycle); break;
+			case PHASE_COIN_GAP: enter(v, PHASE_IDLE, cycle); break;
+			case PHASE_TIMER_LEAD: enter(v, PHASE_PUMP, cycle); break;
+			case PHASE_PUMP:
+				if(xorshift() % 4 == 0) enter(v, PHASE_PUMP_HELD, cycle);
+				else enter(v, PHASE_TIMER_TAIL, cycle);
+				break;
+			case PHASE_PUMP_HELD: enter(v, PHASE_PUMP, cycle); break;
+			case PHASE_TIMER_TAIL: enter(v, PHASE_IDLE, cycle); break;
+		}
+	}
+
+	unsigned timer = GPIO_HIGH, pump = GPIO_HIGH, coin = GPIO_HIGH;
+	switch(v->phase) {
+		case PHASE_IDLE:
+			if(xorshift() % 256 == 0) timer = GPIO_LOW;
+			break;
+		case PHASE_COIN_LOW:
+			coin = GPIO_LOW;
+			break;
+		case PHASE_COIN_GAP:
+			break;
+		case PHASE_PUMP_HELD:
+			pump = (xorshift() % 512 == 0) ? GPIO_HIGH : GPIO_LOW;
+			break;
+		case PHASE_PUMP:
+			pump = (xorshift() % 512 == 0) ? GPIO_HIGH : GPIO_LOW;
+			// fall through
+		case PHASE_TIMER_LEAD:
+		case PHASE_TIMER_TAIL:
+			timer = GPIO_LOW;
+			break;
+	}
+	return timer << BAY_TIMER | pump << BAY_PUMP | GPIO_HIGH << BAY_COIN_RELAY | coin << BAY_MAINTENANCE;
+}
+
+static void check_event(struct virtual_bay *v, int b, long cycle, const struct bay_event *e) {
+	switch(e->kind) {
+		case BAY_TIMER_STARTED:
+		case BAY_PUMP_STARTED: {
+			int relay = (e->kind == BAY_TIMER_STARTED) ? BAY_TIMER : BAY_PUMP;
+			if(v->running[relay]) violation(b, cycle, "started twice");
+			v->running[relay] = true;
+			break;
+		}
+		case BAY_TIMER_STOPPED:
+		case BAY_PUMP_STOPPED: {
+			int relay = (e->kind == BAY_TIMER_STOPPED) ? BAY_TIMER : BAY_PUMP;
+			if(!v->running[relay]) violation(b, cycle, "stopped while not running");
+			v->running[relay] = false;
+			if(e->run_time < 0) violation(b, cycle, "negative run time");
+			if(getElapsedTime(&e->started, &e->time, false) < 0) violation(b, cycle, "stopped before it started");
+			break;
+		}
+		case BAY_INSERT:
+			v->inserts++;
+			break;
+	}
+	if(e->kind == BAY_TIMER_STOPPED) {
+		double window = (relayWindow + 1) * (SAMPLE_PERIOD_NS / 1e9);
+		if(e->session_timer < 0 || fmod(e->session_timer, 60) != 0) violation(b, cycle, "session timer is not whole minutes");
+		if(e->session_pump < 0) violation(b, cycle, "negative session pump time");
+		if(e->session_pump > e->run_time + window + 1e-6) violation(b, cycle, "session pump time longer than the timer");
+		if(e->session_timer > 0) sessions++;
+	}
+	if(e->timer_running != v->running[BAY_TIMER] || e->pump_running != v->running[BAY_PUMP]) {
+		violation(b, cycle, "event running flags disagree with its starts and stops");
+	}
+	if(e->timer_time < 0 || e->pump_time < -1e-6) violation(b, cycle, "negative session so far");
+}
+
+int main(int argc, char **argv) {
+	int bayCount = 4096;
+
+	int opt;
+	while((opt = getopt(argc, argv, "n:c:r:m:s:h")) != -1) {
+		switch(opt) {
+			case 'n': bayCount = atoi(optarg); break;
+			case 'c': cycles = atol(optarg); break;
+			case 'r': relayWindow = atoi(optarg); break;
+			case 'm': coinWindow = atoi(optarg); break;
+			case 's': rngState = strtoull(optarg, NULL, 10) | 1; break;
+			default:
+				fprintf(stderr, "usage: %s [-n bays] [-c cycles] [-r relay window] [-m coin window] [-s seed]\n", argv[0]);
+				exit(opt == 'h' ? 0 : 1);
+		}
+	}
+	if(bayCount < 1 || cycles < 1 || relayWindow < 0 || coinWindow < 0) {
+		fprintf(stderr, "bays and cycles must be positive, windows not negative\n");
+		exit(1);
+	}
+
+	struct virtual_bay *vbays = calloc(bayCount, sizeof(*vbays));
+	struct bay_table bays;
+	unsigned *levels = malloc(bayCount * sizeof(*levels));
+	int *counts = malloc(bayCount * sizeof(*counts));
+	struct bay_event *events = malloc((size_t)bayCount * BAY_MAX_EVENTS * sizeof(*events));
+	if(vbays == NULL || levels == NULL || counts == NULL || events == NULL || bay_table_init(&bays, bayCount) < 0) {
+		fprintf(stderr, "out of memory for %d bays\n", bayCount);
+		exit(1);
+	}
+	struct bay_windows windows = {.relay = relayWindow, .maintenance = coinWindow};
+	int b;
+	for(b = 0; b < bayCount; b++) enter(&vbays[b], PHASE_IDLE, 0);
+
+	// the clock the state machine sees, one sample period a cycle
+	struct timespec t = {1000, 0};
+	long totalEvents = 0;
+	double stepping = 0;
+	long cycle;
+	for(cycle = 0; cycle < cycles; cycle++) {
+		for(b = 0; b < bayCount; b++) levels[b] = next_levels(&vbays[b], cycle);
+
+		// only the sweep itself is timed
+		double start = now_seconds();
+		for(b = 0; b < bayCount; b++) {
+			counts[b] = bay_step(&bays, b, levels[b], &t, &windows, &events[b * BAY_MAX_EVENTS]);
+		}
+		stepping += now_seconds() - start;
+
+		for(b = 0; b < bayCount; b++) {
+			int e;
+			for(e = 0; e < counts[b]; e++) check_event(&vbays[b], b, cycle, &events[b * BAY_MAX_EVENTS + e]);
+			totalEvents += counts[b];
+		}
+
+		t.tv_nsec += SAMPLE_PERIOD_NS;
+		if(t.tv_nsec >= 1000000000) {
+			t.tv_nsec -= 1000000000;
+			t.tv_sec++;
+		}
+	}
+
+	long pulses = 0, inserts = 0;
+	uint64_t rejected[BAY_INPUTS] = {0};
+	for(b = 0; b < bayCount; b++) {
+		int input;
+		for(input = 0; input < BAY_INPUTS; input++) rejected[input] += bays.rejected[b][input];
+		if(vbays[b].inserts != vbays[b].pulses) violation(b, cycles, "inserts counted differ from coin pulses");
+		pulses += vbays[b].pulses;
+		inserts += vbays[b].inserts;
+	}
+
+	double steps = (double)bayCount * cycles;
+	printf("%d bays x %ld cycles (windows: relay %d, coin %d cycles)\n", bayCount, cycles, relayWindow, coinWindow);
+	printf("  bay steps:  %.0f in %.3f s, %.1f ns per bay-step\n", steps, stepping, stepping * 1e9 / steps);
+	printf("  events:     %ld, %.0f events/sec\n", totalEvents, stepping > 0 ? totalEvents / stepping : 0);
+	printf("  sessions:   %ld recorded, %ld of %ld coin pulses counted\n", sessions, inserts, pulses);
+	printf("  rejected:   %" PRIu64 " timer, %" PRIu64 " pump, %" PRIu64 " coin glitches shorter than their window\n",
+		rejected[BAY_TIMER], rejected[BAY_PUMP], rejected[BAY_MAINTENANCE]);
+	printf("  properties: %s (%ld violations)\n", violations == 0 ? "hold" : "VIOLATED", violations);
+
+	bay_table_free(&bays);
+	free(events);
+	free(counts);
+	free(levels);
+	free(vbays);
+	return violations == 0 ? 0 : 1;
+}
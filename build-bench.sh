@@ -0,0 +1,13 @@
+# builds the monitor without wiringPi so the main loop can be benchmarked on any linux box
+# usage: ./cwmonitor-bench -s sim-schedule.txt -b 100000 [-d conninfo]
+#        ./cw-dbbench [-d conninfo] [-n statements] [-b batch size]
+#        ./cw-baybench [-n bays] [-c cycles]
+#        ./cw-loadgen -d "dbname=carwash_load" [-n bays] [-D seconds] > report.json
+#        ./cw-tail [-q] [-w ms per record] socket   (a subscriber for cwmonitor-bench -S socket)
+cd "$(dirname "$0")"
+gcc monitor.c gpio_cdev.c gpio_sim.c gpio_trace.c dbwriter.c metrics.c stream.c forward.c service.c journal.c config.c status.c latency.c trace.c bay.c schema.c -Wall -O2 -pthread -o cwmonitor-bench -I`pg_config --includedir` -L`pg_config --libdir` -lpq -lm -lrt
+gcc dbbench.c dbwriter.c metrics.c service.c journal.c latency.c -Wall -O2 -pthread -o cw-dbbench -I`pg_config --includedir` -L`pg_config --libdir` -lpq -lm
+gcc baybench.c bay.c -Wall -O2 -o cw-baybench -lm
+gcc loadgen.c bay.c dbwriter.c metrics.c service.c journal.c latency.c schema.c -Wall -O2 -pthread -o cw-loadgen -I`pg_config --includedir` -L`pg_config --libdir` -lpq -lm
+gcc streamtail.c latency.c -Wall -O2 -o cw-tail -lm
+cd -
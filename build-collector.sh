@@ -0,0 +1,5 @@
+# builds the central collector that every site's monitor forwards to (collector in carwash.conf)
+# usage: ./cw-collector [-d conninfo] [-l [host:]port]
+cd "$(dirname "$0")"
+gcc collector.c service.c -Wall -O2 -o cw-collector -I`pg_config --includedir` -L`pg_config --libdir` -lpq
+cd -
@@ -1,3 +1,5 @@
 cd /home/pi/app
-gcc gui.c -o cw-gui -I/usr/include/postgresql -L/usr/lib/arm-linux/gnueabihf -lpq -lncurses -lm -ldl
+gcc gui.c config.c status.c dashboard.c -o cw-gui -I/usr/include/postgresql -L/usr/lib/arm-linux/gnueabihf -lpq -lncurses -lm -lrt -ldl
+# the same dashboard for browsers: ./cw-web [-f config] [-d conninfo] [-l [host:]port], then http://<pi>:8080/
+gcc web.c config.c status.c dashboard.c service.c -Wall -O2 -o cw-web -I/usr/include/postgresql -L/usr/lib/arm-linux/gnueabihf -lpq -lm -lrt
 cd -
@@ -1,4 +1,5 @@
 cd /home/pi/app
 #gcc test.c -Wall -o test `pkg-config --cflags --libs glib-2.0` -lwiringPi -I/usr/include/postgresql -L/usr/lib/arm-linux/gnueabihf -lpq
-gcc monitor.c -Wall -o cwmonitor -lwiringPi -I/usr/include/postgresql -L/usr/lib/arm-linux/gnueabihf -lpq -lm -ldl
+gcc monitor.c gpio_wiringpi.c gpio_cdev.c gpio_sim.c gpio_trace.c dbwriter.c metrics.c stream.c forward.c service.c journal.c config.c status.c latency.c trace.c bay.c schema.c -Wall -pthread -DHAVE_WIRINGPI -o cwmonitor -lwiringPi -I/usr/include/postgresql -L/usr/lib/arm-linux/gnueabihf -lpq -lm -lrt -ldl
+gcc streamtail.c latency.c -Wall -O2 -o cw-tail -lm
 cd -
@@ -0,0 +1,526 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <libpq-fe.h>
+#include "forward.h"
+#include "service.h"
+
+/*
+	MULTI-SITE COLLECTOR
+	takes the sessions and maintenance inserts every site's monitor forwards
+	(collector and site in its config, forward.h) and loads them into one
+	central database, one list partition per site.
+
+	one thread, one poll loop, one database connection. every batch that
+	finished arriving during a wakeup, from every site, goes in together:
+	one COPY into staging, one INSERT ... ON CONFLICT DO NOTHING per table,
+	each site's acked_seq moved forward, one COMMIT, and only then is each
+	batch acknowledged. a batch that arrives twice (the monitor resends
+	anything it did not see acknowledged) is thrown away row by row on the
+	(site, bay, timestamp) keys.
+
+	usage: cw-collector [-d conninfo] [-l [host:]port]
+*/
+
+#define COLLECTOR_MAX_CLIENTS 64
+#define COLLECTOR_MESSAGE_MAX (FORWARD_BATCH_HEADER_SIZE + FORWARD_BATCH_MAX * FORWARD_RECORD_SIZE)
+// connecting, the TCP handshake and authentication included
+#define COLLECTOR_CONNECT_TIMEOUT_SECONDS 10
+#define RECONNECT_MAX_SECONDS 60
+
+static volatile sig_atomic_t stopProgram = 0;
+
+static void sig_handler(int signo) {
+	stopProgram = 1;
+}
+
+static const char *SCHEMA =
+	// timestamps are TIMESTAMPTZ here, sites need not share a time zone
+	"CREATE TABLE IF NOT EXISTS collected_sessions (site TEXT NOT NULL, bay INT NOT NULL, timer_time NUMERIC(14,2), pump_time NUMERIC(14,2), "
+		"timestamp TIMESTAMPTZ NOT NULL, started_at TIMESTAMPTZ, journal_id BIGINT NOT NULL, seq BIGINT NOT NULL, "
+		"collected_at TIMESTAMPTZ NOT NULL DEFAULT current_timestamp, PRIMARY KEY (site, bay, timestamp)) PARTITION BY LIST (site);"
+	"CREATE TABLE IF NOT EXISTS collected_maintenance_inserts (site TEXT NOT NULL, bay INT NOT NULL, "
+		"timestamp TIMESTAMPTZ NOT NULL, journal_id BIGINT NOT NULL, seq BIGINT NOT NULL, "
+		"collected_at TIMESTAMPTZ NOT NULL DEFAULT current_timestamp, PRIMARY KEY (site, bay, timestamp)) PARTITION BY LIST (site);"
+	// how far each site's journal has been committed, where its monitor resumes after a reconnect
+	"CREATE TABLE IF NOT EXISTS collector_sites (site TEXT NOT NULL, journal_id BIGINT NOT NULL, acked_seq BIGINT NOT NULL DEFAULT 0, "
+		"last_seen TIMESTAMPTZ NOT NULL DEFAULT current_timestamp, PRIMARY KEY (site, journal_id));"
+	"CREATE OR REPLACE FUNCTION collector_site_partitions(name TEXT) RETURNS void AS $$ "
+	"DECLARE tbl TEXT; BEGIN "
+		"FOREACH tbl IN ARRAY ARRAY['collected_sessions', 'collected_maintenance_inserts'] LOOP "
+			"CONTINUE WHEN to_regclass(tbl || '_' || name) IS NOT NULL; "
+			"EXECUTE format('CREATE TABLE %I PARTITION OF %I FOR VALUES IN (%L)', tbl || '_' || name, tbl, name); "
+		"END LOOP; "
+	"END $$ LANGUAGE plpgsql;"
+	// staging for COPY, private to this connection and emptied by every commit
+	"CREATE TEMP TABLE IF NOT EXISTS collector_staging (site TEXT, journal_id BIGINT, seq BIGINT, kind INT, bay INT, "
+		"wall_ns BIGINT, start_ns BIGINT, timer_time NUMERIC(14,2), pump_time NUMERIC(14,2)) ON COMMIT DELETE ROWS;";
+
+// nanoseconds since the epoch to a timestamp, in whole microseconds with no floating point on the way
+#define NS_TIMESTAMP(column) "'epoch'::timestamptz + (" column " / 1000) * interval '1 microsecond'"
+
+static const char *APPLY_SESSIONS =
+	"INSERT INTO collected_sessions (site, bay, timer_time, pump_time, timestamp, started_at, journal_id, seq) "
+	"SELECT site, bay, timer_time, pump_time, " NS_TIMESTAMP("wall_ns") ", "
+	"CASE WHEN start_ns = 0 THEN NULL ELSE " NS_TIMESTAMP("start_ns") " END, journal_id, seq "
+	"FROM collector_staging WHERE kind = 1 ORDER BY site, seq ON CONFLICT DO NOTHING;";
+static const char *APPLY_INSERTS =
+	"INSERT INTO collected_maintenance_inserts (site, bay, timestamp, journal_id, seq) "
+	"SELECT site, bay, " NS_TIMESTAMP("wall_ns") ", journal_id, seq "
+	"FROM collector_staging WHERE kind = 2 ORDER BY site, seq ON CONFLICT DO NOTHING;";
+static const char *ACK_SITE =
+	"INSERT INTO collector_sites (site, journal_id, acked_seq) VALUES ($1, $2::bigint, $3::bigint) "
+	"ON CONFLICT (site, journal_id) DO UPDATE SET acked_seq = GREATEST(collector_sites.acked_seq, EXCLUDED.acked_seq), last_seen = current_timestamp;";
+
+enum client_state {
+	CLIENT_HELLO,           // reading the hello
+	CLIENT_HEADER,          // reading a batch header
+	CLIENT_RECORDS,         // reading the records the header announced
+	CLIENT_READY,           // a whole batch waiting for the next commit
+};
+
+/*
+	LAYOUT: one slot per connected monitor, fd -1 when free
+	buffer holds the message being read, have bytes of want
+*/
+struct client {
+	int fd;
+	enum client_state state;
+	char site[FORWARD_SITE_SIZE];
+	int64_t journal_id;
+	uint32_t count;
+	uint64_t last_seq;
+	size_t have;
+	size_t want;
+	uint8_t buffer[COLLECTOR_MESSAGE_MAX];
+};
+static struct client clients[COLLECTOR_MAX_CLIENTS];
+
+static uint64_t batches = 0;
+static uint64_t commits = 0;
+static uint64_t received = 0;
+static uint64_t inserted = 0;
+static uint64_t dbErrors = 0;
+
+static bool pg_bad_result(PGresult *res) {
+	return (PQresultStatus(res) != PGRES_COMMAND_OK) ? true : false;
+}
+
+static double monotonic_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+	DATABASE
+	one connection. connecting goes through PQconnectStart/PQconnectPoll in
+	the same poll loop as the sites, with a timeout and a backoff between
+	attempts, so an unreachable database never holds the sites up and a
+	hello never starts a connection of its own: without one it is answered
+	FORWARD_UNAVAILABLE and the monitor tries again later (a host name in
+	conninfo is still looked up blocking, hostaddr avoids that). once
+	connected the schema, the hellos and the group commits are sent one
+	blocking statement at a time
+*/
+static PGconn *conn = NULL;
+// PQconnectPoll still has to be called, connectWant says when the socket is ready for it
+static bool connecting = false;
+static PostgresPollingStatusType connectWant = PGRES_POLLING_WRITING;
+static double connectStarted = 0;
+static double nextConnect = 0;
+static double backoff = 1;
+
+// the connection is gone (the caller has said why), the next attempt waits out the backoff
+static void db_lost(void) {
+	if(conn != NULL) PQfinish(conn);
+	conn = NULL;
+	connecting = false;
+	nextConnect = monotonic_now() + backoff;
+	backoff = (backoff * 2 > RECONNECT_MAX_SECONDS) ? RECONNECT_MAX_SECONDS : backoff * 2;
+}
+
+static void db_connect(const char *conninfo) {
+	if(conn != NULL || monotonic_now() < nextConnect) return;
+	conn = PQconnectStart(conninfo);
+	if(conn == NULL || PQstatus(conn) == CONNECTION_BAD) {
+		fprintf(stderr, "PG_ERROR: %s", conn != NULL ? PQerrorMessage(conn) : "out of memory\n");
+		db_lost();
+		return;
+	}
+	connecting = true;
+	connectWant = PGRES_POLLING_WRITING;
+	connectStarted = monotonic_now();
+}
+
+// the socket is ready for the next step of connecting, once connected the schema goes in
+static void db_connect_poll(void) {
+	connectWant = PQconnectPoll(conn);
+	if(connectWant == PGRES_POLLING_FAILED) {
+		fprintf(stderr, "PG_ERROR: %s", PQerrorMessage(conn));
+		db_lost();
+		return;
+	}
+	if(connectWant != PGRES_POLLING_OK) return;
+	connecting = false;
+	PGresult *res = PQexec(conn, SCHEMA);
+	if(pg_bad_result(res)) {
+		fprintf(stderr, "PG_ERROR: could not set up the collector tables: %s", PQerrorMessage(conn));
+		PQclear(res);
+		db_lost();
+		return;
+	}
+	PQclear(res);
+	backoff = 1;
+	printf("CONNECTED: %s\n", PQdb(conn));
+}
+
+// PQconnectPoll has no timeout of its own (connect_timeout only applies to PQconnectdb)
+static void db_connect_timeout(void) {
+	if(!connecting || monotonic_now() - connectStarted < COLLECTOR_CONNECT_TIMEOUT_SECONDS) return;
+	fprintf(stderr, "COLLECTOR: no connection to the database after %d s\n", COLLECTOR_CONNECT_TIMEOUT_SECONDS);
+	db_lost();
+}
+
+// a statement failed: a connection that went with it is given up, db_connect starts another
+static void db_failed(void) {
+	fprintf(stderr, "PG_ERROR: %s", PQerrorMessage(conn));
+	if(PQstatus(conn) == CONNECTION_BAD) db_lost();
+}
+
+static void drop(struct client *c) {
+	close(c->fd);
+	c->fd = -1;
+}
+
+static int reply(struct client *c, uint32_t status, uint64_t acked) {
+	uint8_t message[FORWARD_REPLY_SIZE];
+	forward_put32(message, FORWARD_MAGIC);
+	forward_put32(message + 4, status);
+	forward_put64(message + 8, acked);
+	// sixteen bytes into an empty socket buffer, the monitor waits for each reply before sending more
+	return send(c->fd, message, sizeof(message), MSG_NOSIGNAL | MSG_DONTWAIT) == sizeof(message) ? 0 : -1;
+}
+
+// the site's partitions exist and its row says where to resume, -1 without a database
+static int64_t site_resume(const char *site, int64_t journalId) {
+	if(conn == NULL || connecting) return -1;
+	char journal[24];
+	snprintf(journal, sizeof(journal), "%" PRId64, journalId);
+	const char *params[2] = {site, journal};
+	PGresult *res = PQexecParams(conn, "SELECT collector_site_partitions($1);", 1, NULL, params, NULL, NULL, 0);
+	if(PQresultStatus(res) != PGRES_TUPLES_OK) {
+		fprintf(stderr, "COLLECTOR: could not make partitions for site %s\n", site);
+		PQclear(res);
+		db_failed();
+		return -1;
+	}
+	PQclear(res);
+	res = PQexecParams(conn, "SELECT acked_seq FROM collector_sites WHERE site = $1 AND journal_id = $2::bigint;", 2, NULL, params, NULL, NULL, 0);
+	if(PQresultStatus(res) != PGRES_TUPLES_OK) {
+		PQclear(res);
+		db_failed();
+		return -1;
+	}
+	int64_t acked = (PQntuples(res) > 0) ? strtoll(PQgetvalue(res, 0, 0), NULL, 10) : 0;
+	PQclear(res);
+	return acked;
+}
+
+static void hello(struct client *c) {
+	const uint8_t *p = c->buffer;
+	memcpy(c->site, p + 16, FORWARD_SITE_SIZE);
+	c->site[FORWARD_SITE_SIZE - 1] = '\0';
+	c->journal_id = (int64_t)forward_get64(p + 8);
+	if(forward_get32(p) != FORWARD_MAGIC || forward_get32(p + 4) != FORWARD_VERSION || !forward_valid_site(c->site)) {
+		fprintf(stderr, "COLLECTOR: refused a hello that is not a version %d forwarder with a good site name\n", FORWARD_VERSION);
+		reply(c, FORWARD_BAD_HELLO, 0);
+		drop(c);
+		return;
+	}
+	int64_t acked = site_resume(c->site, c->journal_id);
+	if(acked < 0) {
+		reply(c, FORWARD_UNAVAILABLE, 0);
+		drop(c);
+		return;
+	}
+	if(reply(c, FORWARD_OK, acked) < 0) {
+		drop(c);
+		return;
+	}
+	printf("SITE %s: journal %" PRId64 " resumes after seq %" PRId64 "\n", c->site, c->journal_id, acked);
+	c->state = CLIENT_HEADER;
+	c->have = 0;
+	c->want = FORWARD_BATCH_HEADER_SIZE;
+}
+
+// NUMERIC(14,2) holds under 10^12 seconds, and NaN or infinity has no place in a total
+static bool valid_seconds(double seconds) {
+	return isfinite(seconds) && seconds >= 0 && seconds < 1e12;
+}
+
+/*
+	every record of a batch that just arrived makes sense, so the group
+	commit only ever sees good rows: a bad one costs its own site the
+	connection, not every other site its commit
+*/
+static bool batch_valid(const struct client *c) {
+	uint32_t r;
+	for(r = 0; r < c->count; r++) {
+		struct forward_record record;
+		forward_decode_record(c->buffer + FORWARD_BATCH_HEADER_SIZE + r * FORWARD_RECORD_SIZE, &record);
+		if((record.kind != FORWARD_SESSION && record.kind != FORWARD_INSERT) || record.bay == 0 || record.seq > c->last_seq
+			|| !valid_seconds(record.timer_time) || !valid_seconds(record.pump_time)) {
+			fprintf(stderr, "SITE %s: bad record at seq %" PRIu64 "\n", c->site, record.seq);
+			return false;
+		}
+	}
+	return true;
+}
+
+// read what the client has sent, moving it along its states. -1 when it has to go
+static int client_read(struct client *c) {
+	while(c->state != CLIENT_READY) {
+		ssize_t n = recv(c->fd, c->buffer + c->have, c->want - c->have, MSG_DONTWAIT);
+		if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return 0;
+		if(n <= 0) return -1;
+		c->have += n;
+		if(c->have < c->want) continue;
+
+		if(c->state == CLIENT_HELLO) {
+			hello(c);
+			if(c->fd < 0) return 0;
+		} else if(c->state == CLIENT_HEADER) {
+			c->count = forward_get32(c->buffer + 4);
+			c->last_seq = forward_get64(c->buffer + 8);
+			if(forward_get32(c->buffer) != FORWARD_MAGIC || c->count > FORWARD_BATCH_MAX) {
+				fprintf(stderr, "SITE %s: bad batch header\n", c->site);
+				return -1;
+			}
+			c->want += c->count * FORWARD_RECORD_SIZE;
+			c->state = (c->count > 0) ? CLIENT_RECORDS : CLIENT_READY;
+		} else {
+			if(!batch_valid(c)) return -1;
+			c->state = CLIENT_READY;
+		}
+	}
+	return 0;
+}
+
+// the rows of every ready batch as COPY text (checked by batch_valid as they arrived)
+static int copy_batches(void) {
+	PGresult *res = PQexec(conn, "COPY collector_staging FROM STDIN;");
+	bool started = (PQresultStatus(res) == PGRES_COPY_IN);
+	PQclear(res);
+	if(!started) return -1;
+
+	char buffer[8192];
+	int used = 0, i;
+	uint32_t r;
+	bool failed = false;
+	for(i = 0; i < COLLECTOR_MAX_CLIENTS && !failed; i++) {
+		struct client *c = &clients[i];
+		if(c->fd < 0 || c->state != CLIENT_READY) continue;
+		for(r = 0; r < c->count && !failed; r++) {
+			struct forward_record record;
+			forward_decode_record(c->buffer + FORWARD_BATCH_HEADER_SIZE + r * FORWARD_RECORD_SIZE, &record);
+			used += sprintf(buffer + used, "%s\t%" PRId64 "\t%" PRIu64 "\t%d\t%d\t%" PRId64 "\t%" PRId64 "\t%lf\t%lf\n", c->site, c->journal_id,
+				record.seq, record.kind, record.bay, record.wall_ns, record.start_ns, record.timer_time, record.pump_time);
+			// room for one more row
+			if(used > (int)sizeof(buffer) - 256) {
+				failed = (PQputCopyData(conn, buffer, used) != 1);
+				used = 0;
+			}
+		}
+	}
+	if(!failed && used > 0) failed = (PQputCopyData(conn, buffer, used) != 1);
+	if(PQputCopyEnd(conn, failed ? "cancelled" : NULL) != 1) failed = true;
+
+	while((res = PQgetResult(conn)) != NULL) {
+		if(pg_bad_result(res)) failed = true;
+		PQclear(res);
+	}
+	return failed ? -1 : 0;
+}
+
+static int apply(const char *sql, uint64_t *rows) {
+	PGresult *res = PQexec(conn, sql);
+	if(pg_bad_result(res)) {
+		PQclear(res);
+		return -1;
+	}
+	*rows += strtoull(PQcmdTuples(res), NULL, 10);
+	PQclear(res);
+	return 0;
+}
+
+/*
+	GROUP COMMIT
+	everything that is ready goes in one transaction, acknowledged after the
+	COMMIT. on any failure nothing is acknowledged and those monitors are
+	disconnected, they resend from their acked_seq once they are back
+*/
+static void commit_ready(void) {
+	int i, ready = 0;
+	uint64_t rows = 0;
+	for(i = 0; i < COLLECTOR_MAX_CLIENTS; i++) {
+		if(clients[i].fd >= 0 && clients[i].state == CLIENT_READY) {
+			ready++;
+			rows += clients[i].count;
+		}
+	}
+	if(ready == 0) return;
+
+	bool failed = (conn == NULL || connecting);
+	uint64_t added = 0;
+	if(!failed) {
+		PGresult *res = PQexec(conn, "BEGIN;");
+		failed = pg_bad_result(res);
+		PQclear(res);
+	}
+	if(!failed && rows > 0) {
+		failed = copy_batches() < 0 || apply(APPLY_SESSIONS, &added) < 0 || apply(APPLY_INSERTS, &added) < 0;
+	}
+	for(i = 0; i < COLLECTOR_MAX_CLIENTS && !failed; i++) {
+		struct client *c = &clients[i];
+		if(c->fd < 0 || c->state != CLIENT_READY) continue;
+		char journal[24], seq[24];
+		snprintf(journal, sizeof(journal), "%" PRId64, c->journal_id);
+		snprintf(seq, sizeof(seq), "%" PRIu64, c->last_seq);
+		const char *params[3] = {c->site, journal, seq};
+		PGresult *res = PQexecParams(conn, ACK_SITE, 3, NULL, params, NULL, NULL, 0);
+		failed = pg_bad_result(res);
+		PQclear(res);
+	}
+	if(!failed) {
+		PGresult *res = PQexec(conn, "COMMIT;");
+		failed = pg_bad_result(res);
+		PQclear(res);
+	}
+
+	if(failed) {
+		dbErrors++;
+		if(conn != NULL && !connecting) {
+			db_failed();
+			if(conn != NULL) PQclear(PQexec(conn, "ROLLBACK;"));
+		}
+		fprintf(stderr, "COLLECTOR: %d batches not committed, their sites will resend\n", ready);
+	} else {
+		commits++;
+		batches += ready;
+		received += rows;
+		inserted += added;
+	}
+	for(i = 0; i < COLLECTOR_MAX_CLIENTS; i++) {
+		struct client *c = &clients[i];
+		if(c->fd < 0 || c->state != CLIENT_READY) continue;
+		if(failed || reply(c, FORWARD_OK, c->last_seq) < 0) {
+			drop(c);
+			continue;
+		}
+		c->state = CLIENT_HEADER;
+		c->have = 0;
+		c->want = FORWARD_BATCH_HEADER_SIZE;
+	}
+}
+
+static void accept_client(int listenFd) {
+	int fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if(fd < 0) return;
+	int i;
+	for(i = 0; i < COLLECTOR_MAX_CLIENTS && clients[i].fd >= 0; i++);
+	if(i == COLLECTOR_MAX_CLIENTS) {
+		fprintf(stderr, "COLLECTOR: every slot is taken, turned a site away\n");
+		close(fd);
+		return;
+	}
+	struct client *c = &clients[i];
+	c->fd = fd;
+	c->state = CLIENT_HELLO;
+	c->site[0] = '\0';
+	c->have = 0;
+	c->want = FORWARD_HELLO_SIZE;
+}
+
+int main(int argc, char **argv) {
+	const char *conninfo = "dbname=carwash_central";
+	const char *address = "0.0.0.0:" FORWARD_DEFAULT_PORT;
+
+	int opt;
+	while((opt = getopt(argc, argv, "d:l:h")) != -1) {
+		switch(opt) {
+			case 'd': conninfo = optarg; break;
+			case 'l': address = optarg; break;
+			default:
+				fprintf(stderr, "usage: %s [-d conninfo] [-l [host:]port]\n", argv[0]);
+				exit(opt == 'h' ? 0 : 1);
+		}
+	}
+
+	int listenFd = service_listen_tcp("COLLECTOR", address, "0.0.0.0", 16);
+	if(listenFd < 0) exit(1);
+	int i;
+	for(i = 0; i < COLLECTOR_MAX_CLIENTS; i++) clients[i].fd = -1;
+
+	// no SA_RESTART, so poll returns on SIGINT
+	struct sigaction action = {.sa_handler = sig_handler};
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	printf("LISTENING: %s\n", address);
+
+	struct pollfd pfds[2 + COLLECTOR_MAX_CLIENTS];
+	int slots[2 + COLLECTOR_MAX_CLIENTS];
+	while(!stopProgram) {
+		// sites are turned away until this works
+		db_connect(conninfo);
+		db_connect_timeout();
+
+		int n = 0, dbSlot = -1;
+		pfds[n++] = (struct pollfd){listenFd, POLLIN, 0};
+		if(connecting) {
+			dbSlot = n;
+			pfds[n++] = (struct pollfd){PQsocket(conn), (connectWant == PGRES_POLLING_READING) ? POLLIN : POLLOUT, 0};
+		}
+		for(i = 0; i < COLLECTOR_MAX_CLIENTS; i++) {
+			// a client with a batch waiting sends nothing until it is acknowledged
+			if(clients[i].fd < 0 || clients[i].state == CLIENT_READY) continue;
+			slots[n] = i;
+			pfds[n++] = (struct pollfd){clients[i].fd, POLLIN, 0};
+		}
+		// without a connection, wake at least once a second to try again or give up on the attempt
+		if(poll(pfds, n, (conn == NULL || connecting) ? 1000 : -1) < 0) {
+			if(errno == EINTR) continue;
+			perror("poll");
+			break;
+		}
+		if(pfds[0].revents & POLLIN) accept_client(listenFd);
+		if(dbSlot >= 0 && pfds[dbSlot].revents != 0) db_connect_poll();
+		for(i = (dbSlot >= 0) ? 2 : 1; i < n; i++) {
+			struct client *c = &clients[slots[i]];
+			if(pfds[i].revents == 0 || c->fd < 0) continue;
+			if(client_read(c) < 0) drop(c);
+		}
+		commit_ready();
+	}
+
+	for(i = 0; i < COLLECTOR_MAX_CLIENTS; i++) {
+		if(clients[i].fd >= 0) drop(&clients[i]);
+	}
+	close(listenFd);
+	if(conn != NULL) PQfinish(conn);
+	printf("COLLECTOR: %" PRIu64 " batches in %" PRIu64 " commits, %" PRIu64 " records received, %" PRIu64 " new, %" PRIu64 " already collected, %" PRIu64 " database errors\n",
+		batches, commits, received, inserted, received - inserted, dbErrors);
+	return 0;
+}
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stddef.h>
+#include "config.h"
+#include "forward.h"
+
+// the original wiring: pins listed are wiringPi numbers (physical commented to right)
+static const int defaultBayPins[4][CONFIG_BAY_PINS] = {
+	{7, 0, 2, 3},     // 7, 11, 13, 15
+	{1, 4, 5, 6},     // 12, 16, 18, 22
+	{21, 22, 23, 24}, // 29, 31, 33, 35
+	{26, 27, 28, 29}, // 32, 36, 38, 40
+};
+
+void config_defaults(struct carwash_config *config) {
+	memset(config, 0, sizeof(*config));
+	config->bay_count = 4;
+	int i;
+	for(i = 0; i < 4; i++) {
+		memcpy(config->bay_pins[i], defaultBayPins[i], sizeof(defaultBayPins[i]));
+	}
+	for(i = 0; i < CONFIG_MAX_BAYS; i++) {
+		// a quarter a minute, a quarter a coin
+		config->price_per_minute[i] = 0.25;
+		config->coin_value[i] = 0.25;
+	}
+	config->reboot_pin = 25; // 37
+	config->wipe_pin = 14;   // 23
+
+	config->relay_debounce_ms = 200;
+	config->maintenance_debounce_ms = 50;
+	config->hold_pin_debounce_ms = 10;
+	config->runtime_refresh_ms = 100;
+	config->runtime_write_ms = 1000;
+	config->reboot_hold_ms = 1000;
+	config->shutdown_hold_ms = 5000;
+	config->wipe_hold_ms = 10000;
+	config->trace_max_kb = 16384;
+	config->copy_threshold = 64;
+	config->retention_months = 0;
+}
+
+static int bad_line(const char *path, int lineno, const char *line, FILE *f) {
+	fprintf(stderr, "CONFIG: bad line %d in %s: %s", lineno, path, line);
+	fclose(f);
+	return -1;
+}
+
+// the rest of a bay line: any of "price <$/min>" and "coin <$>"
+static bool parse_bay_options(const char *p, double *price, double *coin) {
+	char key[16];
+	double value;
+	int used;
+	while(sscanf(p, " %15s %lf%n", key, &value, &used) == 2) {
+		if(strcmp(key, "price") == 0) *price = value;
+		else if(strcmp(key, "coin") == 0) *coin = value;
+		else return false;
+		p += used;
+	}
+	return p[strspn(p, " \t\r\n")] == '\0';
+}
+
+int config_load(const char *path, struct carwash_config *config) {
+	config_defaults(config);
+	if(path == NULL) return 0;
+
+	FILE *f = fopen(path, "r");
+	if(f == NULL) {
+		fprintf(stderr, "CONFIG: could not open %s\n", path);
+		return -1;
+	}
+
+	// bay lines replace the default bays, prices fall back to the file wide ones
+	bool bayDefined[CONFIG_MAX_BAYS] = {false};
+	double bayPrice[CONFIG_MAX_BAYS], bayCoin[CONFIG_MAX_BAYS];
+	double price = config->price_per_minute[0];
+	double coin = config->coin_value[0];
+	int bayCount = 0;
+
+	char line[256];
+	int lineno = 0;
+	while(fgets(line, sizeof(line), f) != NULL) {
+		lineno++;
+		char *p = line + strspn(line, " \t");
+		if(*p == '#' || *p == '\n' || *p == '\r' || *p == '\0') continue;
+		char *comment = strchr(p, '#');
+		if(comment != NULL) *comment = '\0';
+
+		char key[32];
+		int value, used;
+		double amount;
+		if(sscanf(p, "%31s%n", key, &used) != 1) return bad_line(path, lineno, line, f);
+
+		if(strcmp(key, "bay") == 0) {
+			int bay, pins[CONFIG_BAY_PINS], rest;
+			if(sscanf(p + used, "%d %d %d %d %d%n", &bay, &pins[0], &pins[1], &pins[2], &pins[3], &rest) != 5
+				|| bay < 1 || bay > CONFIG_MAX_BAYS || bayDefined[bay - 1]) {
+				return bad_line(path, lineno, line, f);
+			}
+			bayPrice[bay - 1] = -1;
+			bayCoin[bay - 1] = -1;
+			if(!parse_bay_options(p + used + rest, &bayPrice[bay - 1], &bayCoin[bay - 1])) {
+				return bad_line(path, lineno, line, f);
+			}
+			memcpy(config->bay_pins[bay - 1], pins, sizeof(pins));
+			bayDefined[bay - 1] = true;
+			if(bay > bayCount) bayCount = bay;
+		} else if(strcmp(key, "expander") == 0) {
+			int base, address;
+			char kind[16];
+			if(sscanf(p + used, "%15s %d %i", kind, &base, &address) != 3 || strcmp(kind, "mcp23017") != 0
+				|| base < 64 || config->expander_count == CONFIG_MAX_EXPANDERS) {
+				return bad_line(path, lineno, line, f);
+			}
+			config->expanders[config->expander_count].pin_base = base;
+			config->expanders[config->expander_count].i2c_address = address;
+			config->expander_count++;
+		} else if(strcmp(key, "price") == 0 || strcmp(key, "coin") == 0) {
+			if(sscanf(p + used, "%lf", &amount) != 1 || amount < 0) return bad_line(path, lineno, line, f);
+			if(key[0] == 'p') price = amount; else coin = amount;
+		} else if(strcmp(key, "site") == 0) {
+			char site[64];
+			if(sscanf(p + used, "%63s", site) != 1 || !forward_valid_site(site)) return bad_line(path, lineno, line, f);
+			strcpy(config->site, site);
+		} else if(strcmp(key, "collector") == 0) {
+			if(sscanf(p + used, "%127s", config->collector) != 1) return bad_line(path, lineno, line, f);
+		} else {
+			static const struct {
+				const char *key;
+				size_t offset;
+			} settings[] = {
+				{"reboot_pin", offsetof(struct carwash_config, reboot_pin)},
+				{"wipe_pin", offsetof(struct carwash_config, wipe_pin)},
+				{"relay_debounce_ms", offsetof(struct carwash_config, relay_debounce_ms)},
+				{"maintenance_debounce_ms", offsetof(struct carwash_config, maintenance_debounce_ms)},
+				{"hold_pin_debounce_ms", offsetof(struct carwash_config, hold_pin_debounce_ms)},
+				{"runtime_refresh_ms", offsetof(struct carwash_config, runtime_refresh_ms)},
+				{"runtime_write_ms", offsetof(struct carwash_config, runtime_write_ms)},
+				{"reboot_hold_ms", offsetof(struct carwash_config, reboot_hold_ms)},
+				{"shutdown_hold_ms", offsetof(struct carwash_config, shutdown_hold_ms)},
+				{"wipe_hold_ms", offsetof(struct carwash_config, wipe_hold_ms)},
+				{"trace_max_kb", offsetof(struct carwash_config, trace_max_kb)},
+				{"copy_threshold", offsetof(struct carwash_config, copy_threshold)},
+				{"retention_months", offsetof(struct carwash_config, retention_months)},
+			};
+			unsigned int i;
+			for(i = 0; i < sizeof(settings) / sizeof(settings[0]); i++) {
+				if(strcmp(key, settings[i].key) == 0) break;
+			}
+			if(i == sizeof(settings) / sizeof(settings[0]) || sscanf(p + used, "%d", &value) != 1 || value < 0) {
+				return bad_line(path, lineno, line, f);
+			}
+			*(int *)((char *)config + settings[i].offset) = value;
+		}
+	}
+	fclose(f);
+
+	if(bayCount > 0) {
+		int i;
+		for(i = 0; i < bayCount; i++) {
+			if(!bayDefined[i]) {
+				fprintf(stderr, "CONFIG: %s has no line for bay %d\n", path, i + 1);
+				return -1;
+			}
+		}
+		config->bay_count = bayCount;
+	}
+
+	if(config->collector[0] != '\0' && config->site[0] == '\0') {
+		fprintf(stderr, "CONFIG: %s sets a collector but no site to forward as\n", path);
+		return -1;
+	}
+
+	// every input must be a different pin
+	int inputs[CONFIG_MAX_BAYS * CONFIG_BAY_PINS + 2];
+	int count = 0, i, j;
+	for(i = 0; i < config->bay_count; i++) {
+		config->price_per_minute[i] = (bayCount > 0 && bayPrice[i] >= 0) ? bayPrice[i] : price;
+		config->coin_value[i] = (bayCount > 0 && bayCoin[i] >= 0) ? bayCoin[i] : coin;
+		for(j = 0; j < CONFIG_BAY_PINS; j++) inputs[count++] = config->bay_pins[i][j];
+	}
+	inputs[count++] = config->reboot_pin;
+	inputs[count++] = config->wipe_pin;
+	for(i = 0; i < count; i++) {
+		for(j = i + 1; j < count; j++) {
+			if(inputs[i] == inputs[j]) {
+				fprintf(stderr, "CONFIG: pin %d is used for more than one input in %s\n", inputs[i], path);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
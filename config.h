@@ -0,0 +1,86 @@
+#ifndef CARWASH_CONFIG_H
+#define CARWASH_CONFIG_H
+
+/*
+	SITE CONFIGURATION
+	bay count, pin mapping, debounce/hold windows and per-bay pricing, read
+	once at startup by the monitor and the gui. with no file the built-in
+	defaults are the original four bay wiring.
+
+	one setting per line, # starts a comment:
+		bay <number> <timer pin> <pump pin> <coin relay pin> <maintenance pin> [price <$/min>] [coin <$>]
+		price <$/min>                default for bays that do not set their own
+		coin <$>                     value of one maintenance coin
+		reboot_pin <pin>
+		wipe_pin <pin>
+		expander mcp23017 <pin base> <i2c address>
+		relay_debounce_ms <ms>
+		maintenance_debounce_ms <ms>
+		hold_pin_debounce_ms <ms>
+		runtime_refresh_ms <ms>
+		runtime_write_ms <ms>        most often a running bay's bay_status runtime is rewritten (-t)
+		reboot_hold_ms <ms>
+		shutdown_hold_ms <ms>
+		wipe_hold_ms <ms>
+		trace_max_kb <KB>            size a pin trace (monitor -T) rolls over at
+		copy_threshold <rows>        a backlog of more sessions/inserts than this goes in by COPY, 0 never
+		retention_months <months>    whole months of history kept before the current one, 0 keeps all
+		site <name>                  this site's name at the collector, 1 to 31 of a-z, 0-9 and _
+		collector <host[:port]>      forward sessions and inserts to a cw-collector (forward.h), needs site
+
+	pins are wiringPi pin numbers, expander pins start at their pin base
+*/
+
+// every bay takes four inputs and the reboot/wipe pins two more, all in one 64 bit sample
+#define CONFIG_MAX_BAYS 15
+#define CONFIG_MAX_EXPANDERS 8
+#define CONFIG_BAY_PINS 4
+
+struct expander_config {
+	int pin_base;
+	int i2c_address;
+};
+
+struct carwash_config {
+	int bay_count;
+	/*
+		LAYOUT: bay_pins[bay][pin]
+		PIN DEFINTIONS: {
+			0: TIMER_ON_RELAY_INPUT,
+			1: PUMP_ON_RELAY_INPUT,
+			2: INSERT_COIN_RELAY_OUTPUT,
+			3: MAINTENANCE_INSERT
+		}
+	*/
+	int bay_pins[CONFIG_MAX_BAYS][CONFIG_BAY_PINS];
+	double price_per_minute[CONFIG_MAX_BAYS];
+	double coin_value[CONFIG_MAX_BAYS];
+
+	int reboot_pin;
+	int wipe_pin;
+
+	int expander_count;
+	struct expander_config expanders[CONFIG_MAX_EXPANDERS];
+
+	int relay_debounce_ms;
+	int maintenance_debounce_ms;
+	int hold_pin_debounce_ms;
+	int runtime_refresh_ms;
+	int runtime_write_ms;
+	int reboot_hold_ms;
+	int shutdown_hold_ms;
+	int wipe_hold_ms;
+
+	int trace_max_kb;
+	int copy_threshold;
+	int retention_months;
+
+	char site[32];          // FORWARD_SITE_SIZE
+	char collector[128];    // empty: no forwarding
+};
+
+void config_defaults(struct carwash_config *config);
+// defaults overridden by the file, path NULL keeps the defaults; returns -1 with a message on bad input
+int config_load(const char *path, struct carwash_config *config);
+
+#endif
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dashboard.h"
+
+void dashboard_take_status(struct dashboard_bays *bays, PGresult *res, int bayCount, double now) {
+	memset(bays->running, 0, sizeof(bays->running));
+	memset(bays->runtime_base, 0, sizeof(bays->runtime_base));
+	if(PQresultStatus(res) != PGRES_TUPLES_OK) return;
+	int x;
+	for(x = 0; x < PQntuples(res); x++) {
+		int bay = atoi(PQgetvalue(res, x, 0)) - 1;
+		if(bay < 0 || bay >= bayCount) continue;
+		bays->running[bay][0] = strcmp(PQgetvalue(res, x, 1), "f") != 0;
+		bays->running[bay][1] = strcmp(PQgetvalue(res, x, 2), "f") != 0;
+		bays->runtime_base[bay][0] = atof(PQgetvalue(res, x, 3));
+		bays->runtime_base[bay][1] = atof(PQgetvalue(res, x, 4));
+		bays->runtime_at[bay] = now;
+	}
+}
+
+void dashboard_take_totals(struct dashboard_bays *bays, PGresult *res, int bayCount) {
+	if(PQresultStatus(res) != PGRES_TUPLES_OK) return;
+	int x;
+	for(x = 0; x < PQntuples(res); x++) {
+		int bay = atoi(PQgetvalue(res, x, 0)) - 1;
+		if(bay < 0 || bay >= bayCount) continue;
+		bays->total_runtime[bay][0] = atof(PQgetvalue(res, x, 1));
+		bays->total_runtime[bay][1] = atof(PQgetvalue(res, x, 2));
+		bays->maintenance_inserts[bay] = atof(PQgetvalue(res, x, 3));
+	}
+}
+
+enum dashboard_notify_kind dashboard_parse_notify(const char *payload, int bayCount, struct dashboard_notify *out) {
+	int bay, timerRunning, pumpRunning;
+	memset(out, 0, sizeof(*out));
+	if(strcmp(payload, "r") == 0) {
+		out->kind = DASHBOARD_NOTIFY_RELOAD;
+	} else if(sscanf(payload, "%d s %d %d %lf %lf %lf", &bay, &timerRunning, &pumpRunning, &out->runtime[0], &out->runtime[1], &out->at) == 6) {
+		out->kind = DASHBOARD_NOTIFY_STATUS;
+		out->running[0] = timerRunning;
+		out->running[1] = pumpRunning;
+	} else if(sscanf(payload, "%d %c", &bay, &out->change) == 2) {
+		out->kind = DASHBOARD_NOTIFY_TOTALS;
+	} else {
+		return DASHBOARD_NOTIFY_NONE;
+	}
+	if(out->kind != DASHBOARD_NOTIFY_RELOAD) {
+		if(bay < 1 || bay > bayCount) out->kind = DASHBOARD_NOTIFY_NONE;
+		out->bay = bay - 1;
+	}
+	return out->kind;
+}
+
+void dashboard_apply_notify(struct dashboard_bays *bays, const struct dashboard_notify *notify) {
+	if(notify->kind != DASHBOARD_NOTIFY_STATUS) return;
+	bays->running[notify->bay][0] = notify->running[0];
+	bays->running[notify->bay][1] = notify->running[1];
+	bays->runtime_base[notify->bay][0] = notify->runtime[0];
+	bays->runtime_base[notify->bay][1] = notify->runtime[1];
+	bays->runtime_at[notify->bay] = notify->at;
+}
+
+enum dashboard_live_change dashboard_live_read(struct dashboard_live *live, bool checkAlive) {
+	if(live->segment == NULL && checkAlive) live->segment = status_attach();
+	if(live->segment != NULL && checkAlive && !status_alive(live->segment)) {
+		status_detach(live->segment);
+		live->segment = NULL;
+	}
+	// zeroed, the bays past the monitor's count take part in the comparison too
+	struct status_bay bays[CONFIG_MAX_BAYS];
+	memset(bays, 0, sizeof(bays));
+	int count = 0;
+	bool wasLive = live->live;
+	live->live = live->segment != NULL && status_read(live->segment, bays, &count);
+	if(!live->live) return wasLive ? DASHBOARD_LIVE_GONE : DASHBOARD_LIVE_SAME;
+	if(wasLive && count == live->count && memcmp(bays, live->bays, sizeof(bays)) == 0) return DASHBOARD_LIVE_SAME;
+	memcpy(live->bays, bays, sizeof(bays));
+	live->count = count;
+	return DASHBOARD_LIVE_CHANGED;
+}
+
+void dashboard_live_apply(const struct dashboard_live *live, struct dashboard_bays *bays, int bayCount, double now) {
+	int64_t nowNs = status_now_ns();
+	int x;
+	for(x = 0; x < bayCount; x++) {
+		bool known = x < live->count;
+		bays->running[x][0] = known && live->bays[x].timer_running;
+		bays->running[x][1] = known && live->bays[x].pump_running;
+		bays->runtime_base[x][0] = known ? status_timer_runtime(&live->bays[x], nowNs) : 0;
+		bays->runtime_base[x][1] = known ? status_pump_runtime(&live->bays[x], nowNs) : 0;
+		bays->runtime_at[x] = now;
+	}
+}
+
+void dashboard_live_close(struct dashboard_live *live) {
+	if(live->segment != NULL) status_detach(live->segment);
+	live->segment = NULL;
+	live->live = false;
+}
+
+double dashboard_runtime(const struct dashboard_bays *bays, int bay, int which, double now) {
+	double since = now - bays->runtime_at[bay];
+	if(since < 0) since = 0;
+	return bays->runtime_base[bay][which] + (bays->running[bay][which] ? since : 0);
+}
+
+void dashboard_money(const struct dashboard_bays *bays, const struct carwash_config *config, int bay, double *gross, double *maintenance) {
+	*gross = (bays->total_runtime[bay][0] / 60) * config->price_per_minute[bay];
+	*maintenance = bays->maintenance_inserts[bay] * config->coin_value[bay];
+}
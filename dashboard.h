@@ -0,0 +1,84 @@
+#ifndef CARWASH_DASHBOARD_H
+#define CARWASH_DASHBOARD_H
+
+#include <stdbool.h>
+#include <libpq-fe.h>
+#include "config.h"
+#include "status.h"
+
+/*
+	DASHBOARD DATA
+	what cw-gui and cw-web both show of every bay, and where it comes from:
+	live status from the monitor's shared memory segment (status.h) when the
+	monitor runs here, otherwise bay_status and its notifications (monitor
+	-t), and bay_totals reloaded only when a notification says they moved.
+
+	the dashboards own their connection and send the queries themselves
+	(DASHBOARD_STATUS_SQL, DASHBOARD_TOTALS_SQL) in their own poll loops,
+	this turns results, notifications and the segment into dashboard_bays
+*/
+
+#define DASHBOARD_STATUS_SQL "SELECT bay, timer_running, pump_running, timer_runtime, pump_runtime FROM bay_status ORDER BY bay ASC;"
+#define DASHBOARD_TOTALS_SQL "SELECT bay, timer_time, pump_time, maintenance_inserts FROM bay_totals ORDER BY bay ASC;"
+
+// LAYOUT: [bay][0] is the timer, [bay][1] the pump
+struct dashboard_bays {
+	bool running[CONFIG_MAX_BAYS][2];
+	// the session so far at runtime_at (wall seconds), run on locally while the bay is running
+	double runtime_base[CONFIG_MAX_BAYS][2];
+	double runtime_at[CONFIG_MAX_BAYS];
+	double total_runtime[CONFIG_MAX_BAYS][2];
+	double maintenance_inserts[CONFIG_MAX_BAYS];
+};
+
+// a DASHBOARD_STATUS_SQL result, now is the wall time it arrived. a failed one (no table, no monitor keeping it) stops every bay
+void dashboard_take_status(struct dashboard_bays *bays, PGresult *res, int bayCount, double now);
+void dashboard_take_totals(struct dashboard_bays *bays, PGresult *res, int bayCount);
+
+/*
+	one DB_NOTIFY_CHANNEL payload (dbwriter.h): a bay's status for bays,
+	while the live segment does not have them, or what to fetch again
+*/
+enum dashboard_notify_kind {
+	DASHBOARD_NOTIFY_NONE,          // not a payload this knows, or a bay past bayCount
+	DASHBOARD_NOTIFY_RELOAD,        // everything may have changed
+	DASHBOARD_NOTIFY_STATUS,        // bay's status, dashboard_apply_notify it
+	DASHBOARD_NOTIFY_TOTALS,        // bay's totals moved, change is 'c' for a session and 'i' for a maintenance insert
+};
+struct dashboard_notify {
+	enum dashboard_notify_kind kind;
+	int bay;                        // 0 based
+	char change;
+	bool running[2];
+	double runtime[2];
+	double at;
+};
+enum dashboard_notify_kind dashboard_parse_notify(const char *payload, int bayCount, struct dashboard_notify *out);
+void dashboard_apply_notify(struct dashboard_bays *bays, const struct dashboard_notify *notify);
+
+/*
+	LIVE STATUS: the segment and the last copy taken from it. checkAlive
+	attaches to a segment that appeared and lets go of one whose monitor
+	died (one kill each), without it a read is only a copy
+*/
+struct dashboard_live {
+	const struct status_segment *segment;
+	bool live;
+	int count;
+	struct status_bay bays[CONFIG_MAX_BAYS];
+};
+enum dashboard_live_change {
+	DASHBOARD_LIVE_SAME,            // nothing new, or still no monitor
+	DASHBOARD_LIVE_CHANGED,         // the monitor published a change, dashboard_live_apply it
+	DASHBOARD_LIVE_GONE,            // the monitor went away, bay_status is all there is now
+};
+enum dashboard_live_change dashboard_live_read(struct dashboard_live *live, bool checkAlive);
+void dashboard_live_apply(const struct dashboard_live *live, struct dashboard_bays *bays, int bayCount, double now);
+void dashboard_live_close(struct dashboard_live *live);
+
+// the clocks of a bay at now (wall seconds), which 0 for the timer and 1 for the pump
+double dashboard_runtime(const struct dashboard_bays *bays, int bay, int which, double now);
+// a bay's takings from its totals and pricing
+void dashboard_money(const struct dashboard_bays *bays, const struct carwash_config *config, int bay, double *gross, double *maintenance);
+
+#endif
@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <libpq-fe.h>
+#include "dbwriter.h"
+
+/*
+	DATABASE WRITE BENCHMARK
+	runs the monitor's write path against a local postgres, once with one
+	round trip per statement and once pipelined in per-cycle batches, and
+	reports statements/sec for each. then it ingests a backlog of sessions
+	and maintenance inserts, the way the writer catches up after an outage,
+	one row per round trip, in pipelined batches and by COPY, and reports
+	rows/sec for each. everything goes into TEMP tables that shadow the real
+	ones, so the carwash data is never touched.
+
+	first, with no database needed, it times encoding a cycle's parameters
+	both ways: the writer's typed binary values against the sprintf text
+	the statements used to take. with the database it then runs the
+	statements pipelined with each encoding, the text against untyped
+	copies of them, so the difference includes the server parsing text
+	back into numbers.
+
+	usage: cw-dbbench [-d conninfo] [-n statements] [-b statements per batch] [-r backlog rows]
+*/
+
+void pg_fail(PGconn *conn, const char *what) {
+	fprintf(stderr, "PG_ERROR (%s): %s\n", what, PQerrorMessage(conn));
+	PQfinish(conn);
+	exit(1);
+}
+
+void exec_or_fail(PGconn *conn, const char *sql) {
+	PGresult *res = PQexec(conn, sql);
+	if(PQresultStatus(res) != PGRES_COMMAND_OK) {
+		PQclear(res);
+		pg_fail(conn, sql);
+	}
+	PQclear(res);
+}
+
+static double now_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+// a busy cycle: every bay refreshes its runtime, with a status change, session and coin mixed in
+static void fill_events(struct db_event *events, int count, int seed) {
+	int i;
+	for(i = 0; i < count; i++) {
+		struct db_event *e = &events[i];
+		memset(e, 0, sizeof(*e));
+		e->bay = (seed + i) % 4;
+		switch((seed + i) % 10) {
+			case 7: e->kind = DB_BAY_STATUS; e->timer_running = true; break;
+			case 8: e->kind = DB_BAY_SESSION; e->timer_time = 240; e->pump_time = 65.5; break;
+			case 9: e->kind = DB_MAINTENANCE_INSERT; break;
+			default: e->kind = DB_BAY_RUNTIME; e->timer_time = 12.5 + i; e->pump_time = 3.25; break;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &e->time);
+		clock_gettime(CLOCK_REALTIME, &e->wall);
+		if(e->kind == DB_BAY_SESSION) {
+			e->started = e->wall;
+			e->started.tv_sec -= 240;
+		}
+	}
+}
+
+// a journal backlog: three sessions to every maintenance insert
+static void fill_backlog(struct db_event *events, int count, int seed) {
+	int i;
+	for(i = 0; i < count; i++) {
+		struct db_event *e = &events[i];
+		memset(e, 0, sizeof(*e));
+		e->bay = (seed + i) % 4;
+		e->seq = seed + i + 1;
+		if((seed + i) % 4 == 3) {
+			e->kind = DB_MAINTENANCE_INSERT;
+		} else {
+			e->kind = DB_BAY_SESSION;
+			e->timer_time = 240;
+			e->pump_time = 65.5;
+		}
+		clock_gettime(CLOCK_REALTIME, &e->wall);
+		if(e->kind == DB_BAY_SESSION) {
+			e->started = e->wall;
+			e->started.tv_sec -= 240;
+		}
+	}
+}
+
+/*
+	the text parameters the writer sent before its statements were typed:
+	every value printed with sprintf for the server to parse back, sent to
+	untyped copies of the statements as it was then, so the server works
+	out every parameter's type from the SQL as well
+*/
+#define UNTYPED "UNTYPED_"
+
+struct text_params {
+	int count;
+	const char *values[DB_MAX_PARAMS];
+	char strings[DB_MAX_PARAMS][32];
+};
+
+static const char *text_value(struct text_params *params, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static const char *text_value(struct text_params *params, const char *format, ...) {
+	int n = params->count++;
+	va_list args;
+	va_start(args, format);
+	vsnprintf(params->strings[n], sizeof(params->strings[n]), format, args);
+	va_end(args);
+	params->values[n] = params->strings[n];
+	return params->values[n];
+}
+
+static const char *text_encode(const struct db_event *event, struct text_params *params) {
+	params->count = 0;
+	switch(event->kind) {
+		case DB_BAY_STATUS:
+			text_value(params, "%s", event->timer_running ? "true" : "false");
+			text_value(params, "%s", event->pump_running ? "true" : "false");
+			text_value(params, "%d", event->bay + 1);
+			return UNTYPED "UPDATE_BAY_STATUS";
+		case DB_BAY_RUNTIME:
+			text_value(params, "%lf", event->timer_time);
+			text_value(params, "%lf", event->pump_time);
+			text_value(params, "%d", event->bay + 1);
+			return UNTYPED "UPDATE_BAY_STATUS_RUNTIME";
+		case DB_BAY_SESSION:
+			text_value(params, "%d", event->bay + 1);
+			text_value(params, "%lf", event->timer_time);
+			text_value(params, "%lf", event->pump_time);
+			text_value(params, "%ld.%06ld", (long)event->wall.tv_sec, event->wall.tv_nsec / 1000);
+			text_value(params, "%ld.%06ld", (long)event->started.tv_sec, event->started.tv_nsec / 1000);
+			return UNTYPED "BAY_SESSION_INSERT";
+		case DB_MAINTENANCE_INSERT:
+			text_value(params, "%d", event->bay + 1);
+			text_value(params, "%ld.%06ld", (long)event->wall.tv_sec, event->wall.tv_nsec / 1000);
+			return UNTYPED "MAINTENANCE_INSERT";
+	}
+	return NULL;
+}
+
+// ns per event to encode rounds passes over a cycle's worth of events
+static double time_encoding(int rounds, bool text) {
+	struct db_event events[64];
+	fill_events(events, 64, 0);
+	struct db_params binaryParams;
+	struct text_params textParams;
+	// keeps the encoding from being optimized away
+	volatile int sink = 0;
+	int r, i;
+	double start = now_seconds();
+	for(r = 0; r < rounds; r++) {
+		for(i = 0; i < 64; i++) {
+			if(text) {
+				text_encode(&events[i], &textParams);
+				sink += textParams.count;
+			} else {
+				db_encode_event(&events[i], &binaryParams);
+				sink += binaryParams.count;
+			}
+		}
+	}
+	return (now_seconds() - start) * 1e9 / ((double)rounds * 64);
+}
+
+// the statements pipelined in batches, with either encoding
+static double run_encoded(PGconn *conn, int total, int batchSize, bool text) {
+	struct db_event *events = malloc(batchSize * sizeof(*events));
+	struct db_params binaryParams;
+	struct text_params textParams;
+	if(PQpipelineStatus(conn) == PQ_PIPELINE_OFF && PQenterPipelineMode(conn) == 0) pg_fail(conn, "pipeline");
+	int done = 0, i;
+	double start = now_seconds();
+	while(done < total) {
+		int n = (total - done < batchSize) ? total - done : batchSize;
+		fill_events(events, n, done);
+		for(i = 0; i < n; i++) {
+			int sent;
+			if(text) {
+				const char *name = text_encode(&events[i], &textParams);
+				sent = PQsendQueryPrepared(conn, name, textParams.count, textParams.values, NULL, NULL, 0);
+			} else {
+				const char *name = db_encode_event(&events[i], &binaryParams);
+				sent = PQsendQueryPrepared(conn, name, binaryParams.count, binaryParams.values, binaryParams.lengths, binaryParams.formats, 0);
+			}
+			if(!sent) pg_fail(conn, "send");
+		}
+		if(PQpipelineSync(conn) == 0) pg_fail(conn, "sync");
+		for(i = 0; i < n; i++) {
+			PGresult *res = PQgetResult(conn);
+			if(res == NULL || PQresultStatus(res) != PGRES_COMMAND_OK) {
+				PQclear(res);
+				pg_fail(conn, text ? "text parameters" : "binary parameters");
+			}
+			PQclear(res);
+			PQgetResult(conn);
+		}
+		PQclear(PQgetResult(conn));
+		done += n;
+	}
+	double elapsed = now_seconds() - start;
+	free(events);
+	return elapsed;
+}
+
+enum ingest_mode {
+	INGEST_SINGLE,
+	INGEST_PIPELINED,
+	INGEST_COPY,
+};
+
+static double ingest(PGconn *conn, int total, int batchSize, int mode) {
+	struct db_event *events = malloc(batchSize * sizeof(*events));
+	int done = 0;
+	double start = now_seconds();
+	while(done < total) {
+		int n = (total - done < batchSize) ? total - done : batchSize;
+		fill_backlog(events, n, done);
+		int failed = (mode == INGEST_COPY) ? db_copy_events(conn, events, n) : db_write_events(conn, events, n, mode == INGEST_PIPELINED);
+		if(failed < 0) pg_fail(conn, "ingest");
+		done += n;
+	}
+	double elapsed = now_seconds() - start;
+	free(events);
+	return elapsed;
+}
+
+static double run(PGconn *conn, int total, int batchSize, bool pipelined) {
+	struct db_event *events = malloc(batchSize * sizeof(*events));
+	int done = 0;
+	double start = now_seconds();
+	while(done < total) {
+		int n = (total - done < batchSize) ? total - done : batchSize;
+		fill_events(events, n, done);
+		if(db_write_events(conn, events, n, pipelined) < 0) pg_fail(conn, "write");
+		done += n;
+	}
+	double elapsed = now_seconds() - start;
+	free(events);
+	return elapsed;
+}
+
+int main(int argc, char **argv) {
+	const char *conninfo = "user=washman password=cotton dbname=carwash";
+	int total = 20000;
+	int batchSize = 8;
+	int backlog = 20000;
+
+	int opt;
+	while((opt = getopt(argc, argv, "d:n:b:r:h")) != -1) {
+		switch(opt) {
+			case 'd': conninfo = optarg; break;
+			case 'n': total = atoi(optarg); break;
+			case 'b': batchSize = atoi(optarg); break;
+			case 'r': backlog = atoi(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-d conninfo] [-n statements] [-b statements per batch] [-r backlog rows]\n", argv[0]);
+				exit(opt == 'h' ? 0 : 1);
+		}
+	}
+	if(total < 1 || batchSize < 1 || backlog < 1) {
+		fprintf(stderr, "statements, batch size and backlog must be positive\n");
+		exit(1);
+	}
+
+	int rounds = 200000;
+	double textNs = time_encoding(rounds, true);
+	double binaryNs = time_encoding(rounds, false);
+	printf("parameter encoding, %d events\n", rounds * 64);
+	printf("  text (sprintf):  %6.1f ns/event\n", textNs);
+	printf("  typed binary:    %6.1f ns/event  (%.1fx faster)\n", binaryNs, textNs / binaryNs);
+
+	PGconn *conn = PQconnectdb(conninfo);
+	if(PQstatus(conn) == CONNECTION_BAD) pg_fail(conn, "connect");
+
+	exec_or_fail(conn, "CREATE TEMP TABLE bay_status (bay INT NOT NULL, timer_running BOOLEAN NOT NULL DEFAULT FALSE, pump_running BOOLEAN NOT NULL DEFAULT FALSE, timer_runtime NUMERIC(12, 2) NOT NULL DEFAULT 0, pump_runtime NUMERIC(12, 2) NOT NULL DEFAULT 0, PRIMARY KEY (bay));");
+	exec_or_fail(conn, "INSERT INTO bay_status (bay) SELECT generate_series(1, 4);");
+	exec_or_fail(conn, "CREATE TEMP TABLE bay_sessions (id BIGSERIAL, bay INT NOT NULL, timer_time NUMERIC(14,2), pump_time NUMERIC(14,2), timestamp TIMESTAMP DEFAULT current_timestamp, started_at TIMESTAMP, PRIMARY KEY (id));");
+	exec_or_fail(conn, "CREATE TEMP TABLE bay_maintenance_inserts (id BIGSERIAL, bay INT NOT NULL, timestamp TIMESTAMP DEFAULT current_timestamp, PRIMARY KEY (id));");
+	exec_or_fail(conn, "CREATE TEMP TABLE monitor_journal (journal_id BIGINT NOT NULL, applied_seq BIGINT NOT NULL DEFAULT 0, PRIMARY KEY (journal_id));");
+	if(db_prepare_statements(conn) < 0 || db_prepare_untyped(conn, UNTYPED) < 0) pg_fail(conn, "prepare");
+
+	printf("%d statements, %d per batch\n", total, batchSize);
+
+	double single = run(conn, total, batchSize, false);
+	printf("  one per round trip: %8.0f statements/sec  (%d round trips, %.3f s)\n", total / single, total, single);
+
+	double pipelined = run(conn, total, batchSize, true);
+	int trips = (total + batchSize - 1) / batchSize;
+	printf("  pipelined batches:  %8.0f statements/sec  (%d round trips, %.3f s)\n", total / pipelined, trips, pipelined);
+
+	printf("  speedup: %.2fx\n", single / pipelined);
+
+	double textRun = run_encoded(conn, total, batchSize, true);
+	double binaryRun = run_encoded(conn, total, batchSize, false);
+	printf("  pipelined, text parameters:   %8.0f statements/sec  (%.3f s)\n", total / textRun, textRun);
+	printf("  pipelined, binary parameters: %8.0f statements/sec  (%.3f s, %.2fx)\n", total / binaryRun, binaryRun, textRun / binaryRun);
+
+	// the writer's batch sizes: 256 journal records pipelined, 2048 a COPY
+	printf("%d backlog rows (sessions and maintenance inserts)\n", backlog);
+	double oneByOne = ingest(conn, backlog, 256, INGEST_SINGLE);
+	printf("  one row per round trip: %8.0f rows/sec  (%.3f s)\n", backlog / oneByOne, oneByOne);
+	double batched = ingest(conn, backlog, 256, INGEST_PIPELINED);
+	printf("  pipelined, 256 a batch: %8.0f rows/sec  (%.3f s)\n", backlog / batched, batched);
+	double copied = ingest(conn, backlog, 2048, INGEST_COPY);
+	printf("  COPY, 2048 a transaction: %6.0f rows/sec  (%.3f s)\n", backlog / copied, copied);
+	printf("  COPY speedup: %.2fx over one row per round trip, %.2fx over pipelined\n", oneByOne / copied, batched / copied);
+
+	PQfinish(conn);
+	return 0;
+}
@@ -0,0 +1,969 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <inttypes.h>
+#include <endian.h>
+#include "dbwriter.h"
+#include "journal.h"
+#include "metrics.h"
+#include "service.h"
+
+#define DB_QUEUE_MASK (DB_QUEUE_SIZE - 1)
+
+static struct db_event ring[DB_QUEUE_SIZE];
+// head is only written by the producer, tail only by the writer thread
+static _Atomic uint32_t head = 0;
+static _Atomic uint32_t tail = 0;
+
+static _Atomic uint64_t pushed = 0;
+static _Atomic uint64_t dropped = 0;
+static _Atomic uint64_t written = 0;
+static _Atomic uint64_t coalesced = 0;
+static _Atomic uint64_t batches = 0;
+static _Atomic uint64_t copied = 0;
+static _Atomic uint64_t runtimeWritten = 0;
+static _Atomic uint64_t runtimeSuppressed = 0;
+static _Atomic uint32_t maxDepth = 0;
+static _Atomic uint64_t journalPending = 0;
+static _Atomic uint64_t journalDropped = 0;
+static _Atomic uint64_t reconnects = 0;
+static _Atomic uint64_t dbErrors = 0;
+static _Atomic uint64_t wipesApplied = 0;
+// 0 or 1, a uint64_t so the metrics endpoint can show it as a gauge
+static _Atomic uint64_t connected = 0;
+
+static sem_t wake;
+// producer only: something was pushed since the last flush
+static bool unflushed = false;
+static pthread_t writerThread;
+static atomic_bool stopping = false;
+
+// everything below belongs to the writer thread
+static const char *conninfo = NULL;
+static int (*setupDatabase)(PGconn *conn) = NULL;
+static int (*maintainDatabase)(PGconn *conn) = NULL;
+static PGconn *conn = NULL;
+static int64_t registeredJournal = 0;
+static uint64_t copyThreshold = 0;
+
+/*
+	LAYOUT: latest status/runtime row per bay, waiting to be written
+	only the newest value matters, so newer events overwrite older ones and
+	a row stays dirty across a database outage until it is written
+*/
+static struct db_event latestStatus[256];
+static struct db_event latestRuntime[256];
+static bool statusDirty[256];
+static bool runtimeDirty[256];
+static bool baySeen[256];
+
+/*
+	LAYOUT: the runtime row last written per bay
+	dashboards show whole seconds, so a running bay's row is only rewritten
+	when those change, and then no more often than runtimeInterval. a row
+	going back to zero (the session ended) is never held back. rows held
+	back stay dirty, runtimeDue is when the first of them may go
+*/
+static long runtimeShown[256][2];
+static bool runtimeKnown[256];
+static double runtimeWrittenAt[256];
+static double runtimeInterval = 0;
+static double runtimeDue = 0;
+
+/*
+	LAYOUT: event time of the journal record at seq, slot seq % DB_LATENCY_TRACK
+	kept for the records written since start, so their commit can be timed.
+	a backlog longer than this goes untimed
+*/
+#define DB_LATENCY_TRACK 4096
+static struct timespec journaledAt[DB_LATENCY_TRACK];
+static uint64_t journaledSeq[DB_LATENCY_TRACK];
+static pthread_mutex_t latencyLock = PTHREAD_MUTEX_INITIALIZER;
+static struct latency_histogram sessionLatency;
+static struct latency_histogram insertLatency;
+
+static bool pg_bad_result(PGresult *res) {
+	return (PQresultStatus(res) != PGRES_COMMAND_OK) ? true : false;
+}
+
+static bool pg_bad_data(PGresult *res) {
+	return (PQresultStatus(res) != PGRES_TUPLES_OK) ? true : false;
+}
+
+// writes return no rows, except pg_notify which returns one
+static bool pg_bad_write(PGresult *res) {
+	return pg_bad_result(res) && pg_bad_data(res);
+}
+
+bool db_queue_push(const struct db_event *event) {
+	uint32_t h = atomic_load_explicit(&head, memory_order_relaxed);
+	uint32_t t = atomic_load_explicit(&tail, memory_order_acquire);
+	if(h - t >= DB_QUEUE_SIZE) {
+		atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+		return false;
+	}
+
+	ring[h & DB_QUEUE_MASK] = *event;
+	atomic_store_explicit(&head, h + 1, memory_order_release);
+	atomic_fetch_add_explicit(&pushed, 1, memory_order_relaxed);
+
+	uint32_t depth = h + 1 - t;
+	if(depth > atomic_load_explicit(&maxDepth, memory_order_relaxed)) {
+		atomic_store_explicit(&maxDepth, depth, memory_order_relaxed);
+	}
+
+	unflushed = true;
+	return true;
+}
+
+void db_queue_flush(void) {
+	if(!unflushed) return;
+	unflushed = false;
+	// sem_post never blocks, it only wakes the writer if it is waiting
+	sem_post(&wake);
+}
+
+/*
+	TYPED STATEMENTS
+	every statement is prepared with its parameter types, and values go
+	out in binary: int4/int8 and float8 in network byte order, bools as
+	one byte. nothing is formatted on the way out and the server parses
+	no text on the way in. times are float8 epoch seconds for to_timestamp,
+	float8 seconds go into the NUMERIC columns by assignment. the notify
+	payload is the only text parameter
+*/
+#define BOOLOID 16
+#define INT8OID 20
+#define INT4OID 23
+#define TEXTOID 25
+#define FLOAT8OID 701
+
+// index into statements[], and of each statement's latency histogram
+enum statement_id {
+	STATEMENT_UPDATE_BAY_STATUS,
+	STATEMENT_UPDATE_BAY_STATUS_RUNTIME,
+	STATEMENT_BAY_SESSION_INSERT,
+	STATEMENT_MAINTENANCE_INSERT,
+	STATEMENT_BAY_NOTIFY,
+	STATEMENT_JOURNAL_APPLIED,
+	STATEMENT_COPY_SESSIONS_APPLY,
+	STATEMENT_COPY_INSERTS_APPLY,
+	STATEMENT_WIPE_HISTORY,
+	STATEMENT_COUNT,
+	STATEMENT_NONE = -1,
+};
+
+static const struct {
+	const char *name;
+	const char *sql;
+	int params;
+	Oid types[DB_MAX_PARAMS];
+} statements[STATEMENT_COUNT] = {
+	// SET UP PREPARED STATEMENT FOR BAY STATUS
+	[STATEMENT_UPDATE_BAY_STATUS] = {"UPDATE_BAY_STATUS", "UPDATE bay_status SET timer_running = $1, pump_running = $2 WHERE bay = $3;", 3, {BOOLOID, BOOLOID, INT4OID}},
+	// SET UP PREPARED STATEMENT FOR BAY STATUS RUNTIME
+	[STATEMENT_UPDATE_BAY_STATUS_RUNTIME] = {"UPDATE_BAY_STATUS_RUNTIME", "UPDATE bay_status SET timer_runtime = $1, pump_runtime = $2 WHERE bay = $3;", 3, {FLOAT8OID, FLOAT8OID, INT4OID}},
+	// SET UP PREPARED STATEMENT FOR BAY SESSIONS (started_at and timestamp are when it started and ended, not when it was written)
+	[STATEMENT_BAY_SESSION_INSERT] = {"BAY_SESSION_INSERT", "INSERT INTO bay_sessions (bay, timer_time, pump_time, timestamp, started_at) VALUES ($1, $2, $3, to_timestamp($4)::timestamp, to_timestamp($5)::timestamp);", 5,
+		{INT4OID, FLOAT8OID, FLOAT8OID, FLOAT8OID, FLOAT8OID}},
+	// SET UP PREPARED STATEMENT FOR BAY MAINTENANCE INSERTS
+	[STATEMENT_MAINTENANCE_INSERT] = {"MAINTENANCE_INSERT", "INSERT INTO bay_maintenance_inserts (bay, timestamp) VALUES ($1, to_timestamp($2)::timestamp);", 2, {INT4OID, FLOAT8OID}},
+	// SET UP PREPARED STATEMENT FOR DASHBOARD NOTIFICATIONS (delivered when the batch commits)
+	[STATEMENT_BAY_NOTIFY] = {"BAY_NOTIFY", "SELECT pg_notify('" DB_NOTIFY_CHANNEL "', $1);", 1, {TEXTOID}},
+	// SET UP PREPARED STATEMENT FOR THE JOURNAL WATERMARK (same transaction as the inserts it covers)
+	[STATEMENT_JOURNAL_APPLIED] = {"JOURNAL_APPLIED", "UPDATE monitor_journal SET applied_seq = $2 WHERE journal_id = $1 AND applied_seq < $2;", 2, {INT8OID, INT8OID}},
+	// SET UP PREPARED STATEMENTS FOR COPIED BACKLOGS (the same timestamp conversion as the single row inserts)
+	[STATEMENT_COPY_SESSIONS_APPLY] = {"COPY_SESSIONS_APPLY", "INSERT INTO bay_sessions (bay, timer_time, pump_time, timestamp, started_at) SELECT bay, timer_time, pump_time, to_timestamp(at)::timestamp, to_timestamp(started)::timestamp FROM copy_sessions ORDER BY seq;", 0, {0}},
+	[STATEMENT_COPY_INSERTS_APPLY] = {"COPY_INSERTS_APPLY", "INSERT INTO bay_maintenance_inserts (bay, timestamp) SELECT bay, to_timestamp(at)::timestamp FROM copy_inserts ORDER BY seq;", 0, {0}},
+	// SET UP PREPARED STATEMENT FOR THE WIPE PIN (constant time however long the history, the triggers zero bay_totals)
+	[STATEMENT_WIPE_HISTORY] = {"WIPE_HISTORY", "TRUNCATE bay_sessions, bay_maintenance_inserts;", 0, {0}},
+};
+
+/*
+	METRICS (metrics.h)
+	every PQexecPrepared is timed by statement. pipelined statements share
+	a round trip and have no time of their own, so batches are timed as a
+	whole by how they went in
+*/
+static const double dbSeconds[] = {0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+static struct metric_histogram statementLatency[STATEMENT_COUNT];
+enum batch_mode {
+	BATCH_PIPELINE,
+	BATCH_COPY,
+};
+static struct metric_histogram batchLatency[2];
+
+static int64_t monotonic_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static PGresult *exec_prepared(PGconn *conn, int statement, const struct db_params *params) {
+	const char *name = statements[statement].name;
+	int64_t start = monotonic_ns();
+	PGresult *res = (params != NULL)
+		? PQexecPrepared(conn, name, params->count, params->values, params->lengths, params->formats, 0)
+		: PQexecPrepared(conn, name, 0, NULL, NULL, NULL, 0);
+	metrics_observe(&statementLatency[statement], monotonic_ns() - start);
+	return res;
+}
+
+int db_prepare_statements(PGconn *conn) {
+	// staging for COPY, private to this connection and emptied by every commit
+	PGresult *res = PQexec(conn,
+		"CREATE TEMP TABLE IF NOT EXISTS copy_sessions (seq BIGINT, bay INT, timer_time NUMERIC(14,2), pump_time NUMERIC(14,2), at DOUBLE PRECISION, started DOUBLE PRECISION) ON COMMIT DELETE ROWS;"
+		"CREATE TEMP TABLE IF NOT EXISTS copy_inserts (seq BIGINT, bay INT, at DOUBLE PRECISION) ON COMMIT DELETE ROWS;");
+	if(pg_bad_result(res)) {
+		fprintf(stderr, "PG_ERROR: could not create copy staging: %s\n", PQerrorMessage(conn));
+		PQclear(res);
+		return -1;
+	}
+	PQclear(res);
+
+	unsigned int i;
+	for(i = 0; i < sizeof(statements) / sizeof(statements[0]); i++) {
+		res = PQprepare(conn, statements[i].name, statements[i].sql, statements[i].params, statements[i].types);
+		if(pg_bad_result(res)) {
+			fprintf(stderr, "PG_ERROR: could not prepare %s: %s\n", statements[i].name, PQerrorMessage(conn));
+			PQclear(res);
+			return -1;
+		}
+		PQclear(res);
+	}
+	return 0;
+}
+
+int db_prepare_untyped(PGconn *conn, const char *prefix) {
+	int i;
+	for(i = 0; i < STATEMENT_COUNT; i++) {
+		char name[64];
+		snprintf(name, sizeof(name), "%s%s", prefix, statements[i].name);
+		PGresult *res = PQprepare(conn, name, statements[i].sql, statements[i].params, NULL);
+		if(pg_bad_result(res)) {
+			fprintf(stderr, "PG_ERROR: could not prepare %s: %s\n", name, PQerrorMessage(conn));
+			PQclear(res);
+			return -1;
+		}
+		PQclear(res);
+	}
+	return 0;
+}
+
+// the next parameter's value points at its slot in words, filled in network byte order
+static char *param_slot(struct db_params *params, int length) {
+	int n = params->count++;
+	params->values[n] = (const char *)&params->words[n];
+	params->lengths[n] = length;
+	params->formats[n] = 1;
+	return (char *)&params->words[n];
+}
+
+static void param_int4(struct db_params *params, int32_t value) {
+	uint32_t wire = htobe32((uint32_t)value);
+	memcpy(param_slot(params, 4), &wire, 4);
+}
+
+static void param_int8(struct db_params *params, int64_t value) {
+	uint64_t wire = htobe64((uint64_t)value);
+	memcpy(param_slot(params, 8), &wire, 8);
+}
+
+static void param_float8(struct db_params *params, double value) {
+	uint64_t bits;
+	memcpy(&bits, &value, 8);
+	bits = htobe64(bits);
+	memcpy(param_slot(params, 8), &bits, 8);
+}
+
+static void param_bool(struct db_params *params, bool value) {
+	*param_slot(params, 1) = value ? 1 : 0;
+}
+
+static void param_time(struct db_params *params, const struct timespec *t) {
+	param_float8(params, (double)t->tv_sec + t->tv_nsec / 1e9);
+}
+
+static void param_null(struct db_params *params) {
+	int n = params->count++;
+	params->values[n] = NULL;
+	params->lengths[n] = 0;
+	params->formats[n] = 1;
+}
+
+static int encode_event(const struct db_event *event, struct db_params *params) {
+	params->count = 0;
+	switch(event->kind) {
+		case DB_BAY_STATUS:
+			param_bool(params, event->timer_running);
+			param_bool(params, event->pump_running);
+			param_int4(params, event->bay + 1);
+			return STATEMENT_UPDATE_BAY_STATUS;
+		case DB_BAY_RUNTIME:
+			param_float8(params, event->timer_time);
+			param_float8(params, event->pump_time);
+			param_int4(params, event->bay + 1);
+			return STATEMENT_UPDATE_BAY_STATUS_RUNTIME;
+		case DB_BAY_SESSION:
+			param_int4(params, event->bay + 1);
+			param_float8(params, event->timer_time);
+			param_float8(params, event->pump_time);
+			param_time(params, &event->wall);
+			// a session journaled before start times were kept stores NULL
+			if(event->started.tv_sec != 0) param_time(params, &event->started);
+			else param_null(params);
+			return STATEMENT_BAY_SESSION_INSERT;
+		case DB_MAINTENANCE_INSERT:
+			param_int4(params, event->bay + 1);
+			param_time(params, &event->wall);
+			return STATEMENT_MAINTENANCE_INSERT;
+		case DB_JOURNAL_APPLIED:
+			param_int8(params, registeredJournal);
+			param_int8(params, (int64_t)event->seq);
+			return STATEMENT_JOURNAL_APPLIED;
+		case DB_WIPE:
+			return STATEMENT_WIPE_HISTORY;
+		case DB_BAY_NOTIFY:
+			if(event->about == DB_WIPE) {
+				strcpy(params->text, "r");
+			} else if(event->about == DB_BAY_STATUS) {
+				sprintf(params->text, "%d s %d %d %.2f %.2f %ld.%03ld", event->bay + 1, event->timer_running, event->pump_running,
+					event->timer_time, event->pump_time, (long)event->wall.tv_sec, event->wall.tv_nsec / 1000000);
+			} else {
+				sprintf(params->text, "%d %c", event->bay + 1, event->about == DB_BAY_SESSION ? 'c' : 'i');
+			}
+			params->values[0] = params->text;
+			params->lengths[0] = 0;
+			params->formats[0] = 0;
+			params->count = 1;
+			return STATEMENT_BAY_NOTIFY;
+	}
+	return STATEMENT_NONE;
+}
+
+const char *db_encode_event(const struct db_event *event, struct db_params *params) {
+	int statement = encode_event(event, params);
+	return (statement == STATEMENT_NONE) ? NULL : statements[statement].name;
+}
+
+// queue one statement for the event, or run it right away when not pipelined
+static PGresult *send_event(PGconn *conn, const struct db_event *event, bool pipelined) {
+	struct db_params params;
+	int statement = encode_event(event, &params);
+	if(statement == STATEMENT_NONE) return NULL;
+
+	if(pipelined) {
+		// libpq copies the parameters into its send buffer, so the stack copies can go
+		return PQsendQueryPrepared(conn, statements[statement].name, params.count, params.values, params.lengths, params.formats, 0) ? NULL : PQmakeEmptyPGresult(conn, PGRES_FATAL_ERROR);
+	}
+	return exec_prepared(conn, statement, &params);
+}
+
+int db_write_events(PGconn *conn, const struct db_event *events, int count, bool pipelined) {
+	int i;
+	if(!pipelined) {
+		// one round trip per statement, which pipeline mode does not allow
+		if(PQpipelineStatus(conn) != PQ_PIPELINE_OFF && PQexitPipelineMode(conn) == 0) {
+			fprintf(stderr, "PG_ERROR: could not leave pipeline mode: %s\n", PQerrorMessage(conn));
+			return -1;
+		}
+		for(i = 0; i < count; i++) {
+			PGresult *res = send_event(conn, &events[i], false);
+			if(res == NULL) continue;
+			if(pg_bad_write(res)) {
+				fprintf(stderr, "PG_ERROR: %s\n", PQerrorMessage(conn));
+				PQclear(res);
+				return -1;
+			}
+			PQclear(res);
+		}
+		return 0;
+	}
+
+	/*
+		one round trip per batch: every statement goes out back to back and a
+		single sync ends the implicit transaction, so the batch commits (or
+		fails) as a whole
+	*/
+	if(PQpipelineStatus(conn) == PQ_PIPELINE_OFF && PQenterPipelineMode(conn) == 0) {
+		fprintf(stderr, "PG_ERROR: could not enter pipeline mode: %s\n", PQerrorMessage(conn));
+		return -1;
+	}
+
+	int sent = 0;
+	for(i = 0; i < count; i++) {
+		PGresult *res = send_event(conn, &events[i], true);
+		if(res != NULL) {
+			fprintf(stderr, "PG_ERROR: %s\n", PQerrorMessage(conn));
+			PQclear(res);
+			return -1;
+		}
+		sent++;
+	}
+	if(PQpipelineSync(conn) == 0) {
+		fprintf(stderr, "PG_ERROR: %s\n", PQerrorMessage(conn));
+		return -1;
+	}
+
+	int failed = 0;
+	for(i = 0; i < sent; i++) {
+		PGresult *res = PQgetResult(conn);
+		if(res == NULL) {
+			fprintf(stderr, "PG_ERROR: %s\n", PQerrorMessage(conn));
+			return -1;
+		}
+		if(pg_bad_write(res)) {
+			if(failed++ == 0) fprintf(stderr, "PG_ERROR: %s\n", PQresultErrorMessage(res));
+		}
+		PQclear(res);
+		// every statement's results end with a NULL
+		PQgetResult(conn);
+	}
+	PGresult *res = PQgetResult(conn);
+	if(res == NULL || PQresultStatus(res) != PGRES_PIPELINE_SYNC) failed++;
+	PQclear(res);
+	return (failed > 0) ? -1 : 0;
+}
+
+/*
+	COPY one kind of row into its staging table. rows are tab separated
+	text, buffered so a few thousand of them take a handful of writes
+*/
+static int copy_rows(PGconn *conn, const char *sql, uint8_t kind, const struct db_event *events, int count) {
+	PGresult *res = PQexec(conn, sql);
+	bool started = (PQresultStatus(res) == PGRES_COPY_IN);
+	PQclear(res);
+	if(!started) return -1;
+
+	char buffer[8192];
+	int used = 0, i;
+	bool failed = false;
+	for(i = 0; i < count && !failed; i++) {
+		const struct db_event *event = &events[i];
+		if(event->kind != kind) continue;
+		if(kind == DB_BAY_SESSION) {
+			used += sprintf(buffer + used, "%" PRIu64 "\t%d\t%lf\t%lf\t%ld.%06ld\t", event->seq, event->bay + 1,
+				event->timer_time, event->pump_time, (long)event->wall.tv_sec, event->wall.tv_nsec / 1000);
+			if(event->started.tv_sec != 0) used += sprintf(buffer + used, "%ld.%06ld\n", (long)event->started.tv_sec, event->started.tv_nsec / 1000);
+			else used += sprintf(buffer + used, "\\N\n");
+		} else {
+			used += sprintf(buffer + used, "%" PRIu64 "\t%d\t%ld.%06ld\n", event->seq, event->bay + 1,
+				(long)event->wall.tv_sec, event->wall.tv_nsec / 1000);
+		}
+		// room for one more row of either kind
+		if(used > (int)sizeof(buffer) - 192) {
+			failed = (PQputCopyData(conn, buffer, used) != 1);
+			used = 0;
+		}
+	}
+	if(!failed && used > 0) failed = (PQputCopyData(conn, buffer, used) != 1);
+	if(PQputCopyEnd(conn, failed ? "cancelled" : NULL) != 1) failed = true;
+
+	while((res = PQgetResult(conn)) != NULL) {
+		if(pg_bad_result(res)) failed = true;
+		PQclear(res);
+	}
+	return failed ? -1 : 0;
+}
+
+int db_copy_events(PGconn *conn, const struct db_event *events, int count) {
+	int sessions = 0, inserts = 0, i;
+	for(i = 0; i < count; i++) {
+		if(events[i].kind == DB_BAY_SESSION) sessions++;
+		else if(events[i].kind == DB_MAINTENANCE_INSERT) inserts++;
+	}
+
+	// COPY is not allowed in a pipeline
+	if(PQpipelineStatus(conn) != PQ_PIPELINE_OFF && PQexitPipelineMode(conn) == 0) {
+		fprintf(stderr, "PG_ERROR: could not leave pipeline mode: %s\n", PQerrorMessage(conn));
+		return -1;
+	}
+
+	PGresult *res = PQexec(conn, "BEGIN;");
+	bool failed = pg_bad_result(res);
+	PQclear(res);
+	if(!failed && sessions > 0) {
+		failed = copy_rows(conn, "COPY copy_sessions (seq, bay, timer_time, pump_time, at, started) FROM STDIN;", DB_BAY_SESSION, events, count) < 0;
+		if(!failed) {
+			res = exec_prepared(conn, STATEMENT_COPY_SESSIONS_APPLY, NULL);
+			failed = pg_bad_result(res);
+			PQclear(res);
+		}
+	}
+	if(!failed && inserts > 0) {
+		failed = copy_rows(conn, "COPY copy_inserts (seq, bay, at) FROM STDIN;", DB_MAINTENANCE_INSERT, events, count) < 0;
+		if(!failed) {
+			res = exec_prepared(conn, STATEMENT_COPY_INSERTS_APPLY, NULL);
+			failed = pg_bad_result(res);
+			PQclear(res);
+		}
+	}
+	// the few other statements (watermark, notifies, status rows) go one by one inside the transaction
+	for(i = 0; i < count && !failed; i++) {
+		if(events[i].kind == DB_BAY_SESSION || events[i].kind == DB_MAINTENANCE_INSERT) continue;
+		res = send_event(conn, &events[i], false);
+		if(res == NULL) continue;
+		failed = pg_bad_write(res);
+		PQclear(res);
+	}
+	if(failed) {
+		fprintf(stderr, "PG_ERROR: %s\n", PQerrorMessage(conn));
+		res = PQexec(conn, "ROLLBACK;");
+		PQclear(res);
+		return -1;
+	}
+
+	res = PQexec(conn, "COMMIT;");
+	failed = pg_bad_result(res);
+	if(failed) fprintf(stderr, "PG_ERROR: %s\n", PQerrorMessage(conn));
+	PQclear(res);
+	return failed ? -1 : 0;
+}
+
+static void wait_for_work(double seconds) {
+	struct timespec until;
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_sec += (time_t)seconds;
+	until.tv_nsec += (long)((seconds - floor(seconds)) * 1000000000.0);
+	if(until.tv_nsec >= 1000000000L) {
+		until.tv_sec++;
+		until.tv_nsec -= 1000000000L;
+	}
+	sem_timedwait(&wake, &until);
+}
+
+static double monotonic_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+/*
+	empty the ring: sessions and inserts go into the journal (and hit the
+	disk before postgres sees them), status and runtime rows are folded into
+	the latest value for their bay
+*/
+static void drain_ring(void) {
+	uint32_t t = atomic_load_explicit(&tail, memory_order_relaxed);
+	uint32_t h = atomic_load_explicit(&head, memory_order_acquire);
+	uint64_t merged = 0;
+
+	while(t != h) {
+		const struct db_event *event = &ring[t & DB_QUEUE_MASK];
+		switch(event->kind) {
+			case DB_BAY_STATUS:
+			case DB_BAY_RUNTIME: {
+				bool *dirty = (event->kind == DB_BAY_STATUS) ? statusDirty : runtimeDirty;
+				struct db_event *latest = (event->kind == DB_BAY_STATUS) ? latestStatus : latestRuntime;
+				if(dirty[event->bay]) {
+					merged++;
+					if(event->kind == DB_BAY_RUNTIME) atomic_fetch_add_explicit(&runtimeSuppressed, 1, memory_order_relaxed);
+				}
+				latest[event->bay] = *event;
+				dirty[event->bay] = true;
+				baySeen[event->bay] = true;
+				break;
+			}
+			case DB_BAY_SESSION:
+			case DB_MAINTENANCE_INSERT:
+			case DB_WIPE: {
+				struct journal_record record = {
+					.kind = event->kind,
+					.bay = event->bay,
+					.wall_ns = (int64_t)event->wall.tv_sec * 1000000000 + event->wall.tv_nsec,
+					.start_ns = (int64_t)event->started.tv_sec * 1000000000 + event->started.tv_nsec,
+					.timer_time = event->timer_time,
+					.pump_time = event->pump_time,
+				};
+				uint64_t seq = journal_append(&record);
+				if(seq == 0) {
+					if(event->kind == DB_WIPE) fprintf(stderr, "JOURNAL: full, wipe lost\n");
+					else fprintf(stderr, "JOURNAL: full, bay %d %s lost\n", event->bay + 1, event->kind == DB_BAY_SESSION ? "session" : "insert");
+				} else if(event->kind != DB_WIPE) {
+					journaledAt[seq % DB_LATENCY_TRACK] = event->time;
+					journaledSeq[seq % DB_LATENCY_TRACK] = seq;
+				}
+				break;
+			}
+		}
+		t++;
+		// hand each slot back as soon as it is copied out
+		atomic_store_explicit(&tail, t, memory_order_release);
+		h = atomic_load_explicit(&head, memory_order_acquire);
+	}
+
+	journal_sync();
+	atomic_fetch_add_explicit(&coalesced, merged, memory_order_relaxed);
+	atomic_store_explicit(&journalPending, journal_next_seq() - 1 - journal_applied_seq(), memory_order_relaxed);
+	atomic_store_explicit(&journalDropped, journal_dropped(), memory_order_relaxed);
+}
+
+/*
+	write everything outstanding: journal records the database has not got
+	yet, then every dirty status/runtime row. each batch is one round trip
+	and one transaction that also moves the journal watermark. a wipe ends
+	its batch, so it only takes what was recorded before it
+*/
+#define DB_BATCH_MAX 256
+// a backlog past the copy threshold goes in by COPY, this many journal records a transaction
+#define DB_COPY_BATCH_MAX 2048
+// journal records, status and runtime rows, a notify per bay for each of status/session/insert, the watermark
+static struct db_event batch[DB_COPY_BATCH_MAX + 2 * 256 + 3 * 256 + 1];
+
+static void add_notify(int *count, int bay, uint8_t about, const struct db_event *status) {
+	struct db_event *event = &batch[(*count)++];
+	if(status != NULL) *event = *status; else memset(event, 0, sizeof(*event));
+	event->kind = DB_BAY_NOTIFY;
+	event->bay = bay;
+	event->about = about;
+}
+
+// journal records first to last are in the database as of now
+static void record_commit_latency(uint64_t first, uint64_t last) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t nowNs = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+	uint64_t seq;
+	pthread_mutex_lock(&latencyLock);
+	for(seq = first; seq <= last; seq++) {
+		if(journaledSeq[seq % DB_LATENCY_TRACK] != seq) continue;
+		const struct timespec *at = &journaledAt[seq % DB_LATENCY_TRACK];
+		struct latency_histogram *h = (journal_get(seq)->kind == DB_BAY_SESSION) ? &sessionLatency : &insertLatency;
+		latency_record(h, nowNs - ((int64_t)at->tv_sec * 1000000000 + at->tv_nsec));
+	}
+	pthread_mutex_unlock(&latencyLock);
+}
+
+enum runtime_decision {
+	RUNTIME_WRITE,
+	RUNTIME_UNCHANGED,      // same whole seconds as the row already there
+	RUNTIME_LATER,          // changed, but the last write was too recent
+};
+
+static enum runtime_decision runtime_decide(int bay, double now) {
+	const struct db_event *latest = &latestRuntime[bay];
+	long timer = (long)floor(latest->timer_time), pump = (long)floor(latest->pump_time);
+	if(!runtimeKnown[bay]) return RUNTIME_WRITE;
+	if(timer == runtimeShown[bay][0] && pump == runtimeShown[bay][1]) return RUNTIME_UNCHANGED;
+	if(timer == 0 && pump == 0) return RUNTIME_WRITE;
+	if(now - runtimeWrittenAt[bay] < runtimeInterval) {
+		double due = runtimeWrittenAt[bay] + runtimeInterval;
+		if(runtimeDue == 0 || due < runtimeDue) runtimeDue = due;
+		return RUNTIME_LATER;
+	}
+	return RUNTIME_WRITE;
+}
+
+static int flush_to_db(void) {
+	bool updatesSent = false;
+	bool runtimeSending[256] = {false};
+	int runtimeRows = 0;
+	double now = monotonic_seconds();
+	runtimeDue = 0;
+	for(;;) {
+		int count = 0, i;
+		// one notify per bay and kind is enough, listeners reload what changed
+		bool sessionNotify[256] = {false}, insertNotify[256] = {false};
+		bool wiping = false;
+		uint64_t seq, lastSeq = journal_applied_seq();
+		bool copying = copyThreshold > 0 && journal_next_seq() - 1 - lastSeq > copyThreshold;
+		int limit = copying ? DB_COPY_BATCH_MAX : DB_BATCH_MAX;
+		for(seq = lastSeq + 1; seq < journal_next_seq() && count < limit; seq++) {
+			const struct journal_record *record = journal_get(seq);
+			struct db_event *event = &batch[count++];
+			memset(event, 0, sizeof(*event));
+			event->kind = record->kind;
+			event->seq = seq;
+			event->bay = record->bay;
+			event->wall.tv_sec = record->wall_ns / 1000000000;
+			event->wall.tv_nsec = record->wall_ns % 1000000000;
+			event->started.tv_sec = record->start_ns / 1000000000;
+			event->started.tv_nsec = record->start_ns % 1000000000;
+			event->timer_time = record->timer_time;
+			event->pump_time = record->pump_time;
+			if(record->kind == DB_BAY_SESSION) sessionNotify[record->bay] = true;
+			else if(record->kind == DB_MAINTENANCE_INSERT) insertNotify[record->bay] = true;
+			lastSeq = seq;
+			if(record->kind == DB_WIPE) {
+				wiping = true;
+				break;
+			}
+		}
+		if(!updatesSent) {
+			for(i = 0; i < 256; i++) {
+				if(statusDirty[i]) batch[count++] = latestStatus[i];
+				if(!runtimeDirty[i]) continue;
+				switch(runtime_decide(i, now)) {
+					case RUNTIME_WRITE:
+						batch[count++] = latestRuntime[i];
+						runtimeSending[i] = true;
+						runtimeRows++;
+						break;
+					case RUNTIME_UNCHANGED:
+						runtimeDirty[i] = false;
+						atomic_fetch_add_explicit(&runtimeSuppressed, 1, memory_order_relaxed);
+						break;
+					case RUNTIME_LATER:
+						break;
+				}
+			}
+		}
+		if(count == 0) return 0;
+
+		for(i = 0; i < 256; i++) {
+			if(!updatesSent && statusDirty[i]) add_notify(&count, i, DB_BAY_STATUS, &latestStatus[i]);
+			if(sessionNotify[i]) add_notify(&count, i, DB_BAY_SESSION, NULL);
+			if(insertNotify[i]) add_notify(&count, i, DB_MAINTENANCE_INSERT, NULL);
+		}
+		if(wiping) add_notify(&count, 0, DB_WIPE, NULL);
+
+		bool advances = lastSeq > journal_applied_seq();
+		if(advances) {
+			memset(&batch[count], 0, sizeof(batch[count]));
+			batch[count].kind = DB_JOURNAL_APPLIED;
+			batch[count].seq = lastSeq;
+			count++;
+		}
+
+		int rows = (int)(lastSeq - journal_applied_seq());
+		int64_t start = monotonic_ns();
+		if(copying) {
+			if(db_copy_events(conn, batch, count) < 0) return -1;
+			atomic_fetch_add_explicit(&copied, rows, memory_order_relaxed);
+		} else if(db_write_events(conn, batch, count, true) < 0) {
+			return -1;
+		}
+		metrics_observe(&batchLatency[copying ? BATCH_COPY : BATCH_PIPELINE], monotonic_ns() - start);
+
+		if(advances) {
+			record_commit_latency(journal_applied_seq() + 1, lastSeq);
+			journal_set_applied(lastSeq);
+		}
+		if(wiping) atomic_fetch_add(&wipesApplied, 1);
+		if(!updatesSent) {
+			memset(statusDirty, 0, sizeof(statusDirty));
+			for(i = 0; i < 256; i++) {
+				if(!runtimeSending[i]) continue;
+				runtimeDirty[i] = false;
+				runtimeKnown[i] = true;
+				runtimeShown[i][0] = (long)floor(latestRuntime[i].timer_time);
+				runtimeShown[i][1] = (long)floor(latestRuntime[i].pump_time);
+				runtimeWrittenAt[i] = now;
+			}
+			atomic_fetch_add_explicit(&runtimeWritten, runtimeRows, memory_order_relaxed);
+			updatesSent = true;
+		}
+		atomic_fetch_add_explicit(&written, count, memory_order_relaxed);
+		atomic_fetch_add_explicit(&batches, 1, memory_order_relaxed);
+		atomic_store_explicit(&journalPending, journal_next_seq() - 1 - journal_applied_seq(), memory_order_relaxed);
+		if(lastSeq + 1 >= journal_next_seq()) return 0;
+	}
+}
+
+static void disconnect(void) {
+	PQfinish(conn);
+	conn = NULL;
+	atomic_store(&connected, false);
+}
+
+// connect, make sure the tables exist, prepare, and find out how much of the journal postgres already has
+static int try_connect(void) {
+	// the conninfo string is expanded, connect_timeout only applies when it does not set one
+	const char *keys[] = {"connect_timeout", "dbname", NULL};
+	const char *values[] = {"10", conninfo, NULL};
+	conn = PQconnectdbParams(keys, values, 1);
+	if(PQstatus(conn) == CONNECTION_BAD) {
+		fprintf(stderr, "Connection to database failed: %s", PQerrorMessage(conn));
+		disconnect();
+		return -1;
+	}
+	if(setupDatabase(conn) < 0 || db_prepare_statements(conn) < 0) {
+		disconnect();
+		return -1;
+	}
+
+	char id_string[24];
+	sprintf(id_string, "%" PRId64, journal_id());
+	const char *params[1] = {id_string};
+	PGresult *res = PQexecParams(conn, "INSERT INTO monitor_journal (journal_id, applied_seq) VALUES ($1, 0) ON CONFLICT (journal_id) DO NOTHING;", 1, NULL, params, NULL, NULL, 0);
+	bool failed = pg_bad_result(res);
+	PQclear(res);
+	if(!failed) {
+		res = PQexecParams(conn, "SELECT applied_seq FROM monitor_journal WHERE journal_id = $1;", 1, NULL, params, NULL, NULL, 0);
+		failed = pg_bad_data(res) || PQntuples(res) != 1;
+		// a commit that landed just before a crash may be ahead of the file
+		if(!failed) journal_set_applied(strtoull(PQgetvalue(res, 0, 0), NULL, 10));
+		PQclear(res);
+	}
+	if(failed) {
+		fprintf(stderr, "PG_ERROR: could not register journal: %s\n", PQerrorMessage(conn));
+		disconnect();
+		return -1;
+	}
+	registeredJournal = journal_id();
+
+	// setup reset every bay_status row, dashboards should reload before we put back what we know
+	res = PQexec(conn, "SELECT pg_notify('" DB_NOTIFY_CHANNEL "', 'r');");
+	PQclear(res);
+	int i;
+	for(i = 0; i < 256; i++) {
+		if(baySeen[i]) {
+			statusDirty[i] = true;
+			runtimeDirty[i] = true;
+			runtimeKnown[i] = false;
+		}
+	}
+
+	atomic_store(&connected, true);
+	return 0;
+}
+
+#define RECONNECT_MIN_SECONDS 1
+#define RECONNECT_MAX_SECONDS 60
+#define MAINTAIN_SECONDS 3600
+
+static void *writer_main(void *arg) {
+	double backoff = RECONNECT_MIN_SECONDS;
+	double nextAttempt = 0;
+	double nextMaintenance = 0;
+
+	for(;;) {
+		bool online = atomic_load(&connected);
+		double wait = online ? 1 : nextAttempt - monotonic_seconds();
+		// runtime rows held back by the rate limit go out once it allows
+		if(online && runtimeDue > 0 && runtimeDue - monotonic_seconds() < wait) wait = runtimeDue - monotonic_seconds();
+		if(wait > 0) wait_for_work(wait);
+
+		drain_ring();
+		bool finishing = atomic_load(&stopping);
+
+		if(!online && (finishing || monotonic_seconds() >= nextAttempt)) {
+			if(try_connect() == 0) {
+				if(atomic_fetch_add(&reconnects, 1) > 0) printf("DB: reconnected, replaying journal\n");
+				backoff = RECONNECT_MIN_SECONDS;
+				nextMaintenance = 0;
+				online = true;
+			} else {
+				nextAttempt = monotonic_seconds() + backoff;
+				backoff = (backoff * 2 > RECONNECT_MAX_SECONDS) ? RECONNECT_MAX_SECONDS : backoff * 2;
+			}
+		}
+
+		if(online && flush_to_db() < 0) {
+			// keep sampling and journaling, the journal is replayed once the database is back
+			fprintf(stderr, "DB: write failed, journaling until the database is back\n");
+			atomic_fetch_add(&dbErrors, 1);
+			disconnect();
+			nextAttempt = monotonic_seconds() + backoff;
+		} else if(online && maintainDatabase != NULL && !finishing && monotonic_seconds() >= nextMaintenance) {
+			// housekeeping runs outside the pipeline, between batches. a failure is retried next time
+			if(PQpipelineStatus(conn) == PQ_PIPELINE_OFF || PQexitPipelineMode(conn) == 1) maintainDatabase(conn);
+			nextMaintenance = monotonic_seconds() + MAINTAIN_SECONDS;
+		}
+
+		if(finishing && atomic_load_explicit(&tail, memory_order_relaxed) == atomic_load_explicit(&head, memory_order_acquire)) break;
+	}
+
+	if(conn != NULL) disconnect();
+	journal_close();
+	return NULL;
+}
+
+int db_writer_start(const char *writerConninfo, const char *journalPath, int copyRows, int runtimeWriteMs, int (*setup)(PGconn *conn), int (*maintain)(PGconn *conn)) {
+	conninfo = writerConninfo;
+	copyThreshold = (copyRows > 0) ? copyRows : 0;
+	runtimeInterval = (runtimeWriteMs > 0) ? runtimeWriteMs / 1000.0 : 0;
+	setupDatabase = setup;
+	maintainDatabase = maintain;
+	if(journal_open(journalPath, JOURNAL_DEFAULT_CAPACITY) < 0) return -1;
+	latency_reset(&sessionLatency);
+	latency_reset(&insertLatency);
+	int i;
+	for(i = 0; i < STATEMENT_COUNT; i++) metrics_histogram_init(&statementLatency[i], dbSeconds, sizeof(dbSeconds) / sizeof(dbSeconds[0]));
+	for(i = 0; i < 2; i++) metrics_histogram_init(&batchLatency[i], dbSeconds, sizeof(dbSeconds) / sizeof(dbSeconds[0]));
+	atomic_store(&journalPending, journal_next_seq() - 1 - journal_applied_seq());
+	if(sem_init(&wake, 0, 0) < 0) return -1;
+
+	return service_thread_start("DB", &writerThread, writer_main, NULL);
+}
+
+bool db_wipe_queue(uint64_t *ticket) {
+	*ticket = atomic_load(&wipesApplied);
+	struct db_event event;
+	memset(&event, 0, sizeof(event));
+	event.kind = DB_WIPE;
+	clock_gettime(CLOCK_MONOTONIC, &event.time);
+	clock_gettime(CLOCK_REALTIME, &event.wall);
+	if(!db_queue_push(&event)) return false;
+	db_queue_flush();
+	return true;
+}
+
+bool db_wipe_applied(uint64_t ticket) {
+	return atomic_load(&wipesApplied) != ticket;
+}
+
+void db_writer_stop(void) {
+	atomic_store(&stopping, true);
+	sem_post(&wake);
+	pthread_join(writerThread, NULL);
+	sem_destroy(&wake);
+}
+
+void db_queue_stats(struct db_queue_stats *out) {
+	// tail first: it can only catch up to head, never pass it
+	uint32_t t = atomic_load_explicit(&tail, memory_order_acquire);
+	uint32_t h = atomic_load_explicit(&head, memory_order_acquire);
+	out->pushed = atomic_load_explicit(&pushed, memory_order_relaxed);
+	out->dropped = atomic_load_explicit(&dropped, memory_order_relaxed);
+	out->written = atomic_load_explicit(&written, memory_order_relaxed);
+	out->coalesced = atomic_load_explicit(&coalesced, memory_order_relaxed);
+	out->batches = atomic_load_explicit(&batches, memory_order_relaxed);
+	out->copied = atomic_load_explicit(&copied, memory_order_relaxed);
+	out->runtime_written = atomic_load_explicit(&runtimeWritten, memory_order_relaxed);
+	out->runtime_suppressed = atomic_load_explicit(&runtimeSuppressed, memory_order_relaxed);
+	out->depth = h - t;
+	out->max_depth = atomic_load_explicit(&maxDepth, memory_order_relaxed);
+	out->journal_pending = atomic_load_explicit(&journalPending, memory_order_relaxed);
+	out->journal_dropped = atomic_load_explicit(&journalDropped, memory_order_relaxed);
+	out->reconnects = atomic_load_explicit(&reconnects, memory_order_relaxed);
+	out->db_errors = atomic_load_explicit(&dbErrors, memory_order_relaxed);
+	out->connected = atomic_load_explicit(&connected, memory_order_relaxed);
+}
+
+void db_commit_latency(struct latency_histogram *sessions, struct latency_histogram *inserts) {
+	pthread_mutex_lock(&latencyLock);
+	*sessions = sessionLatency;
+	*inserts = insertLatency;
+	pthread_mutex_unlock(&latencyLock);
+}
+
+int db_register_metrics(void) {
+	int failed = 0, i;
+	char labels[64];
+	for(i = 0; i < STATEMENT_COUNT; i++) {
+		snprintf(labels, sizeof(labels), "statement=\"%s\"", statements[i].name);
+		failed |= metrics_register("carwash_db_statement_seconds", "PQexecPrepared round trips by prepared statement, outside pipelines", METRIC_HISTOGRAM, labels, &statementLatency[i]);
+	}
+	failed |= metrics_register("carwash_db_batch_seconds", "writer batches, one transaction each, by how they went in", METRIC_HISTOGRAM, "mode=\"pipeline\"", &batchLatency[BATCH_PIPELINE]);
+	failed |= metrics_register("carwash_db_batch_seconds", "writer batches, one transaction each, by how they went in", METRIC_HISTOGRAM, "mode=\"copy\"", &batchLatency[BATCH_COPY]);
+	failed |= metrics_register("carwash_db_errors", "batches that failed and dropped the connection", METRIC_COUNTER, NULL, &dbErrors);
+	failed |= metrics_register("carwash_db_connections", "successful connections, the first one included", METRIC_COUNTER, NULL, &reconnects);
+	failed |= metrics_register("carwash_db_connected", "1 while the writer has a working connection", METRIC_GAUGE, NULL, &connected);
+	failed |= metrics_register("carwash_db_queued", "records pushed into the writer's ring", METRIC_COUNTER, NULL, &pushed);
+	failed |= metrics_register("carwash_db_queue_dropped", "records lost to a full ring", METRIC_COUNTER, NULL, &dropped);
+	failed |= metrics_register("carwash_db_statements", "statements sent", METRIC_COUNTER, NULL, &written);
+	failed |= metrics_register("carwash_db_round_trips", "batches written", METRIC_COUNTER, NULL, &batches);
+	failed |= metrics_register("carwash_db_coalesced", "status and runtime updates folded into a newer one", METRIC_COUNTER, NULL, &coalesced);
+	failed |= metrics_register("carwash_db_copied", "sessions and inserts that went in by COPY", METRIC_COUNTER, NULL, &copied);
+	failed |= metrics_register("carwash_db_runtime_written", "bay_status runtime rows written", METRIC_COUNTER, NULL, &runtimeWritten);
+	failed |= metrics_register("carwash_db_runtime_suppressed", "bay_status runtime updates never written", METRIC_COUNTER, NULL, &runtimeSuppressed);
+	failed |= metrics_register("carwash_journal_pending", "journaled sessions and inserts not yet in the database", METRIC_GAUGE, NULL, &journalPending);
+	failed |= metrics_register("carwash_journal_dropped", "sessions and inserts lost to a full journal", METRIC_COUNTER, NULL, &journalDropped);
+	return failed ? -1 : 0;
+}
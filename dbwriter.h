@@ -0,0 +1,162 @@
+#ifndef CARWASH_DBWRITER_H
+#define CARWASH_DBWRITER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <libpq-fe.h>
+#include "latency.h"
+
+/*
+	DATABASE WRITER
+	the sampling loop never talks to postgres. it pushes fixed size records
+	into a bounded single producer / single consumer ring and a writer
+	thread drains them into the database. a full ring drops the record
+	instead of blocking the sampler.
+
+	the writer owns the connection. sessions and maintenance inserts go
+	through the on-disk journal (journal.h) before postgres, so a database
+	outage or a crash loses nothing: the writer reconnects with backoff and
+	replays whatever the database has not acknowledged.
+*/
+
+enum db_event_kind {
+	DB_BAY_STATUS,          // timer_running, pump_running
+	DB_BAY_RUNTIME,         // timer_time, pump_time of the running session
+	DB_BAY_SESSION,         // timer_time, pump_time of a finished session
+	DB_MAINTENANCE_INSERT,
+	DB_JOURNAL_APPLIED,     // writer internal: seq is the journal watermark
+	DB_BAY_NOTIFY,          // writer internal: tell listeners about an event of kind about
+	DB_WIPE,                // empty the session and insert history, journaled like a session
+};
+
+/*
+	DASHBOARD NOTIFICATIONS
+	every batch that changes what a dashboard shows also sends a NOTIFY on
+	this channel, committed with the batch. payloads are space separated:
+		<bay> s <timer running> <pump running> <timer secs> <pump secs> <wall secs>
+			status change, the times are the session so far at wall secs,
+			listeners run the clocks on from there themselves. only sent
+			when the monitor keeps bay_status (-t), local readers use the
+			live status segment (status.h) instead
+		<bay> c         a session was recorded, totals changed
+		<bay> i         a maintenance insert was recorded, totals changed
+		r               the monitor (re)connected and reset every status, or
+		                history was wiped or retired, reload
+*/
+#define DB_NOTIFY_CHANNEL "bay_events"
+
+struct db_event {
+	uint8_t kind;
+	uint8_t bay;            // 0 based
+	bool timer_running;
+	bool pump_running;
+	struct timespec time;   // CLOCK_MONOTONIC (or simulated) time of the event
+	struct timespec wall;   // CLOCK_REALTIME of the event, what gets stored
+	struct timespec started;        // DB_BAY_SESSION: CLOCK_REALTIME the session started, zero when unknown
+	uint64_t seq;
+	uint8_t about;          // DB_BAY_NOTIFY: the kind being announced
+	double timer_time;
+	double pump_time;
+};
+
+// must be a power of two
+#define DB_QUEUE_SIZE 1024
+
+struct db_queue_stats {
+	uint64_t pushed;
+	uint64_t dropped;
+	uint64_t written;       // statements sent
+	uint64_t coalesced;     // status/runtime updates folded into a newer one
+	uint64_t batches;       // round trips
+	uint64_t copied;        // sessions and inserts that went in by COPY
+	uint64_t runtime_written;       // bay_status runtime rows written
+	uint64_t runtime_suppressed;    // runtime updates never written: same whole seconds, or a newer one came first
+	uint32_t depth;
+	uint32_t max_depth;
+	uint64_t journal_pending;       // journaled but not yet in the database
+	uint64_t journal_dropped;       // lost because the journal was full
+	uint64_t reconnects;
+	uint64_t db_errors;
+	bool connected;
+};
+
+// prepare every statement the writer uses on conn
+int db_prepare_statements(PGconn *conn);
+/*
+	the same statements again, named prefix + name, with no parameter types:
+	the server infers them from the SQL and parses text values, the way the
+	writer sent them before they were typed (cw-dbbench compares the two)
+*/
+int db_prepare_untyped(PGconn *conn, const char *prefix);
+
+/*
+	one statement's parameters, ready for PQexecPrepared/PQsendQueryPrepared:
+	binary values live in words, the notify payload in text
+*/
+#define DB_MAX_PARAMS 5
+struct db_params {
+	int count;
+	const char *values[DB_MAX_PARAMS];
+	int lengths[DB_MAX_PARAMS];
+	int formats[DB_MAX_PARAMS];
+	uint64_t words[DB_MAX_PARAMS];
+	char text[128];
+};
+// the prepared statement that writes event, with its parameters encoded into params. NULL for none
+const char *db_encode_event(const struct db_event *event, struct db_params *params);
+/*
+	write events straight to conn. pipelined sends the whole array in one
+	round trip and one implicit transaction, otherwise one statement at a time
+*/
+int db_write_events(PGconn *conn, const struct db_event *events, int count, bool pipelined);
+/*
+	write events straight to conn in one transaction: sessions and maintenance
+	inserts by COPY into per connection staging tables and one INSERT ... SELECT
+	each, ordered by seq, anything else one statement at a time. far fewer
+	round trips for a backlog than pipelining one INSERT per row
+*/
+int db_copy_events(PGconn *conn, const struct db_event *events, int count);
+
+/*
+	open the journal and start the writer thread. it connects (and keeps
+	reconnecting) with conninfo, calling setup on every new connection
+	before preparing statements, so the monitor runs without a database.
+	whenever more than copyRows sessions and inserts are waiting (after an
+	outage, say) they go in by COPY (db_copy_events), 0 never does.
+	a running bay's runtime row is rewritten when its whole seconds change,
+	at most once every runtimeWriteMs (0 for no limit).
+	maintain (NULL for none) runs once connected and then hourly, for
+	housekeeping such as history partitions (schema.h)
+*/
+int db_writer_start(const char *conninfo, const char *journalPath, int copyRows, int runtimeWriteMs, int (*setup)(PGconn *conn), int (*maintain)(PGconn *conn));
+// producer side, never blocks: returns false (and counts a drop) when the ring is full
+bool db_queue_push(const struct db_event *event);
+// producer side, once per cycle: wake the writer so everything pushed goes out as one batch
+void db_queue_flush(void);
+/*
+	producer side, never blocks: queue a DB_WIPE and wake the writer. ticket
+	is for db_wipe_applied. false when the ring is full and nothing was
+	queued. once queued it is journaled behind everything recorded before it
+	and goes in when the database is up, restarts included
+*/
+bool db_wipe_queue(uint64_t *ticket);
+// true once the TRUNCATE of the wipe that returned ticket (or a later one) has committed
+bool db_wipe_applied(uint64_t ticket);
+// journals everything still queued, writes it if the database is up, and joins the writer thread
+void db_writer_stop(void);
+void db_queue_stats(struct db_queue_stats *out);
+/*
+	how long each session and maintenance insert took from its event time to
+	the commit that put it in the database. only records journaled since the
+	writer started count, and only with CLOCK_MONOTONIC event times (not the
+	polling simulator's)
+*/
+void db_commit_latency(struct latency_histogram *sessions, struct latency_histogram *inserts);
+/*
+	add the writer's counters and its statement and batch latencies to the
+	metrics registry (metrics.h), after db_writer_start
+*/
+int db_register_metrics(void);
+
+#endif
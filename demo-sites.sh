@@ -0,0 +1,47 @@
+# several simulated sites forwarding to one collector, all on this machine and one local postgres
+# usage: ./demo-sites.sh [sites] [seconds]
+# needs ./build-bench.sh and ./build-collector.sh first, and createdb/psql rights on the local server
+cd "$(dirname "$0")"
+SITES=${1:-3}
+SECONDS_RUN=${2:-300}
+PORT=17411
+WORK=$(mktemp -d)
+
+createdb carwash_central 2>/dev/null
+./cw-collector -d "dbname=carwash_central" -l 127.0.0.1:$PORT > "$WORK/collector.log" 2>&1 &
+COLLECTOR=$!
+sleep 1
+
+# every site gets its own database, journal and config. they share the live status segment,
+# which only dashboards read, so the last one to write it wins
+PIDS=""
+for i in $(seq 1 $SITES); do
+	createdb carwash_site$i 2>/dev/null
+	printf 'site site%d\ncollector 127.0.0.1:%d\n' $i $PORT > "$WORK/site$i.conf"
+	./cwmonitor-bench -f "$WORK/site$i.conf" -s sim-schedule.txt -d "dbname=carwash_site$i" -j "$WORK/site$i.journal" > "$WORK/site$i.log" 2>&1 &
+	PIDS="$PIDS $!"
+done
+
+# half way through the collector goes away for a while, the sites keep going and resend after
+sleep $((SECONDS_RUN / 2))
+kill -INT $COLLECTOR; wait $COLLECTOR
+sleep 20
+./cw-collector -d "dbname=carwash_central" -l 127.0.0.1:$PORT >> "$WORK/collector.log" 2>&1 &
+COLLECTOR=$!
+sleep $((SECONDS_RUN / 2))
+
+kill -INT $PIDS; wait $PIDS
+kill -INT $COLLECTOR; wait $COLLECTOR
+
+# every site's own history should be in the central tables exactly once
+STATUS=0
+for i in $(seq 1 $SITES); do
+	LOCAL=$(psql -At -d carwash_site$i -c "SELECT (SELECT COUNT(*) FROM bay_sessions) || ' ' || (SELECT COUNT(*) FROM bay_maintenance_inserts);")
+	CENTRAL=$(psql -At -d carwash_central -c "SELECT (SELECT COUNT(*) FROM collected_sessions WHERE site = 'site$i') || ' ' || (SELECT COUNT(*) FROM collected_maintenance_inserts WHERE site = 'site$i');")
+	echo "site$i: local sessions/inserts $LOCAL, central $CENTRAL"
+	[ "$LOCAL" = "$CENTRAL" ] || STATUS=1
+done
+grep COLLECTOR: "$WORK/collector.log"
+echo "logs in $WORK"
+cd - > /dev/null
+exit $STATUS
@@ -0,0 +1,267 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include "forward.h"
+#include "journal.h"
+#include "dbwriter.h"
+#include "metrics.h"
+#include "service.h"
+
+#define RECONNECT_MIN_SECONDS 1
+#define RECONNECT_MAX_SECONDS 60
+// a connect, a send or an acknowledgement that takes longer than this drops the connection
+#define FORWARD_TIMEOUT_MS 30000
+// how often an idle forwarder looks for new journal records
+#define FORWARD_IDLE_MS 500
+
+static char collectorHost[256];
+static char collectorPort[16];
+static char siteName[FORWARD_SITE_SIZE];
+static pthread_t forwarderThread;
+static int stopFd = -1;
+static bool forwarding = false;
+
+static _Atomic uint64_t forwarded = 0;
+static _Atomic uint64_t acknowledged = 0;
+static _Atomic uint64_t lost = 0;
+static _Atomic uint64_t forwardErrors = 0;
+static _Atomic uint64_t forwardConnected = 0;
+
+// everything below belongs to the forwarder thread
+static int fd = -1;
+static uint8_t message[FORWARD_BATCH_HEADER_SIZE + FORWARD_BATCH_MAX * FORWARD_RECORD_SIZE];
+
+/*
+	wait up to timeoutMs for fd to be ready for events, or for forward_stop.
+	1 ready, 0 timed out, -1 stopping or the socket failed
+*/
+static int wait_for(int waitFd, short events, int timeoutMs) {
+	struct pollfd pfds[2] = {{stopFd, POLLIN, 0}, {waitFd, events, 0}};
+	int n = poll(pfds, waitFd >= 0 ? 2 : 1, timeoutMs);
+	if(n < 0) return (errno == EINTR) ? 0 : -1;
+	if(pfds[0].revents & POLLIN) return -1;
+	if(n == 0) return 0;
+	if(pfds[1].revents & events) return 1;
+	return -1;
+}
+
+// the collector's answer to the hello or the last batch, status and acked seq
+static int read_reply(uint32_t *status, uint64_t *acked) {
+	uint8_t reply[FORWARD_REPLY_SIZE];
+	size_t have = 0;
+	while(have < sizeof(reply)) {
+		if(wait_for(fd, POLLIN, FORWARD_TIMEOUT_MS) <= 0) return -1;
+		ssize_t n = recv(fd, reply + have, sizeof(reply) - have, MSG_DONTWAIT);
+		if(n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+		if(n <= 0) return -1;
+		have += n;
+	}
+	if(forward_get32(reply) != FORWARD_MAGIC) return -1;
+	*status = forward_get32(reply + 4);
+	*acked = forward_get64(reply + 8);
+	return 0;
+}
+
+static void disconnect(void) {
+	if(fd >= 0) close(fd);
+	fd = -1;
+	atomic_store(&forwardConnected, 0);
+}
+
+// connect and say hello, returns the seq to resume after or -1
+static int64_t try_connect(void) {
+	struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+	struct addrinfo *found;
+	int err = getaddrinfo(collectorHost, collectorPort, &hints, &found);
+	if(err != 0) {
+		fprintf(stderr, "FORWARD: %s: %s\n", collectorHost, gai_strerror(err));
+		return -1;
+	}
+	fd = socket(found->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(fd >= 0 && connect(fd, found->ai_addr, found->ai_addrlen) < 0 && errno != EINPROGRESS) {
+		disconnect();
+	}
+	freeaddrinfo(found);
+	if(fd < 0) return -1;
+
+	// a non-blocking connect is done once the socket is writable, its error says how it went
+	int soError = 0;
+	socklen_t length = sizeof(soError);
+	if(wait_for(fd, POLLOUT, FORWARD_TIMEOUT_MS) <= 0 || getsockopt(fd, SOL_SOCKET, SO_ERROR, &soError, &length) < 0 || soError != 0) {
+		disconnect();
+		return -1;
+	}
+
+	uint8_t hello[FORWARD_HELLO_SIZE] = {0};
+	forward_put32(hello, FORWARD_MAGIC);
+	forward_put32(hello + 4, FORWARD_VERSION);
+	forward_put64(hello + 8, (uint64_t)journal_id());
+	strcpy((char *)hello + 16, siteName);
+	uint32_t status;
+	uint64_t acked;
+	if(service_send_all(fd, hello, sizeof(hello), FORWARD_TIMEOUT_MS, stopFd) < 0 || read_reply(&status, &acked) < 0) {
+		disconnect();
+		return -1;
+	}
+	if(status != FORWARD_OK) {
+		fprintf(stderr, "FORWARD: %s:%s refused site %s: %s\n", collectorHost, collectorPort, siteName,
+			status == FORWARD_BAD_HELLO ? "bad hello" : "no database");
+		disconnect();
+		return -1;
+	}
+	atomic_store(&forwardConnected, 1);
+	return (int64_t)acked;
+}
+
+/*
+	build the next batch from cursor: sessions and inserts only (a wipe
+	empties the site's own history, the central one keeps it), records the
+	ring already wrapped past are counted lost. returns how many records,
+	*lastSeq the journal seq it covers through (0 when nothing is new)
+*/
+static int build_batch(uint64_t cursor, uint64_t *lastSeq) {
+	int count = 0;
+	uint64_t seq;
+	*lastSeq = 0;
+	for(seq = cursor; count < FORWARD_BATCH_MAX; seq++) {
+		struct journal_record record;
+		int found = journal_read(seq, &record);
+		if(found < 0) break;
+		*lastSeq = seq;
+		if(found == 0) {
+			atomic_fetch_add_explicit(&lost, 1, memory_order_relaxed);
+			continue;
+		}
+		if(record.kind != DB_BAY_SESSION && record.kind != DB_MAINTENANCE_INSERT) continue;
+		struct forward_record out = {
+			.seq = seq,
+			.wall_ns = record.wall_ns,
+			.start_ns = record.start_ns,
+			.timer_time = record.timer_time,
+			.pump_time = record.pump_time,
+			.kind = (record.kind == DB_BAY_SESSION) ? FORWARD_SESSION : FORWARD_INSERT,
+			.bay = record.bay + 1,
+		};
+		forward_encode_record(message + FORWARD_BATCH_HEADER_SIZE + count * FORWARD_RECORD_SIZE, &out);
+		count++;
+	}
+	forward_put32(message, FORWARD_MAGIC);
+	forward_put32(message + 4, count);
+	forward_put64(message + 8, *lastSeq);
+	return count;
+}
+
+static void *forwarder_main(void *arg) {
+	double backoff = RECONNECT_MIN_SECONDS;
+	uint64_t cursor = 1;
+
+	for(;;) {
+		if(fd < 0) {
+			int64_t acked = try_connect();
+			if(acked < 0) {
+				atomic_fetch_add(&forwardErrors, 1);
+				if(wait_for(-1, 0, (int)(backoff * 1000)) < 0) break;
+				backoff = (backoff * 2 > RECONNECT_MAX_SECONDS) ? RECONNECT_MAX_SECONDS : backoff * 2;
+				continue;
+			}
+			backoff = RECONNECT_MIN_SECONDS;
+			// whatever the collector has not committed goes again
+			cursor = (uint64_t)acked + 1;
+		}
+
+		uint64_t lastSeq;
+		int count = build_batch(cursor, &lastSeq);
+		if(lastSeq == 0) {
+			if(wait_for(-1, 0, FORWARD_IDLE_MS) < 0) break;
+			continue;
+		}
+
+		uint32_t status;
+		uint64_t acked;
+		if(service_send_all(fd, message, FORWARD_BATCH_HEADER_SIZE + count * FORWARD_RECORD_SIZE, FORWARD_TIMEOUT_MS, stopFd) < 0
+			|| read_reply(&status, &acked) < 0 || status != FORWARD_OK || acked != lastSeq) {
+			fprintf(stderr, "FORWARD: batch through seq %llu not acknowledged, resending after reconnect\n", (unsigned long long)lastSeq);
+			atomic_fetch_add(&forwardErrors, 1);
+			disconnect();
+			continue;
+		}
+		atomic_fetch_add_explicit(&forwarded, count, memory_order_relaxed);
+		atomic_store_explicit(&acknowledged, acked, memory_order_relaxed);
+		cursor = lastSeq + 1;
+	}
+
+	disconnect();
+	return NULL;
+}
+
+int forward_start(const char *collector, const char *site) {
+	if(!forward_valid_site(site)) {
+		fprintf(stderr, "FORWARD: site name \"%s\" must be 1 to %d of a-z, 0-9 and _\n", site, FORWARD_SITE_SIZE - 1);
+		return -1;
+	}
+	strcpy(siteName, site);
+	// host[:port], a bracketed IPv6 address keeps its colons
+	const char *colon = strrchr(collector, ':');
+	if(colon != NULL && strchr(colon, ']') == NULL) {
+		snprintf(collectorPort, sizeof(collectorPort), "%s", colon + 1);
+	} else {
+		strcpy(collectorPort, FORWARD_DEFAULT_PORT);
+		colon = collector + strlen(collector);
+	}
+	const char *host = collector;
+	size_t length = colon - collector;
+	if(length > 1 && host[0] == '[' && host[length - 1] == ']') {
+		host++;
+		length -= 2;
+	}
+	if(length == 0 || length >= sizeof(collectorHost)) {
+		fprintf(stderr, "FORWARD: bad collector address %s\n", collector);
+		return -1;
+	}
+	memcpy(collectorHost, host, length);
+	collectorHost[length] = '\0';
+
+	stopFd = eventfd(0, EFD_CLOEXEC);
+	if(stopFd < 0) return -1;
+
+	if(service_thread_start("FORWARD", &forwarderThread, forwarder_main, NULL) < 0) {
+		close(stopFd);
+		stopFd = -1;
+		return -1;
+	}
+	forwarding = true;
+	return 0;
+}
+
+void forward_stop(void) {
+	if(!forwarding) return;
+	forwarding = false;
+	uint64_t one = 1;
+	if(write(stopFd, &one, sizeof(one)) < 0) perror("FORWARD");
+	pthread_join(forwarderThread, NULL);
+	close(stopFd);
+	stopFd = -1;
+	printf("FORWARD: %llu records acknowledged by %s:%s through seq %llu, %llu lost to a wrapped journal\n",
+		(unsigned long long)atomic_load(&forwarded), collectorHost, collectorPort,
+		(unsigned long long)atomic_load(&acknowledged), (unsigned long long)atomic_load(&lost));
+}
+
+int forward_register_metrics(void) {
+	int failed = 0;
+	failed |= metrics_register("carwash_forward_records", "sessions and inserts the collector acknowledged", METRIC_COUNTER, NULL, &forwarded);
+	failed |= metrics_register("carwash_forward_acked_seq", "journal seq the collector has committed through", METRIC_GAUGE, NULL, &acknowledged);
+	failed |= metrics_register("carwash_forward_lost", "journal records the ring wrapped past before they were forwarded", METRIC_COUNTER, NULL, &lost);
+	failed |= metrics_register("carwash_forward_errors", "failed connects and unacknowledged batches", METRIC_COUNTER, NULL, &forwardErrors);
+	failed |= metrics_register("carwash_forward_connected", "1 while connected to the collector", METRIC_GAUGE, NULL, &forwardConnected);
+	return failed ? -1 : 0;
+}
@@ -0,0 +1,141 @@
+#ifndef CARWASH_FORWARD_H
+#define CARWASH_FORWARD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+
+/*
+	SITE FORWARDING
+	every site's monitor writes its own database, and with a collector set
+	in its config it also forwards its sessions and maintenance inserts to
+	one central cw-collector over TCP. the forwarder is a thread of its
+	own that reads the journal (journal.h) behind the writer, so a slow or
+	missing collector never holds up sampling or the local database.
+
+	the collector remembers, per site and journal, the last journal seq it
+	committed (collector_sites). the forwarder starts from there on every
+	connection, sends a batch, and waits for the commit's acknowledgement
+	before sending the next one. anything unacknowledged is simply sent
+	again after a reconnect, and the collector throws away rows it already
+	has, keyed on (site, bay, event time). the local journal keeps its old
+	records until it wraps, so a collector that is gone for longer than the
+	journal holds loses the oldest ones (counted, the local database still
+	has them).
+
+	LAYOUT: every message, integers big endian, doubles as their IEEE bits
+		hello (monitor to collector, first):   magic u32, version u32, journal_id i64, site char[32]
+		reply (collector to monitor):          magic u32, status u32, acked_seq u64
+			answers the hello (resume after acked_seq) and every batch (committed through acked_seq)
+		batch (monitor to collector):          magic u32, count u32, last_seq u64, count records of
+			seq u64, wall_ns i64, start_ns i64, timer_time f64, pump_time f64, kind u8, bay u8, 6 zero bytes
+			last_seq is the journal seq the batch covers through, records it skipped included
+*/
+
+#define FORWARD_MAGIC 0x43574657u       // "CWFW"
+#define FORWARD_VERSION 1
+#define FORWARD_DEFAULT_PORT "7411"
+// site names are [a-z0-9_] so they can name a partition, the size includes the terminating zero
+#define FORWARD_SITE_SIZE 32
+#define FORWARD_BATCH_MAX 512
+
+#define FORWARD_HELLO_SIZE 48
+#define FORWARD_REPLY_SIZE 16
+#define FORWARD_BATCH_HEADER_SIZE 16
+#define FORWARD_RECORD_SIZE 48
+
+enum forward_status {
+	FORWARD_OK,
+	FORWARD_BAD_HELLO,      // wrong magic, version or site name, do not retry as is
+	FORWARD_UNAVAILABLE,    // the collector has no database right now, try again later
+};
+
+enum forward_kind {
+	FORWARD_SESSION = 1,
+	FORWARD_INSERT = 2,
+};
+
+struct forward_record {
+	uint64_t seq;
+	int64_t wall_ns;        // CLOCK_REALTIME of the event
+	int64_t start_ns;       // sessions: when it started, 0 when unknown
+	double timer_time;
+	double pump_time;
+	uint8_t kind;           // enum forward_kind
+	uint8_t bay;            // 1 based
+};
+
+static inline void forward_put32(uint8_t *p, uint32_t v) {
+	v = htobe32(v);
+	memcpy(p, &v, 4);
+}
+
+static inline void forward_put64(uint8_t *p, uint64_t v) {
+	v = htobe64(v);
+	memcpy(p, &v, 8);
+}
+
+static inline uint32_t forward_get32(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return be32toh(v);
+}
+
+static inline uint64_t forward_get64(const uint8_t *p) {
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return be64toh(v);
+}
+
+static inline void forward_put_double(uint8_t *p, double d) {
+	uint64_t bits;
+	memcpy(&bits, &d, 8);
+	forward_put64(p, bits);
+}
+
+static inline double forward_get_double(const uint8_t *p) {
+	uint64_t bits = forward_get64(p);
+	double d;
+	memcpy(&d, &bits, 8);
+	return d;
+}
+
+// a site name is 1 to 31 of [a-z0-9_]
+static inline bool forward_valid_site(const char *site) {
+	size_t n = strspn(site, "abcdefghijklmnopqrstuvwxyz0123456789_");
+	return n > 0 && n < FORWARD_SITE_SIZE && site[n] == '\0';
+}
+
+static inline void forward_encode_record(uint8_t *p, const struct forward_record *r) {
+	forward_put64(p, r->seq);
+	forward_put64(p + 8, (uint64_t)r->wall_ns);
+	forward_put64(p + 16, (uint64_t)r->start_ns);
+	forward_put_double(p + 24, r->timer_time);
+	forward_put_double(p + 32, r->pump_time);
+	p[40] = r->kind;
+	p[41] = r->bay;
+	memset(p + 42, 0, 6);
+}
+
+static inline void forward_decode_record(const uint8_t *p, struct forward_record *r) {
+	r->seq = forward_get64(p);
+	r->wall_ns = (int64_t)forward_get64(p + 8);
+	r->start_ns = (int64_t)forward_get64(p + 16);
+	r->timer_time = forward_get_double(p + 24);
+	r->pump_time = forward_get_double(p + 32);
+	r->kind = p[40];
+	r->bay = p[41];
+}
+
+/*
+	start forwarding to collector ("host[:port]", FORWARD_DEFAULT_PORT when
+	none) as site. the journal has to be open already (db_writer_start),
+	and forward_stop has to come before it is closed (db_writer_stop)
+*/
+int forward_start(const char *collector, const char *site);
+void forward_stop(void);
+// forwarded, acknowledged, lost and connected, for the metrics registry (metrics.h)
+int forward_register_metrics(void);
+
+#endif
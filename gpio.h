@@ -0,0 +1,105 @@
+#ifndef CARWASH_GPIO_H
+#define CARWASH_GPIO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#define GPIO_LOW 0
+#define GPIO_HIGH 1
+
+// inputs are addressed by slot (their index in the list given to open_inputs)
+#define GPIO_MAX_INPUTS 64
+
+/*
+	ONE SNAPSHOT OF EVERY INPUT
+	bit n of levels is the level of slot n, all taken in a single read
+	time is CLOCK_MONOTONIC for real hardware, simulated time otherwise
+*/
+struct gpio_sample {
+	uint64_t levels;
+	struct timespec time;
+};
+
+#define GPIO_LEVEL(sample, slot) ((int)(((sample)->levels >> (slot)) & 1))
+
+/*
+	ONE DEBOUNCED EDGE (event driven backends)
+	time is when the line changed, not when the debounce period ran out
+*/
+struct gpio_edge {
+	int slot;
+	int level;
+	struct timespec time;
+};
+
+/*
+	GPIO BACKEND
+	every pin access in monitor goes through one of these, so the main loop
+	can run on the Pi (wiringPi) or on any Linux box against a scripted
+	schedule of pin levels (sim)
+
+	pins are wiringPi pin numbers for every backend
+*/
+struct gpio_backend {
+	const char *name;
+	// true when pins are not real hardware (no reboot/shutdown side effects, no sleeping)
+	bool simulated;
+	int (*setup)(void);
+	/*
+		configure pins as inputs with the pull up enabled, pins[n] becomes slot n
+		debounce_us is NULL for polling, otherwise edges are reported through
+		event_fd and every line is debounced for debounce_us[n] first
+	*/
+	int (*open_inputs)(const int *pins, const int *debounce_us, int count);
+	// read every input at once
+	void (*sample)(struct gpio_sample *out);
+	// fd that polls readable when edges are pending (NULL when the backend can only poll)
+	int (*event_fd)(void);
+	// fetch pending edges without blocking, returns how many were stored
+	int (*read_edges)(struct gpio_edge *out, int max);
+	// pull the inputs back down on exit
+	void (*close_inputs)(void);
+	void (*teardown)(void);
+};
+
+#ifdef HAVE_WIRINGPI
+extern const struct gpio_backend gpio_wiringpi;
+// MCP23017 on i2c, its 16 pins become pin_base..pin_base+15 (call before setup)
+void gpio_wiringpi_add_mcp23017(int pin_base, int i2c_address);
+#endif
+extern const struct gpio_backend gpio_cdev;
+extern const struct gpio_backend gpio_sim;
+
+// linux GPIO character device, pins are mapped from wiringPi to BCM line offsets
+void gpio_cdev_set_chip(const char *path);
+
+/*
+	SIM SCHEDULE
+	one change per line: <time ms> <pin> <level>
+		level is 0/1 or low/high, pins default to high (pulled up, relay off)
+	optional line: repeat <period ms>
+		replays the schedule every period forever
+	lines starting with # are comments
+
+	when polling, simulated time advances step_ns on every sample()
+	with edges, the schedule plays in real time behind a timerfd standing in
+	for the kernel's event fd, and debounce is applied the way the kernel does
+*/
+int gpio_sim_load(const char *path, long step_ns);
+
+/*
+	TRACE REPLAY
+	plays a pin trace (trace.h) back one recorded cycle per sample(), as
+	fast as the loop asks for them. sample times are the recorded ones, the
+	trace's slot layout has to match the inputs opened. polling only
+*/
+extern const struct gpio_backend gpio_trace;
+// reads the header: the sample period and bay count the trace was recorded with
+int gpio_trace_load(const char *path, long *samplePeriod, int *bayCount);
+// wall clock time of a replayed sample time
+void gpio_trace_wall_time(const struct timespec *t, struct timespec *wall);
+// true once the last recorded cycle has been sampled
+bool gpio_trace_finished(void);
+
+#endif
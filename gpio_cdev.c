@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include "gpio.h"
+
+/*
+	LINUX GPIO CHARACTER DEVICE
+	all inputs are one line request, so a sample is one GET_VALUES ioctl.
+	in event mode the kernel debounces each line and queues timestamped
+	edges on the request fd, which the monitor blocks on with poll().
+*/
+
+// wiringPi pin -> BCM line offset (rev 2 boards and later, 40 pin header)
+static const int wpiToBcm[32] = {
+	17, 18, 27, 22, 23, 24, 25, 4,
+	2, 3, 8, 7, 10, 9, 11, 14,
+	15, 28, 29, 30, 31, 5, 6, 13,
+	19, 26, 12, 16, 20, 21, 0, 1,
+};
+
+static const char *chipPath = "/dev/gpiochip0";
+static int chipFd = -1;
+static int lineFd = -1;
+
+static int lineCount = 0;
+static uint32_t lineOffsets[GPIO_MAX_INPUTS];
+static int64_t debounceNs[GPIO_MAX_INPUTS];
+// what the last good read saw, every input idle (pulled up) until then
+static uint64_t lastLevels = ~0ULL;
+static bool readFailing = false;
+
+void gpio_cdev_set_chip(const char *path) {
+	chipPath = path;
+}
+
+static int cdev_setup(void) {
+	chipFd = open(chipPath, O_RDONLY | O_CLOEXEC);
+	if(chipFd < 0) {
+		fprintf(stderr, "GPIO: could not open %s: %s\n", chipPath, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static int cdev_open_inputs(const int *pins, const int *debounce_us, int count) {
+	if(count > GPIO_MAX_INPUTS || count > GPIO_V2_LINES_MAX) return -1;
+
+	struct gpio_v2_line_request req;
+	memset(&req, 0, sizeof(req));
+	strncpy(req.consumer, "cwmonitor", sizeof(req.consumer) - 1);
+	req.num_lines = count;
+	req.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_BIAS_PULL_UP;
+	if(debounce_us != NULL) {
+		req.config.flags |= GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+	}
+
+	int i, a;
+	for(i = 0; i < count; i++) {
+		if(pins[i] < 0 || pins[i] >= 32) {
+			fprintf(stderr, "GPIO: pin %d is not on the header, the cdev backend only maps pins 0-31\n", pins[i]);
+			return -1;
+		}
+		req.offsets[i] = wpiToBcm[pins[i]];
+		lineOffsets[i] = req.offsets[i];
+		debounceNs[i] = 0;
+
+		// one config attribute per distinct debounce period
+		if(debounce_us == NULL || debounce_us[i] <= 0) continue;
+		debounceNs[i] = (int64_t)debounce_us[i] * 1000;
+		for(a = 0; a < (int)req.config.num_attrs; a++) {
+			if(req.config.attrs[a].attr.debounce_period_us == (uint32_t)debounce_us[i]) break;
+		}
+		if(a == (int)req.config.num_attrs) {
+			if(a == GPIO_V2_LINE_NUM_ATTRS_MAX) {
+				fprintf(stderr, "GPIO: too many distinct debounce periods\n");
+				return -1;
+			}
+			req.config.attrs[a].attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+			req.config.attrs[a].attr.debounce_period_us = debounce_us[i];
+			req.config.num_attrs++;
+		}
+		req.config.attrs[a].mask |= 1ULL << i;
+	}
+
+	if(ioctl(chipFd, GPIO_V2_GET_LINE_IOCTL, &req) < 0) {
+		fprintf(stderr, "GPIO: line request on %s failed: %s\n", chipPath, strerror(errno));
+		return -1;
+	}
+	lineFd = req.fd;
+	lineCount = count;
+	fcntl(lineFd, F_SETFL, fcntl(lineFd, F_GETFL) | O_NONBLOCK);
+	return 0;
+}
+
+static void cdev_sample(struct gpio_sample *out) {
+	struct gpio_v2_line_values values;
+	values.bits = 0;
+	values.mask = (lineCount == 64) ? ~0ULL : (1ULL << lineCount) - 1;
+	// a failed read is not every input pulled low (active): the last levels stand until a read works again
+	if(ioctl(lineFd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0) {
+		if(!readFailing) fprintf(stderr, "GPIO: reading the lines on %s failed, holding the last levels: %s\n", chipPath, strerror(errno));
+		readFailing = true;
+	} else {
+		if(readFailing) fprintf(stderr, "GPIO: reading the lines on %s again\n", chipPath);
+		readFailing = false;
+		lastLevels = values.bits;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &out->time);
+	out->levels = lastLevels;
+}
+
+static int cdev_event_fd(void) {
+	return lineFd;
+}
+
+static int cdev_read_edges(struct gpio_edge *out, int max) {
+	struct gpio_v2_line_event events[16];
+	int stored = 0;
+
+	while(stored < max) {
+		int want = (max - stored < 16) ? max - stored : 16;
+		ssize_t n = read(lineFd, events, want * sizeof(events[0]));
+		if(n <= 0) break;
+
+		int i, got = n / sizeof(events[0]);
+		for(i = 0; i < got; i++) {
+			int slot = -1, l;
+			for(l = 0; l < lineCount; l++) {
+				if(lineOffsets[l] == events[i].offset) {
+					slot = l;
+					break;
+				}
+			}
+			if(slot < 0) continue;
+
+			// the kernel stamps a debounced edge when the line has been stable for the whole period
+			int64_t t = (int64_t)events[i].timestamp_ns - debounceNs[slot];
+			out[stored].slot = slot;
+			out[stored].level = (events[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE) ? GPIO_HIGH : GPIO_LOW;
+			out[stored].time.tv_sec = t / 1000000000;
+			out[stored].time.tv_nsec = t % 1000000000;
+			stored++;
+		}
+		if(got < want) break;
+	}
+	return stored;
+}
+
+static void cdev_close_inputs(void) {
+	if(lineFd < 0) return;
+
+	struct gpio_v2_line_config config;
+	memset(&config, 0, sizeof(config));
+	config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN;
+	ioctl(lineFd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config);
+
+	close(lineFd);
+	lineFd = -1;
+	lineCount = 0;
+}
+
+static void cdev_teardown(void) {
+	if(chipFd >= 0) {
+		close(chipFd);
+		chipFd = -1;
+	}
+}
+
+const struct gpio_backend gpio_cdev = {
+	.name = "cdev",
+	.simulated = false,
+	.setup = cdev_setup,
+	.open_inputs = cdev_open_inputs,
+	.sample = cdev_sample,
+	.event_fd = cdev_event_fd,
+	.read_edges = cdev_read_edges,
+	.close_inputs = cdev_close_inputs,
+	.teardown = cdev_teardown,
+};
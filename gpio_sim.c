@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include "gpio.h"
+
+#define SIM_MAX_PINS 256
+
+struct sim_change {
+	int64_t at_ms;
+	int pin;
+	int level;
+	int order;
+};
+
+static struct sim_change *changes = NULL;
+static int change_count = 0;
+static int64_t repeat_ms = 0;
+
+static int levels[SIM_MAX_PINS];
+static int next_change = 0;
+static int64_t now_ns = 0;
+static int64_t step_ns = 0;
+static int64_t pass_start_ms = 0;
+
+static int inputPins[GPIO_MAX_INPUTS];
+static int inputCount = 0;
+
+// event mode: schedule time 0 is startNs on CLOCK_MONOTONIC
+static bool eventMode = false;
+static int timerFd = -1;
+static int64_t startNs = 0;
+static int64_t changedAt[SIM_MAX_PINS];
+static int64_t debounceNs[GPIO_MAX_INPUTS];
+static int reported[GPIO_MAX_INPUTS];
+
+static int64_t monotonic_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void ns_to_timespec(int64_t ns, struct timespec *ts) {
+	ts->tv_sec = ns / 1000000000;
+	ts->tv_nsec = ns % 1000000000;
+}
+
+static int compare_changes(const void *a, const void *b) {
+	const struct sim_change *ca = a;
+	const struct sim_change *cb = b;
+	if(ca->at_ms != cb->at_ms) return (ca->at_ms < cb->at_ms) ? -1 : 1;
+	return ca->order - cb->order;
+}
+
+static int parse_level(const char *s) {
+	if(strcmp(s, "0") == 0 || strcasecmp(s, "low") == 0) return GPIO_LOW;
+	if(strcmp(s, "1") == 0 || strcasecmp(s, "high") == 0) return GPIO_HIGH;
+	return -1;
+}
+
+int gpio_sim_load(const char *path, long step) {
+	step_ns = step;
+	FILE *f = fopen(path, "r");
+	if(f == NULL) {
+		fprintf(stderr, "SIM: could not open schedule %s\n", path);
+		return -1;
+	}
+
+	int capacity = 64;
+	changes = malloc(capacity * sizeof(*changes));
+	change_count = 0;
+	if(changes == NULL) {
+		fprintf(stderr, "SIM: out of memory for schedule %s\n", path);
+		fclose(f);
+		return -1;
+	}
+
+	char line[256];
+	int lineno = 0;
+	while(fgets(line, sizeof(line), f) != NULL) {
+		lineno++;
+		char *p = line + strspn(line, " \t");
+		if(*p == '#' || *p == '\n' || *p == '\0') continue;
+
+		long long period;
+		if(sscanf(p, "repeat %lld", &period) == 1) {
+			repeat_ms = period;
+			continue;
+		}
+
+		long long at;
+		int pin;
+		char level[16];
+		if(sscanf(p, "%lld %d %15s", &at, &pin, level) != 3 || pin < 0 || pin >= SIM_MAX_PINS || parse_level(level) < 0) {
+			fprintf(stderr, "SIM: bad schedule line %d: %s", lineno, line);
+			fclose(f);
+			free(changes);
+			changes = NULL;
+			change_count = 0;
+			return -1;
+		}
+
+		if(change_count == capacity) {
+			struct sim_change *grown = realloc(changes, capacity * 2 * sizeof(*changes));
+			if(grown == NULL) {
+				fprintf(stderr, "SIM: out of memory at schedule line %d\n", lineno);
+				fclose(f);
+				free(changes);
+				changes = NULL;
+				change_count = 0;
+				return -1;
+			}
+			changes = grown;
+			capacity *= 2;
+		}
+		changes[change_count] = (struct sim_change){at, pin, parse_level(level), change_count};
+		change_count++;
+	}
+	fclose(f);
+
+	// changes at the same time apply in file order
+	qsort(changes, change_count, sizeof(*changes), compare_changes);
+	if(repeat_ms > 0 && change_count > 0 && changes[change_count - 1].at_ms >= repeat_ms) {
+		fprintf(stderr, "SIM: repeat period %" PRId64 " ms is shorter than the schedule\n", repeat_ms);
+		free(changes);
+		changes = NULL;
+		change_count = 0;
+		return -1;
+	}
+	return 0;
+}
+
+static int sim_setup(void) {
+	int i;
+	for(i = 0; i < SIM_MAX_PINS; i++) {
+		levels[i] = GPIO_HIGH;
+		changedAt[i] = 0;
+	}
+	next_change = 0;
+	now_ns = 0;
+	pass_start_ms = 0;
+	return 0;
+}
+
+// apply every change that is due at schedule time now (ns)
+static void apply_due_changes(int64_t now) {
+	int64_t now_ms = now / 1000000;
+	for(;;) {
+		if(next_change >= change_count) {
+			if(repeat_ms <= 0 || change_count == 0 || now_ms < pass_start_ms + repeat_ms) break;
+			pass_start_ms += repeat_ms;
+			next_change = 0;
+		}
+		int64_t at_ms = changes[next_change].at_ms + pass_start_ms;
+		if(at_ms > now_ms) break;
+		levels[changes[next_change].pin] = changes[next_change].level;
+		changedAt[changes[next_change].pin] = at_ms * 1000000;
+		next_change++;
+	}
+}
+
+// schedule time (ns) of the next change, -1 when the schedule is finished
+static int64_t next_change_ns(void) {
+	if(next_change < change_count) return (changes[next_change].at_ms + pass_start_ms) * 1000000;
+	if(repeat_ms > 0 && change_count > 0) return (pass_start_ms + repeat_ms + changes[0].at_ms) * 1000000;
+	return -1;
+}
+
+static void arm_timer(int64_t deadline) {
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+	if(deadline >= 0) {
+		ns_to_timespec(startNs + deadline, &its.it_value);
+		// an all zero it_value disarms the timer
+		if(its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) its.it_value.tv_nsec = 1;
+	}
+	timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static int sim_open_inputs(const int *pins, const int *debounce_us, int count) {
+	if(count > GPIO_MAX_INPUTS) return -1;
+	int i;
+	for(i = 0; i < count; i++) {
+		if(pins[i] < 0 || pins[i] >= SIM_MAX_PINS) return -1;
+		inputPins[i] = pins[i];
+		debounceNs[i] = (debounce_us != NULL) ? (int64_t)debounce_us[i] * 1000 : 0;
+		reported[i] = GPIO_HIGH;
+	}
+	inputCount = count;
+
+	if(debounce_us != NULL) {
+		timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if(timerFd < 0) return -1;
+		eventMode = true;
+		startNs = monotonic_ns();
+		arm_timer(next_change_ns());
+	}
+	return 0;
+}
+
+static void sim_sample(struct gpio_sample *out) {
+	int64_t now = eventMode ? monotonic_ns() - startNs : now_ns;
+	apply_due_changes(now);
+
+	uint64_t mask = 0;
+	int i;
+	for(i = 0; i < inputCount; i++) {
+		mask |= (uint64_t)levels[inputPins[i]] << i;
+	}
+	out->levels = mask;
+
+	if(eventMode) {
+		ns_to_timespec(startNs + now, &out->time);
+	} else {
+		ns_to_timespec(now, &out->time);
+		now_ns += step_ns;
+	}
+}
+
+static int sim_event_fd(void) {
+	return timerFd;
+}
+
+static int sim_read_edges(struct gpio_edge *out, int max) {
+	uint64_t expirations;
+	if(read(timerFd, &expirations, sizeof(expirations)) < 0) {
+		// spurious wakeup, the pending state is re-checked below anyway
+	}
+
+	int64_t now = monotonic_ns() - startNs;
+	apply_due_changes(now);
+
+	// like the kernel, a change is only an edge once the line has held it for the debounce period
+	int64_t deadline = next_change_ns();
+	int stored = 0;
+	int i, j;
+	for(i = 0; i < inputCount; i++) {
+		int pin = inputPins[i];
+		if(levels[pin] == reported[i]) continue;
+
+		int64_t stableAt = changedAt[pin] + debounceNs[i];
+		if(stableAt > now || stored == max) {
+			if(stored == max) stableAt = now;
+			if(deadline < 0 || stableAt < deadline) deadline = stableAt;
+			continue;
+		}
+
+		// keep the batch in time order
+		struct gpio_edge edge = {i, levels[pin], {0, 0}};
+		ns_to_timespec(startNs + changedAt[pin], &edge.time);
+		for(j = stored; j > 0 && changedAt[inputPins[out[j - 1].slot]] > changedAt[pin]; j--) {
+			out[j] = out[j - 1];
+		}
+		out[j] = edge;
+		stored++;
+		reported[i] = levels[pin];
+	}
+
+	arm_timer(deadline);
+	return stored;
+}
+
+static void sim_close_inputs(void) {
+	if(timerFd >= 0) {
+		close(timerFd);
+		timerFd = -1;
+	}
+	eventMode = false;
+	inputCount = 0;
+}
+
+static void sim_teardown(void) {
+	free(changes);
+	changes = NULL;
+	change_count = 0;
+}
+
+const struct gpio_backend gpio_sim = {
+	.name = "sim",
+	.simulated = true,
+	.setup = sim_setup,
+	.open_inputs = sim_open_inputs,
+	.sample = sim_sample,
+	.event_fd = sim_event_fd,
+	.read_edges = sim_read_edges,
+	.close_inputs = sim_close_inputs,
+	.teardown = sim_teardown,
+};
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <string.h>
+#include "gpio.h"
+#include "trace.h"
+
+static struct trace_header header;
+static bool loaded = false;
+
+// the record the trace is heading for, and how far into the run up to it we are
+static uint64_t levels = 0;
+static int64_t runStartNs = 0;
+static uint64_t runCycles = 0;
+static int64_t runNs = 0;
+static uint64_t runChanged = 0;
+static uint64_t cycle = 0;
+static bool haveRun = false;
+static bool finished = false;
+
+static void ns_to_timespec(int64_t ns, struct timespec *ts) {
+	ts->tv_sec = ns / 1000000000;
+	ts->tv_nsec = ns % 1000000000;
+}
+
+static void next_run(void) {
+	int got = trace_replay_next(&runCycles, &runNs, &runChanged);
+	if(got < 0) fprintf(stderr, "TRACE: trace is cut short, replaying what is there\n");
+	haveRun = (got > 0);
+	cycle = 0;
+}
+
+int gpio_trace_load(const char *path, long *samplePeriod, int *bayCount) {
+	if(trace_replay_open(path, &header) < 0) return -1;
+	loaded = true;
+	*samplePeriod = header.sample_period_ns;
+	*bayCount = header.bay_count;
+	return 0;
+}
+
+void gpio_trace_wall_time(const struct timespec *t, struct timespec *wall) {
+	int64_t ns = header.start_wall_ns + ((int64_t)t->tv_sec * 1000000000 + t->tv_nsec - header.start_mono_ns);
+	ns_to_timespec(ns, wall);
+}
+
+bool gpio_trace_finished(void) {
+	return finished;
+}
+
+static int trace_setup(void) {
+	if(!loaded) return -1;
+	levels = header.start_levels;
+	runStartNs = header.start_mono_ns;
+	finished = false;
+	next_run();
+	return 0;
+}
+
+static int trace_open_inputs(const int *pins, const int *debounce_us, int count) {
+	// debounce and sessions are only the same if every slot is the pin it was when recorded
+	if(debounce_us != NULL || (uint32_t)count != header.input_count) return -1;
+	int i;
+	for(i = 0; i < count; i++) {
+		if(pins[i] != header.pins[i]) {
+			fprintf(stderr, "TRACE: slot %d was pin %d when recorded, the config says pin %d\n", i, header.pins[i], pins[i]);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void trace_sample_levels(struct gpio_sample *out) {
+	int64_t now;
+	if(haveRun && cycle >= runCycles) {
+		// the recorded change lands on exactly the cycle and time it was seen
+		levels ^= runChanged;
+		runStartNs += runNs;
+		now = runStartNs;
+		next_run();
+	} else if(haveRun) {
+		// cycles in between are spread evenly over the run
+		now = runStartNs + (int64_t)((double)runNs * cycle / runCycles);
+	} else {
+		now = runStartNs + (int64_t)cycle * header.sample_period_ns;
+	}
+	cycle++;
+	if(!haveRun) finished = true;
+
+	out->levels = levels;
+	ns_to_timespec(now, &out->time);
+}
+
+static void trace_close_inputs(void) {
+}
+
+static void trace_teardown(void) {
+	trace_replay_close();
+	loaded = false;
+}
+
+const struct gpio_backend gpio_trace = {
+	.name = "trace",
+	.simulated = true,
+	.setup = trace_setup,
+	.open_inputs = trace_open_inputs,
+	.sample = trace_sample_levels,
+	.event_fd = NULL,
+	.read_edges = NULL,
+	.close_inputs = trace_close_inputs,
+	.teardown = trace_teardown,
+};
@@ -0,0 +1,121 @@
+#include <wiringPi.h>
+#include <mcp23017.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "gpio.h"
+
+/*
+	BULK READS
+	on the BCM283x/2711 every GPIO level 0-31 sits in one register (GPLEV0),
+	so a single MMIO load through /dev/gpiomem samples every bay at once.
+	pins that are not on bank 0 (or boards without gpiomem, like the Pi 5)
+	fall back to one digitalRead each.
+*/
+#define GPIOMEM_SIZE 4096
+#define GPLEV0 (0x34 / 4)
+
+static volatile uint32_t *gpioRegs = NULL;
+
+static int inputPins[GPIO_MAX_INPUTS];
+static int inputBits[GPIO_MAX_INPUTS]; // BCM bit in GPLEV0, -1 for digitalRead
+static int inputCount = 0;
+
+// MCP23017 expanders for sites with more bays than the header has pins
+#define MAX_EXPANDERS 8
+static int expanderBase[MAX_EXPANDERS];
+static int expanderAddress[MAX_EXPANDERS];
+static int expanderCount = 0;
+
+void gpio_wiringpi_add_mcp23017(int pin_base, int i2c_address) {
+	if(expanderCount == MAX_EXPANDERS) return;
+	expanderBase[expanderCount] = pin_base;
+	expanderAddress[expanderCount] = i2c_address;
+	expanderCount++;
+}
+
+static int wpi_setup(void) {
+	if(wiringPiSetup() < 0) return -1;
+
+	int i;
+	for(i = 0; i < expanderCount; i++) {
+		if(!mcp23017Setup(expanderBase[i], expanderAddress[i])) {
+			fprintf(stderr, "GPIO: no MCP23017 at i2c address 0x%02x\n", expanderAddress[i]);
+			return -1;
+		}
+	}
+
+	int fd = open("/dev/gpiomem", O_RDONLY | O_SYNC | O_CLOEXEC);
+	if(fd < 0) {
+		printf("GPIO: /dev/gpiomem not available, reading pins one at a time\n");
+		return 0;
+	}
+	void *map = mmap(NULL, GPIOMEM_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) {
+		printf("GPIO: could not map /dev/gpiomem, reading pins one at a time\n");
+		return 0;
+	}
+	gpioRegs = map;
+	return 0;
+}
+
+static int wpi_open_inputs(const int *pins, const int *debounce_us, int count) {
+	// wiringPi can only be polled
+	if(debounce_us != NULL || count > GPIO_MAX_INPUTS) return -1;
+	int i;
+	for(i = 0; i < count; i++) {
+		pinMode(pins[i], INPUT);
+		pullUpDnControl(pins[i], PUD_UP);
+		inputPins[i] = pins[i];
+
+		// expander pins (pin base >= 64) have no BCM number
+		int bcm = (pins[i] < 64) ? wpiPinToGpio(pins[i]) : -1;
+		inputBits[i] = (gpioRegs != NULL && bcm >= 0 && bcm < 32) ? bcm : -1;
+	}
+	inputCount = count;
+	return 0;
+}
+
+static void wpi_sample(struct gpio_sample *out) {
+	uint32_t bank0 = (gpioRegs != NULL) ? gpioRegs[GPLEV0] : 0;
+	clock_gettime(CLOCK_MONOTONIC, &out->time);
+
+	uint64_t levels = 0;
+	int i;
+	for(i = 0; i < inputCount; i++) {
+		int high = (inputBits[i] >= 0)
+			? (bank0 >> inputBits[i]) & 1
+			: digitalRead(inputPins[i]) != LOW;
+		levels |= (uint64_t)high << i;
+	}
+	out->levels = levels;
+}
+
+static void wpi_close_inputs(void) {
+	int i;
+	for(i = 0; i < inputCount; i++) {
+		pullUpDnControl(inputPins[i], PUD_DOWN);
+	}
+	inputCount = 0;
+}
+
+static void wpi_teardown(void) {
+	if(gpioRegs != NULL) {
+		munmap((void *)gpioRegs, GPIOMEM_SIZE);
+		gpioRegs = NULL;
+	}
+}
+
+const struct gpio_backend gpio_wiringpi = {
+	.name = "wiringpi",
+	.simulated = false,
+	.setup = wpi_setup,
+	.open_inputs = wpi_open_inputs,
+	.sample = wpi_sample,
+	.event_fd = NULL,
+	.read_edges = NULL,
+	.close_inputs = wpi_close_inputs,
+	.teardown = wpi_teardown,
+};
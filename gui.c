@@ -8,6 +8,14 @@
 #include <ncurses.h>
 #include <libpq-fe.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <sys/ioctl.h>
+#include "config.h"
+#include "dbwriter.h"
+#include "dashboard.h"
 
 bool stopProgram = false;
 
@@ -38,15 +46,513 @@ bool pg_bad_data(PGresult *res) {
 	return (PQresultStatus(res) != PGRES_TUPLES_OK) ? true : false;
 }
 
-int main ()
+volatile sig_atomic_t resized = 0;
+
+void resize_handler(int signo)
+{
+	resized = 1;
+}
+
+/*
+	DAMAGE TRACKED RENDERING
+	every frame is built as a list of fields (position, color, text) in the
+	same order. only fields that differ from the last frame are erased and
+	redrawn, so an idle dashboard sends next to nothing over a slow ssh link.
+	what a frame cost is read back from the kernel's count of bytes this
+	process has written (ncurses writes the terminal fd directly, nothing
+	else writes while a frame goes out)
+*/
+#define MAX_FIELDS (CONFIG_MAX_BAYS * 24 + 8)
+#define FIELD_TEXT 48
+
+struct field {
+	int y, x;
+	int color;
+	char text[FIELD_TEXT];
+};
+
+struct field frame[MAX_FIELDS];
+struct field shown[MAX_FIELDS];
+int frameCount = 0;
+int shownCount = 0;
+// forget what is on screen, the next render draws everything
+bool fullRedraw = true;
+
+long bytes_written(void)
+{
+	long wchar = -1;
+	char line[64];
+	FILE *io = fopen("/proc/self/io", "r");
+	if(io == NULL) return -1;
+	while(fgets(line, sizeof(line), io) != NULL) {
+		if(sscanf(line, "wchar: %ld", &wchar) == 1) break;
+	}
+	fclose(io);
+	return wchar;
+}
+
+void put(int y, int x, int color, const char *fmt, ...)
+{
+	if(frameCount == MAX_FIELDS) return;
+	struct field *f = &frame[frameCount++];
+	f->y = y;
+	f->x = x;
+	f->color = color;
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(f->text, FIELD_TEXT, fmt, args);
+	va_end(args);
+	// a newline would clear the rest of the line on screen
+	f->text[strcspn(f->text, "\n")] = '\0';
+}
+
+bool same_field(const struct field *a, const struct field *b)
+{
+	return a->y == b->y && a->x == b->x && a->color == b->color && strcmp(a->text, b->text) == 0;
+}
+
+void render(void)
+{
+	int i;
+	if(fullRedraw) {
+		clear();
+		shownCount = 0;
+		fullRedraw = false;
+	}
+
+	// blank everything that changed first, so a moved field never wipes a new one
+	for(i = 0; i < shownCount; i++) {
+		if(i < frameCount && same_field(&frame[i], &shown[i])) continue;
+		mvprintw(shown[i].y, shown[i].x, "%*s", (int)strlen(shown[i].text), "");
+	}
+	for(i = 0; i < frameCount; i++) {
+		if(i < shownCount && same_field(&frame[i], &shown[i])) continue;
+		if(frame[i].color) attron(COLOR_PAIR(frame[i].color));
+		mvprintw(frame[i].y, frame[i].x, "%s", frame[i].text);
+		if(frame[i].color) attroff(COLOR_PAIR(frame[i].color));
+	}
+
+	memcpy(shown, frame, frameCount * sizeof(frame[0]));
+	shownCount = frameCount;
+	frameCount = 0;
+	refresh();
+}
+
+/*
+	DOUBLE BUFFERED SNAPSHOT
+	everything a frame shows lives in one snapshot. the frame is drawn from
+	the front one only; a query result, a notification or a change in the
+	live status segment is applied to a copy in the back one, which then
+	becomes the front. a frame never shows half of a result, and nothing a
+	fetch does waits on the screen or the other way around
+*/
+#define RECENT_SESSIONS 20
+#define REVENUE_ROWS 31
+
+struct recent_session {
+	char when[20];
+	double timer_time;
+	double pump_time;
+};
+
+struct revenue_row {
+	char period[12];
+	long sessions;
+	double timer_time;
+	long inserts;
+};
+
+struct gui_snapshot {
+	// status and totals of every bay (dashboard.h)
+	struct dashboard_bays bays;
+
+	// DRILLDOWN: which bay (and range) the rows are for, -1 before the first fetch
+	int sessionsBay;
+	int sessionCount;
+	struct recent_session sessions[RECENT_SESSIONS];
+	int revenueBay;
+	int revenueRange;
+	int revenueCount;
+	struct revenue_row revenue[REVENUE_ROWS];
+};
+
+struct gui_snapshot snapshots[2];
+int front = 0;
+
+struct gui_snapshot *begin_update(void)
+{
+	snapshots[!front] = snapshots[front];
+	return &snapshots[!front];
+}
+
+void publish_update(void)
+{
+	front = !front;
+}
+
+// revenue breakdowns the r key steps through
+struct revenue_range {
+	const char *label;
+	const char *unit;       // date_trunc field, one row per unit
+	const char *format;     // to_char of a row's period
+	const char *count;      // rows, this one included
+};
+const struct revenue_range ranges[] = {
+	{"LAST 7 DAYS", "day", "YYYY-MM-DD", "7"},
+	{"LAST 30 DAYS", "day", "YYYY-MM-DD", "30"},
+	{"LAST 12 MONTHS", "month", "YYYY-MM", "12"},
+};
+#define RANGE_COUNT (int)(sizeof(ranges) / sizeof(ranges[0]))
+
+/*
+	ASYNCHRONOUS FETCHES
+	one query in flight at a time, sent with PQsendQuery(Params) on a
+	nonblocking connection and read back in the same poll as the keyboard.
+	each kind is asked for again only when something says it changed: a
+	notification, a reconnecting monitor, or the user picking another bay
+	or range. results for a bay or range no longer selected are thrown away
+	and the current one is fetched instead
+*/
+enum gui_query {
+	QUERY_NONE,
+	QUERY_STATUS,
+	QUERY_TOTALS,
+	QUERY_SESSIONS,
+	QUERY_REVENUE,
+};
+
+static const char *SESSIONS_SQL =
+	"SELECT to_char(timestamp, 'YYYY-MM-DD HH24:MI:SS'), timer_time, pump_time FROM bay_sessions "
+	"WHERE bay = $1::int ORDER BY timestamp DESC LIMIT $2::int;";
+// one row per day or month of the range, empty ones included, newest first
+static const char *REVENUE_SQL =
+	"WITH r AS (SELECT date_trunc($2, localtimestamp) - ($4::int - 1) * ('1 ' || $2)::interval AS first, "
+		"date_trunc($2, localtimestamp) AS last, ('1 ' || $2)::interval AS step) "
+	"SELECT to_char(p.period, $3), COALESCE(s.sessions, 0), COALESCE(s.timer_time, 0), COALESCE(m.inserts, 0) "
+	"FROM r, generate_series(r.first, r.last, r.step) AS p(period) "
+	"LEFT JOIN (SELECT date_trunc($2, timestamp) AS period, COUNT(*) AS sessions, SUM(timer_time) AS timer_time "
+		"FROM bay_sessions, r WHERE bay = $1::int AND timestamp >= r.first GROUP BY 1) s USING (period) "
+	"LEFT JOIN (SELECT date_trunc($2, timestamp) AS period, COUNT(*) AS inserts "
+		"FROM bay_maintenance_inserts, r WHERE bay = $1::int AND timestamp >= r.first GROUP BY 1) m USING (period) "
+	"ORDER BY p.period DESC;";
+
+PGconn *conn = NULL;
+enum gui_query inFlight = QUERY_NONE;
+// the bay and range the query in flight was for
+int inFlightBay = 0;
+int inFlightRange = 0;
+// nonblocking: a query can be left part sent, PQflush goes on with it when the socket takes more
+bool flushing = false;
+bool reloadStatus = true;
+bool reloadTotals = true;
+bool reloadSessions = false;
+bool reloadRevenue = false;
+// LIVE STATUS: copied out of shared memory every frame while the monitor runs here
+struct dashboard_live liveStatus;
+
+// SELECTION: the highlighted bay, and whether its drilldown is open
+int selectedBay = 0;
+bool detailOpen = false;
+int selectedRange = 0;
+
+bool fetch_flush(void)
+{
+	int pending = PQflush(conn);
+	flushing = pending > 0;
+	return pending >= 0;
+}
+
+// send the next query that is due, false when the connection failed
+bool fetch_next(void)
+{
+	if(inFlight != QUERY_NONE) return true;
+	char bay[12], limit[12];
+	snprintf(bay, sizeof(bay), "%d", selectedBay + 1);
+	snprintf(limit, sizeof(limit), "%d", RECENT_SESSIONS);
+	int sent = 1;
+	if(reloadTotals) {
+		reloadTotals = false;
+		inFlight = QUERY_TOTALS;
+		sent = PQsendQuery(conn, DASHBOARD_TOTALS_SQL);
+	} else if(reloadStatus && !liveStatus.live) {
+		reloadStatus = false;
+		inFlight = QUERY_STATUS;
+		sent = PQsendQuery(conn, DASHBOARD_STATUS_SQL);
+	} else if(reloadSessions && detailOpen) {
+		reloadSessions = false;
+		inFlight = QUERY_SESSIONS;
+		const char *params[2] = {bay, limit};
+		sent = PQsendQueryParams(conn, SESSIONS_SQL, 2, NULL, params, NULL, NULL, 0);
+	} else if(reloadRevenue && detailOpen) {
+		reloadRevenue = false;
+		inFlight = QUERY_REVENUE;
+		const struct revenue_range *range = &ranges[selectedRange];
+		const char *params[4] = {bay, range->unit, range->format, range->count};
+		sent = PQsendQueryParams(conn, REVENUE_SQL, 4, NULL, params, NULL, NULL, 0);
+	} else {
+		return true;
+	}
+	inFlightBay = selectedBay;
+	inFlightRange = selectedRange;
+	return sent == 1 && fetch_flush();
+}
+
+// copy a finished result into the back snapshot and make it the front one
+void take_result(PGresult *res, int bayCount, double now)
+{
+	int x;
+	if(inFlight == QUERY_STATUS && liveStatus.live) return;
+	if(PQresultStatus(res) != PGRES_TUPLES_OK) {
+		// no bay_status table, no monitor keeping it: nothing is known to be running
+		if(inFlight == QUERY_STATUS) {
+			dashboard_take_status(&begin_update()->bays, res, bayCount, now);
+			publish_update();
+		}
+		return;
+	}
+	// picked another bay (or range, for revenue) while this was on its way, the new one is already due
+	if(inFlight == QUERY_SESSIONS && inFlightBay != selectedBay) return;
+	if(inFlight == QUERY_REVENUE && (inFlightBay != selectedBay || inFlightRange != selectedRange)) return;
+
+	struct gui_snapshot *back = begin_update();
+	switch(inFlight) {
+		case QUERY_STATUS:
+			dashboard_take_status(&back->bays, res, bayCount, now);
+			break;
+		case QUERY_TOTALS:
+			dashboard_take_totals(&back->bays, res, bayCount);
+			break;
+		case QUERY_SESSIONS:
+			back->sessionsBay = inFlightBay;
+			back->sessionCount = 0;
+			for(x = 0; x < PQntuples(res) && x < RECENT_SESSIONS; x++) {
+				struct recent_session *session = &back->sessions[back->sessionCount++];
+				snprintf(session->when, sizeof(session->when), "%s", PQgetvalue(res, x, 0));
+				session->timer_time = atof(PQgetvalue(res, x, 1));
+				session->pump_time = atof(PQgetvalue(res, x, 2));
+			}
+			break;
+		case QUERY_REVENUE:
+			back->revenueBay = inFlightBay;
+			back->revenueRange = inFlightRange;
+			back->revenueCount = 0;
+			for(x = 0; x < PQntuples(res) && x < REVENUE_ROWS; x++) {
+				struct revenue_row *row = &back->revenue[back->revenueCount++];
+				snprintf(row->period, sizeof(row->period), "%s", PQgetvalue(res, x, 0));
+				row->sessions = atol(PQgetvalue(res, x, 1));
+				row->timer_time = atof(PQgetvalue(res, x, 2));
+				row->inserts = atol(PQgetvalue(res, x, 3));
+			}
+			break;
+		case QUERY_NONE:
+			break;
+	}
+	publish_update();
+}
+
+// everything the socket had: query results and notifications. false when the connection failed
+bool fetch_input(int bayCount, double now)
+{
+	if(PQconsumeInput(conn) == 0) return false;
+	while(inFlight != QUERY_NONE && !PQisBusy(conn)) {
+		PGresult *res = PQgetResult(conn);
+		if(res == NULL) {
+			inFlight = QUERY_NONE;
+			break;
+		}
+		take_result(res, bayCount, now);
+		PQclear(res);
+	}
+
+	PGnotify *notify;
+	while((notify = PQnotifies(conn)) != NULL) {
+		struct dashboard_notify note;
+		switch(dashboard_parse_notify(notify->extra, bayCount, &note)) {
+			case DASHBOARD_NOTIFY_RELOAD:
+				reloadStatus = true;
+				reloadTotals = true;
+				reloadSessions = true;
+				reloadRevenue = true;
+				break;
+			case DASHBOARD_NOTIFY_STATUS:
+				if(!liveStatus.live) {
+					dashboard_apply_notify(&begin_update()->bays, &note);
+					publish_update();
+				}
+				break;
+			case DASHBOARD_NOTIFY_TOTALS:
+				// a session or maintenance insert moved the totals, and the drilldown if it is that bay
+				reloadTotals = true;
+				if(note.bay == selectedBay) {
+					if(note.change == 'c') reloadSessions = true;
+					reloadRevenue = true;
+				}
+				break;
+			case DASHBOARD_NOTIFY_NONE:
+				break;
+		}
+		PQfreemem(notify);
+	}
+	return true;
+}
+
+// keys waiting on stdin, false to quit
+bool read_keys(int bayCount)
+{
+	int ch;
+	while((ch = getch()) != ERR) {
+		int bay = selectedBay, range = selectedRange;
+		switch(ch) {
+			case 'q':
+			case 'Q':
+				return false;
+			case KEY_LEFT:
+			case 'h':
+				bay = (selectedBay + bayCount - 1) % bayCount;
+				break;
+			case KEY_RIGHT:
+			case 'l':
+			case '\t':
+				bay = (selectedBay + 1) % bayCount;
+				break;
+			case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+				if(ch - '1' < bayCount) bay = ch - '1';
+				break;
+			case '\n':
+			case KEY_ENTER:
+			case ' ':
+				detailOpen = !detailOpen;
+				fullRedraw = true;
+				break;
+			case 27:        // escape
+			case KEY_BACKSPACE:
+				if(detailOpen) fullRedraw = true;
+				detailOpen = false;
+				break;
+			case 'r':
+				range = (selectedRange + 1) % RANGE_COUNT;
+				break;
+			case KEY_RESIZE:
+				resized = 1;
+				break;
+		}
+		if(bay != selectedBay) reloadSessions = true;
+		if(bay != selectedBay || range != selectedRange) reloadRevenue = true;
+		selectedBay = bay;
+		selectedRange = range;
+		// opening the drilldown always fetches it fresh
+		if(detailOpen && (ch == '\n' || ch == KEY_ENTER || ch == ' ')) {
+			reloadSessions = true;
+			reloadRevenue = true;
+		}
+	}
+	return true;
+}
+
+// the snapshot only changes when the monitor published a change
+void read_live(int bayCount, double now)
+{
+	switch(dashboard_live_read(&liveStatus, true)) {
+		case DASHBOARD_LIVE_CHANGED:
+			dashboard_live_apply(&liveStatus, &begin_update()->bays, bayCount, now);
+			publish_update();
+			break;
+		case DASHBOARD_LIVE_GONE:
+			// whatever bay_status says is stale by the time the segment goes
+			reloadStatus = true;
+			break;
+		case DASHBOARD_LIVE_SAME:
+			break;
+	}
+}
+
+// h:mm:ss or m:ss, whole seconds
+void format_duration(char *out, size_t size, double seconds)
+{
+	int total = (int)seconds;
+	if(total >= 3600) snprintf(out, size, "%d:%02d:%02d", total / 3600, total % 3600 / 60, total % 60);
+	else snprintf(out, size, "%d:%02d", total / 60, total % 60);
+}
+
+/*
+	DRILLDOWN: the selected bay's recent sessions on the left, its revenue
+	over the selected range on the right, in place of the bay panels
+*/
+void draw_detail(const struct gui_snapshot *snap, const struct carwash_config *config, int ymax, int xmax, double now)
+{
+	int bay = selectedBay;
+	int rows = ymax - 8;
+	int right = xmax / 2;
+	int x;
+	char timer[16], pump[16];
+
+	int color = snap->bays.running[bay][0] ? 1 : 2;
+	put(2, 1, color, "   BAY %d   ", bay + 1);
+	if(snap->bays.running[bay][0]) {
+		format_duration(timer, sizeof(timer), dashboard_runtime(&snap->bays, bay, 0, now));
+		format_duration(pump, sizeof(pump), dashboard_runtime(&snap->bays, bay, 1, now));
+		put(2, 14, 5, "RUNNING %s, PUMP %s%s", timer, pump, snap->bays.running[bay][1] ? " (ON)" : "");
+	} else {
+		put(2, 14, 0, "%s", "");
+	}
+
+	put(4, 1, 0, "RECENT SESSIONS");
+	put(5, 1, 3, "%-19s %8s %8s %7s", "ENDED", "TIMER", "PUMP", "GROSS");
+	if(snap->sessionsBay != bay) {
+		put(6, 1, 0, "loading...");
+	} else if(snap->sessionCount == 0) {
+		put(6, 1, 0, "no sessions");
+	}
+	for(x = 0; snap->sessionsBay == bay && x < snap->sessionCount && x < rows; x++) {
+		const struct recent_session *session = &snap->sessions[x];
+		format_duration(timer, sizeof(timer), session->timer_time);
+		format_duration(pump, sizeof(pump), session->pump_time);
+		put(6 + x, 1, 4, "%-19s %8s %8s %7.2f", session->when, timer, pump, session->timer_time / 60 * config->price_per_minute[bay]);
+	}
+
+	bool current = snap->revenueBay == bay && snap->revenueRange == selectedRange;
+	put(4, right, 0, "REVENUE, %s", ranges[selectedRange].label);
+	put(5, right, 3, "%-10s %6s %8s %7s %7s", "", "WASHES", "GROSS", "COINS", "NET");
+	if(!current) put(6, right, 0, "loading...");
+	double gross = 0, coins = 0;
+	for(x = 0; current && x < snap->revenueCount; x++) {
+		const struct revenue_row *row = &snap->revenue[x];
+		double rowGross = row->timer_time / 60 * config->price_per_minute[bay];
+		double rowCoins = row->inserts * config->coin_value[bay];
+		gross += rowGross;
+		coins += rowCoins;
+		if(x < rows - 1) put(6 + x, right, 4, "%-10s %6ld %8.2f %7.2f %7.2f", row->period, row->sessions, rowGross, rowCoins, rowGross - rowCoins);
+	}
+	if(current) {
+		int shown = snap->revenueCount < rows - 1 ? snap->revenueCount : rows - 1;
+		put(6 + shown, right, 5, "%-10s %6s %8.2f %7.2f %7.2f", "TOTAL", "", gross, coins, gross - coins);
+	}
+}
+
+int main (int argc, char **argv)
 {
+	// same site configuration as the monitor: bay count and pricing
+	const char *configPath = NULL;
+	int opt;
+	while((opt = getopt(argc, argv, "f:h")) != -1) {
+		switch(opt) {
+			case 'f': configPath = optarg; break;
+			default:
+				fprintf(stderr, "usage: %s [-f config]\n", argv[0]);
+				exit(opt == 'h' ? 0 : 1);
+		}
+	}
+	struct carwash_config config;
+	if(config_load(configPath, &config) < 0) exit(1);
+	int bayCount = config.bay_count;
+
 	if (signal(SIGINT, sig_handler) == SIG_ERR)
 		printf("\ncan't catch SIGINT\n");
 	if (signal(SIGUSR1, sig_handler) == SIG_ERR)
 		printf("\ncan't catch SIGUSR1\n");
 
 	// CONNECT TO POSTGRESQL
-	PGconn *conn = PQconnectdb("user=washman password=cotton dbname=carwash");
+	conn = PQconnectdb("user=washman password=cotton dbname=carwash");
 
 	if(PQstatus(conn) == CONNECTION_BAD) {
 		fprintf(stderr, "Connection to database failed: %s\n", PQerrorMessage(conn));
@@ -54,62 +560,41 @@ int main ()
 		exit(1);
 	}
 
+	// the monitor tells us when anything changes, so the database is only asked when it has
+	PGresult *res = PQexec(conn, "LISTEN " DB_NOTIFY_CHANNEL ";");
+	if(pg_bad_result(res)) do_exit(conn, res);
+	PQclear(res);
+	// from here on every query is sent and read back without waiting on it
+	if(PQsetnonblocking(conn, 1) != 0) do_exit(conn, NULL);
+	snapshots[0].sessionsBay = snapshots[0].revenueBay = -1;
+
 	// INIT NCURSES
 	initscr();
 	cbreak();
 	noecho();
 	curs_set(0);
+	// keys come in with the poll below, getch only takes what is already there
+	keypad(stdscr, TRUE);
+	nodelay(stdscr, TRUE);
+	set_escdelay(25);
+
+	// ncurses would otherwise only pick up a resize from getch()
+	signal(SIGWINCH, resize_handler);
 
-	// get coordinates
+	// get coordinates (again after every resize)
 	int xmax,ymax;
-	getmaxyx(stdscr, ymax, xmax);
-
-	int quads[4][2] = {
-		{ymax/4, xmax/4},	// TOP LEFT
-		{ymax/4, xmax/4 + xmax/2}, // TOP RIGHT
-		{ymax/4 + ymax/2, xmax/4}, // BOTTOM LEFT
-		{ymax/4 + ymax/2, xmax/4 + xmax/2} // BOTTOM RIGHT
-	};
-
-	int vertical_quad_width = ((xmax+4) / 4);
-	int vertical_quad_height = ymax - 6;
-	int vertical_quad_top = 4;
-
-	int title_offset = -(ymax/4)/2;
-
-	/* MAIN DATA STORAGE */
-	bool bayRunning[4][2] = {
-		{false, false},
-		{false, false},
-		{false, false},
-		{false, false},
-	};
-
-	// timer - pump
-	double bayCurrentRuntime[4][2] = {
-		{0,0},
-		{0,0},
-		{0,0},
-		{0,0},
-	};
-
-	// timer - pump
-	double bayTotalRuntime[4][2] = {
-		{0,0},
-		{0,0},
-		{0,0},
-		{0,0},
-	};
-
-	double bayMaintenanceInserts[4] = {0,0,0,0};
+	// one column per bay, wrapping onto another row of columns when they get too narrow
+	#define MIN_COLUMN_WIDTH 22
+	#define PANEL_HEIGHT 22
+	int columns;
+	int vertical_quad_width;
+	resized = 1;
+
+	// what the front snapshot works out to this frame
+	double bayCurrentRuntime[CONFIG_MAX_BAYS][2] = {{0}};
 
 	// gross, net, maintenance
-	double bayMoneyTotals[4][3] = {
-		{0,0,0},
-		{0,0,0},
-		{0,0,0},
-		{0,0,0},
-	};
+	double bayMoneyTotals[CONFIG_MAX_BAYS][3] = {{0}};
 
 
 
@@ -128,7 +613,7 @@ int main ()
 	double T;
     char* temp_string[20] = {0};
 
-	char* bayTitle[16] = {0};
+	char bayTitle[32] = {0};
 	char* pumpTitle[16] = {0};
 	char* current_timer_time_string[16] = {0};
 	char* current_pump_time_string[16] = {0};
@@ -142,13 +627,32 @@ int main ()
 
 	int c = 0;
 	int x = 0;
+	long lastFrameBytes = 0;
+	long totalFrameBytes = 0;
 	while(stopProgram == false) {
-		erase();
+		struct timespec wallNow;
+		clock_gettime(CLOCK_REALTIME, &wallNow);
+		double now = (double)wallNow.tv_sec + (double)wallNow.tv_nsec / 1000000000.0;
+
+		// LAYOUT
+		if(resized) {
+			resized = 0;
+			struct winsize ws;
+			if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 && ws.ws_col > 0) {
+				resizeterm(ws.ws_row, ws.ws_col);
+			}
+			getmaxyx(stdscr, ymax, xmax);
+			columns = (xmax + 4) / MIN_COLUMN_WIDTH;
+			if(columns < 1) columns = 1;
+			if(columns > bayCount) columns = bayCount;
+			vertical_quad_width = ((xmax+4) / columns);
+			fullRedraw = true;
+		}
 
 		// print time
     	current_time = time(NULL);
     	c_time_string = ctime(&current_time);
-		mvprintw(0, xmax/2 - 2 - strlen((const char *)c_time_string) / 2, "%s", c_time_string);
+		put(0, xmax/2 - 2 - strlen((const char *)c_time_string) / 2, 0, "%s", c_time_string);
 
 
 		// print operating temperature
@@ -161,60 +665,37 @@ int main ()
 		fscanf (temperatureFile, "%lf", &T);
 		T /= 1000;
 		sprintf((unsigned char *)temp_string, " TEMP: %6.3f C. ", T);
-		attron(COLOR_PAIR(3));
-		mvprintw(0, 1, "%s", temp_string);
-		attroff(COLOR_PAIR(3));
+		put(0, 1, 3, "%s", temp_string);
 		fclose (temperatureFile);
 
 
-		// collect bay statuses
-		char *stm = "SELECT bay, timer_running, pump_running, timer_runtime, pump_runtime FROM bay_status ORDER BY bay ASC;";
-		PGresult *res = PQexec(conn, stm);
-		if(pg_bad_data(res)) do_exit(conn, res);
-		for(x = 0; x < 4; x++) {
-			int currentBay = atof(PQgetvalue(res, x, 0)) - 1;
-			bayRunning[currentBay][0] = strcmp(PQgetvalue(res, x, 1), "f") != 0;
-			bayRunning[currentBay][1] = strcmp(PQgetvalue(res, x, 2), "f") != 0;
-			bayCurrentRuntime[currentBay][0] = atof(PQgetvalue(res, x, 3));
-			bayCurrentRuntime[currentBay][1] = atof(PQgetvalue(res, x, 4));
-		}
-		PQclear(res);
+		// collect bay statuses: straight out of shared memory when the monitor is running here,
+		// otherwise from bay_status (monitor -t) and its notifications
+		read_live(bayCount, now);
+		const struct gui_snapshot *snap = &snapshots[front];
 
-		// collect bay totals
-		char *stm2 = "SELECT bay, SUM(timer_time) as total_timer_time, SUM(pump_time) as total_pump_time FROM bay_sessions GROUP BY bay ORDER BY bay ASC;";
-		res = PQexec(conn, stm2);
-		if(pg_bad_data(res)) do_exit(conn, res);
-		for(x = 0; x < PQntuples(res); x++) {
-			int currentBay = atof(PQgetvalue(res, x, 0)) - 1;
-			bayTotalRuntime[currentBay][0] = atof(PQgetvalue(res, x, 1));
-			bayTotalRuntime[currentBay][1] = atof(PQgetvalue(res, x, 2));
+		// RUN THE CLOCKS
+		for(x = 0; x < bayCount; x++) {
+			bayCurrentRuntime[x][0] = dashboard_runtime(&snap->bays, x, 0, now);
+			bayCurrentRuntime[x][1] = dashboard_runtime(&snap->bays, x, 1, now);
 		}
-		PQclear(res);
-
-		// collect bay maintenance inserts
-		char *stm3 = "SELECT bay, count(*) as total FROM bay_maintenance_inserts GROUP BY bay ORDER BY bay ASC;";
-		res = PQexec(conn, stm3);
-		if(pg_bad_data(res)) do_exit(conn, res);
-		for(x = 0; x < PQntuples(res); x++) {
-			int currentBay = atof(PQgetvalue(res, x, 0)) - 1;
-			bayMaintenanceInserts[currentBay] = atof(PQgetvalue(res, x, 1));
-		}
-		PQclear(res);
 
 		// TOTAL UP MONEY
 		double totalRevenue = 0;
-		for(x = 0; x < 4; x++) {
-			bayMoneyTotals[x][0] = (bayTotalRuntime[x][0] / 60) / 4;
-			bayMoneyTotals[x][1] = ((bayTotalRuntime[x][0] / 60) / 4) - (bayMaintenanceInserts[x] * 0.25);
-			bayMoneyTotals[x][2] = bayMaintenanceInserts[x] * 0.25;
+		for(x = 0; x < bayCount; x++) {
+			dashboard_money(&snap->bays, &config, x, &bayMoneyTotals[x][0], &bayMoneyTotals[x][2]);
+			bayMoneyTotals[x][1] = bayMoneyTotals[x][0] - bayMoneyTotals[x][2];
 
 			totalRevenue += bayMoneyTotals[x][1];
 		}
 
 		// print money total at bottom
-		mvprintw(ymax - 1, (xmax / 2) - 15, "TOTAL REVENUE: $%.2f", totalRevenue);
+		put(ymax - 1, (xmax / 2) - 15, 0, "TOTAL REVENUE: $%.2f", totalRevenue);
+		// what the last frame cost on the wire
+		put(ymax - 1, 1, 0, "%ld bytes/frame, %ld total", lastFrameBytes, totalFrameBytes);
+		put(1, 1, 0, "%s", detailOpen ? "<- -> bay   r range   esc back   q quit" : "<- -> bay   enter details   q quit");
 
-		for(x = 0; x < 4; x++) {
+		for(x = 0; x < bayCount && !detailOpen; x++) {
 			if(bayCurrentRuntime[x][0] >= 3599.99) {
 				sprintf((unsigned char *)current_timer_time_string, "%d hrs %d mins %d secs", (int)bayCurrentRuntime[x][0]/3600, ((int)bayCurrentRuntime[x][0] % 3600) / 60, (int)bayCurrentRuntime[x][0] % 60);
 			} else if (bayCurrentRuntime[x][0] > 59.99 && bayCurrentRuntime[x][0] < 3599.99) {
@@ -229,93 +710,102 @@ int main ()
 			} else {
 				sprintf((unsigned char *)current_pump_time_string, "%.2f seconds", bayCurrentRuntime[x][1]);
 			}
-			if(bayTotalRuntime[x][0] >= 3599.99) {
-				sprintf((unsigned char *)total_timer_time_string, "%d hrs %d mins", (int)bayTotalRuntime[x][0]/3600, ((int)bayTotalRuntime[x][0] % 3600) / 60);
-			} else if (bayTotalRuntime[x][0] > 59.99 && bayTotalRuntime[x][0] < 3599.99) {
-				sprintf((unsigned char *)total_timer_time_string, "%d minutes", (int)bayTotalRuntime[x][0] / 60);
+			if(snap->bays.total_runtime[x][0] >= 3599.99) {
+				sprintf((unsigned char *)total_timer_time_string, "%d hrs %d mins", (int)snap->bays.total_runtime[x][0]/3600, ((int)snap->bays.total_runtime[x][0] % 3600) / 60);
+			} else if (snap->bays.total_runtime[x][0] > 59.99 && snap->bays.total_runtime[x][0] < 3599.99) {
+				sprintf((unsigned char *)total_timer_time_string, "%d minutes", (int)snap->bays.total_runtime[x][0] / 60);
 			} else {
-				sprintf((unsigned char *)total_timer_time_string, "%.2f seconds", bayTotalRuntime[x][0]);
+				sprintf((unsigned char *)total_timer_time_string, "%.2f seconds", snap->bays.total_runtime[x][0]);
 			}
-			if(bayTotalRuntime[x][1] >= 3599.99) {
-				sprintf((unsigned char *)total_pump_time_string, "%d hrs %d mins %d secs", (int)bayTotalRuntime[x][1]/3600, ((int)bayTotalRuntime[x][1] % 3600) / 60, (int)bayTotalRuntime[x][1] % 60);	
-			} else if (bayTotalRuntime[x][1] > 59.99 && bayTotalRuntime[x][1] < 3599.99) {
-				sprintf((unsigned char *)total_pump_time_string, "%d mins %d secs", (int)bayTotalRuntime[x][1] / 60, (int)bayTotalRuntime[x][1] % 60);	
+			if(snap->bays.total_runtime[x][1] >= 3599.99) {
+				sprintf((unsigned char *)total_pump_time_string, "%d hrs %d mins %d secs", (int)snap->bays.total_runtime[x][1]/3600, ((int)snap->bays.total_runtime[x][1] % 3600) / 60, (int)snap->bays.total_runtime[x][1] % 60);	
+			} else if (snap->bays.total_runtime[x][1] > 59.99 && snap->bays.total_runtime[x][1] < 3599.99) {
+				sprintf((unsigned char *)total_pump_time_string, "%d mins %d secs", (int)snap->bays.total_runtime[x][1] / 60, (int)snap->bays.total_runtime[x][1] % 60);	
 			} else {
-				sprintf((unsigned char *)total_pump_time_string, "%.2f seconds", bayTotalRuntime[x][1]);
+				sprintf((unsigned char *)total_pump_time_string, "%.2f seconds", snap->bays.total_runtime[x][1]);
 			}
 
 			sprintf((unsigned char *)total_gross_money_string, "$%.2f", bayMoneyTotals[x][0]);
 			sprintf((unsigned char *)total_net_money_string, "$%.2f", bayMoneyTotals[x][1]);
 			sprintf((unsigned char *)total_maintenance_money_string, "-$%.2f", bayMoneyTotals[x][2]);
-			sprintf((unsigned char *)bayTitle,  "       BAY %d        ", (x + 1));
+			// the selected bay's title is bracketed
+			bool selected = (x == selectedBay);
+			snprintf(bayTitle, sizeof(bayTitle), "     %sBAY %d%s      ", selected ? "> " : "  ", (x + 1), selected ? " <" : "  ");
 			sprintf((unsigned char *)pumpTitle, "       PUMP %d       ", (x + 1));
 
-			int quad_x_center = ((x * vertical_quad_width) + vertical_quad_width/2) + ((x > 2) ? -1 : 0);
-			int quad_x_left = x * vertical_quad_width + ((x > 2) ? 0 : 1);
+			int column = x % columns;
+			int quad_x_center = ((column * vertical_quad_width) + vertical_quad_width/2) + ((column > 2) ? -1 : 0);
+			int quad_x_left = column * vertical_quad_width + ((column > 2) ? 0 : 1);
+			int vertical_quad_top = 4 + (x / columns) * PANEL_HEIGHT;
 
 			// TIMER, CURRENT TIMER, TOTAL TIMER, TOTAL MONEY, TOTAL INSERTS, NET MONEY
-			attron(COLOR_PAIR((bayRunning[x][0]) ? 1 : 2));
-			if(bayRunning[x][0]) {
-				mvprintw(vertical_quad_top, quad_x_center - 9, "              ");	
-				mvprintw(vertical_quad_top+2, quad_x_center - 9, "              ");	
-			}
-			mvprintw(vertical_quad_top + 1, quad_x_center - strlen((const char *)bayTitle)/2 - 2, (const char *)bayTitle);
-			attroff(COLOR_PAIR((bayRunning[x][0]) ? 1 : 2));
-
-
-			if(bayRunning[x][0]) {
-				attron(COLOR_PAIR(5));
-				mvprintw(vertical_quad_top+3, quad_x_center - strlen((const char *)current_timer_time_string)/2 - 2, (const char *)current_timer_time_string);
-				attroff(COLOR_PAIR(5));
-			}
+			// fields that come and go are still put (empty) so every bay keeps its place in the frame
+			int timerColor = (snap->bays.running[x][0]) ? 1 : 2;
+			const char *band = (snap->bays.running[x][0]) ? "              " : "";
+			put(vertical_quad_top, quad_x_center - 9, timerColor, "%s", band);
+			put(vertical_quad_top+2, quad_x_center - 9, timerColor, "%s", band);
+			put(vertical_quad_top + 1, quad_x_center - strlen(bayTitle)/2 - 2, timerColor, "%s", bayTitle);
 
+			put(vertical_quad_top+3, quad_x_center - strlen((const char *)current_timer_time_string)/2 - 2, 5, "%s",
+				(snap->bays.running[x][0]) ? (const char *)current_timer_time_string : "");
 
-			mvprintw(vertical_quad_top+5, quad_x_left, "TOTAL TIMER RUNTIME:");
-			attron(COLOR_PAIR(4));
-			mvprintw(vertical_quad_top+6, quad_x_left + 1, (const char *)total_timer_time_string);
-			attroff(COLOR_PAIR(4));
+			put(vertical_quad_top+5, quad_x_left, 0, "TOTAL TIMER RUNTIME:");
+			put(vertical_quad_top+6, quad_x_left + 1, 4, "%s", (const char *)total_timer_time_string);
 
-			mvprintw(vertical_quad_top+7, quad_x_left, "GROSS REVENUE:");
-			attron(COLOR_PAIR(4));
-			mvprintw(vertical_quad_top+8, quad_x_left + 1, (const char *)total_gross_money_string);
-			attroff(COLOR_PAIR(4));
+			put(vertical_quad_top+7, quad_x_left, 0, "GROSS REVENUE:");
+			put(vertical_quad_top+8, quad_x_left + 1, 4, "%s", (const char *)total_gross_money_string);
 
-			mvprintw(vertical_quad_top+9, quad_x_left, "MANUAL COINS:");
-			attron(COLOR_PAIR(4));
-			mvprintw(vertical_quad_top+10, quad_x_left, (const char *)total_maintenance_money_string);
-			attroff(COLOR_PAIR(4));
-
-			mvprintw(vertical_quad_top+11, quad_x_left, "NET REVENUE:");
-			attron(COLOR_PAIR(4));
-			mvprintw(vertical_quad_top+12, quad_x_left + 1, (const char *)total_net_money_string);
-			attroff(COLOR_PAIR(4));
+			put(vertical_quad_top+9, quad_x_left, 0, "MANUAL COINS:");
+			put(vertical_quad_top+10, quad_x_left, 4, "%s", (const char *)total_maintenance_money_string);
 
+			put(vertical_quad_top+11, quad_x_left, 0, "NET REVENUE:");
+			put(vertical_quad_top+12, quad_x_left + 1, 4, "%s", (const char *)total_net_money_string);
 
 			// PUMP, CURRENT PUMP TIMER, TOTAL PUMP TIMER, 
-			attron(COLOR_PAIR((bayRunning[x][1]) ? 1 : 2));
-			if(bayRunning[x][0]) {
-				mvprintw(vertical_quad_top + 14, quad_x_center - 9, "              ");
-				mvprintw(vertical_quad_top + 16, quad_x_center - 9, "              ");
-			}
-			mvprintw(vertical_quad_top + 15, quad_x_center - strlen((const char *)pumpTitle)/2 - 2, (const char *)pumpTitle);
-			attroff(COLOR_PAIR((bayRunning[x][1]) ? 1 : 2));
-
+			int pumpColor = (snap->bays.running[x][1]) ? 1 : 2;
+			put(vertical_quad_top + 14, quad_x_center - 9, pumpColor, "%s", band);
+			put(vertical_quad_top + 16, quad_x_center - 9, pumpColor, "%s", band);
+			put(vertical_quad_top + 15, quad_x_center - strlen((const char *)pumpTitle)/2 - 2, pumpColor, "%s", (const char *)pumpTitle);
 
-			if(bayRunning[x][0]) {
-				attron(COLOR_PAIR(5));
-				mvprintw(vertical_quad_top+17, quad_x_center - strlen((const char *)current_pump_time_string)/2 - 2, (const char *)current_pump_time_string);
-				attroff(COLOR_PAIR(5));
-			}
+			put(vertical_quad_top+17, quad_x_center - strlen((const char *)current_pump_time_string)/2 - 2, 5, "%s",
+				(snap->bays.running[x][0]) ? (const char *)current_pump_time_string : "");
 
-			mvprintw(vertical_quad_top+19, quad_x_left, "TOTAL PUMP RUNTIME:");
-			attron(COLOR_PAIR(4));
-			mvprintw(vertical_quad_top+20, quad_x_left, (const char *)total_pump_time_string);
-			attroff(COLOR_PAIR(4));
+			put(vertical_quad_top+19, quad_x_left, 0, "TOTAL PUMP RUNTIME:");
+			put(vertical_quad_top+20, quad_x_left, 4, "%s", (const char *)total_pump_time_string);
 
 		}
-		refresh();
+		if(detailOpen) draw_detail(snap, &config, ymax, xmax, now);
+		long bytesBefore = bytes_written();
+		render();
+		lastFrameBytes = bytes_written() - bytesBefore;
+		totalFrameBytes += lastFrameBytes;
 		c++;
-		nanosleep((const struct timespec[]){{0, 100000000L}}, NULL);
+
+		// FETCH whatever is due, without waiting on it
+		if(!fetch_next()) {
+			fprintf(stderr, "PG_ERROR: %s\n", PQerrorMessage(conn));
+			break;
+		}
+
+		// WAIT for a key, the database, or the next whole second to move the clocks on
+		clock_gettime(CLOCK_REALTIME, &wallNow);
+		struct pollfd pfds[2] = {
+			{STDIN_FILENO, POLLIN, 0},
+			{PQsocket(conn), POLLIN | (flushing ? POLLOUT : 0), 0},
+		};
+		if(poll(pfds, 2, 1000 - wallNow.tv_nsec / 1000000) < 0 && errno != EINTR) {
+			perror("poll");
+			break;
+		}
+		if((pfds[0].revents & POLLIN) && !read_keys(bayCount)) break;
+		if((pfds[1].revents & POLLOUT) && !fetch_flush()) {
+			fprintf(stderr, "PG_ERROR: %s\n", PQerrorMessage(conn));
+			break;
+		}
+		if((pfds[1].revents & ~POLLOUT) && !fetch_input(bayCount, now)) {
+			fprintf(stderr, "PG_ERROR: %s\n", PQerrorMessage(conn));
+			break;
+		}
 	}
 
 	PQfinish(conn);
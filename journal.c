@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+#include "journal.h"
+
+#define JOURNAL_MAGIC "CWJRNL\0\1"
+#define JOURNAL_VERSION 2
+// the header gets a page to itself so record writes never share its page
+#define JOURNAL_HEADER_SIZE 4096
+
+struct journal_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint64_t capacity;
+	int64_t journal_id;
+	uint64_t next_seq;      // first record is seq 1
+	uint64_t applied_seq;
+};
+
+static int fd = -1;
+static size_t mapSize = 0;
+static struct journal_header *header = NULL;
+static struct journal_record *records = NULL;
+static bool dirty = false;
+static uint64_t dropped = 0;
+// the writer thread owns the journal, this only keeps journal_read from seeing an append half done
+static pthread_mutex_t appendLock = PTHREAD_MUTEX_INITIALIZER;
+
+// FNV-1a over the record with the check field zeroed
+static uint32_t record_check(const struct journal_record *record) {
+	struct journal_record copy = *record;
+	copy.check = 0;
+	const unsigned char *p = (const unsigned char *)&copy;
+	uint32_t hash = 2166136261u;
+	size_t i;
+	for(i = 0; i < sizeof(copy); i++) {
+		hash = (hash ^ p[i]) * 16777619u;
+	}
+	return hash;
+}
+
+int journal_open(const char *path, uint64_t capacity) {
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if(fd < 0) {
+		fprintf(stderr, "JOURNAL: could not open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	struct stat st;
+	fstat(fd, &st);
+	bool fresh = (st.st_size == 0);
+	if(!fresh) {
+		// an existing journal keeps the capacity it was created with
+		struct journal_header existing;
+		bool readable = pread(fd, &existing, sizeof(existing), 0) == sizeof(existing) && memcmp(existing.magic, JOURNAL_MAGIC, 8) == 0;
+		if(!readable
+			|| existing.version != JOURNAL_VERSION
+			|| existing.record_size != sizeof(struct journal_record)) {
+			fprintf(stderr, "JOURNAL: %s is not a journal this version can read\n", path);
+			close(fd);
+			return -1;
+		}
+		capacity = existing.capacity;
+	}
+
+	mapSize = JOURNAL_HEADER_SIZE + capacity * sizeof(struct journal_record);
+	if(fresh && ftruncate(fd, mapSize) < 0) {
+		fprintf(stderr, "JOURNAL: could not size %s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	// populate up front so appends never page fault
+	void *map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+	if(map == MAP_FAILED) {
+		fprintf(stderr, "JOURNAL: could not map %s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	header = map;
+	records = (struct journal_record *)((char *)map + JOURNAL_HEADER_SIZE);
+
+	if(fresh) {
+		memcpy(header->magic, JOURNAL_MAGIC, 8);
+		header->version = JOURNAL_VERSION;
+		header->record_size = sizeof(struct journal_record);
+		header->capacity = capacity;
+		if(getrandom(&header->journal_id, sizeof(header->journal_id), 0) != sizeof(header->journal_id)) {
+			header->journal_id = (int64_t)time(NULL) ^ ((int64_t)getpid() << 32);
+		}
+		// keep it positive, it is a postgres BIGINT
+		header->journal_id &= INT64_MAX;
+		header->next_seq = 1;
+		header->applied_seq = 0;
+		dirty = true;
+		journal_sync();
+		return 0;
+	}
+
+	// a crash can leave the header ahead of records that never hit the disk
+	uint64_t seq;
+	for(seq = header->applied_seq + 1; seq < header->next_seq; seq++) {
+		const struct journal_record *record = &records[seq % header->capacity];
+		if(record->seq != seq || record->check != record_check(record)) {
+			fprintf(stderr, "JOURNAL: dropping %" PRIu64 " torn record(s) from seq %" PRIu64 "\n", header->next_seq - seq, seq);
+			header->next_seq = seq;
+			dirty = true;
+			break;
+		}
+	}
+
+	uint64_t pending = header->next_seq - 1 - header->applied_seq;
+	if(pending > 0) printf("JOURNAL: %" PRIu64 " record(s) waiting for the database\n", pending);
+	return 0;
+}
+
+void journal_close(void) {
+	if(header == NULL) return;
+	journal_sync();
+	munmap(header, mapSize);
+	close(fd);
+	header = NULL;
+	records = NULL;
+	fd = -1;
+}
+
+uint64_t journal_append(struct journal_record *record) {
+	if(header->next_seq - 1 - header->applied_seq >= header->capacity) {
+		dropped++;
+		return 0;
+	}
+	record->seq = header->next_seq;
+	record->reserved = 0;
+	record->check = record_check(record);
+	pthread_mutex_lock(&appendLock);
+	records[record->seq % header->capacity] = *record;
+	header->next_seq++;
+	pthread_mutex_unlock(&appendLock);
+	dirty = true;
+	return record->seq;
+}
+
+void journal_sync(void) {
+	if(!dirty) return;
+	msync(header, mapSize, MS_SYNC);
+	dirty = false;
+}
+
+const struct journal_record *journal_get(uint64_t seq) {
+	if(seq <= header->applied_seq || seq >= header->next_seq) return NULL;
+	return &records[seq % header->capacity];
+}
+
+int journal_read(uint64_t seq, struct journal_record *out) {
+	pthread_mutex_lock(&appendLock);
+	int found = -1;
+	if(seq < header->next_seq) {
+		*out = records[seq % header->capacity];
+		found = (out->seq == seq && out->check == record_check(out)) ? 1 : 0;
+	}
+	pthread_mutex_unlock(&appendLock);
+	return found;
+}
+
+void journal_set_applied(uint64_t seq) {
+	if(seq <= header->applied_seq) return;
+	if(seq >= header->next_seq) seq = header->next_seq - 1;
+	header->applied_seq = seq;
+	dirty = true;
+}
+
+int64_t journal_id(void) {
+	return header->journal_id;
+}
+
+uint64_t journal_next_seq(void) {
+	return header->next_seq;
+}
+
+uint64_t journal_applied_seq(void) {
+	return header->applied_seq;
+}
+
+uint64_t journal_dropped(void) {
+	return dropped;
+}
@@ -0,0 +1,59 @@
+#ifndef CARWASH_JOURNAL_H
+#define CARWASH_JOURNAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+	SESSION JOURNAL
+	an append-only, memory mapped file of every session and maintenance
+	insert, written before postgres ever sees them. records are numbered;
+	everything after applied_seq is not yet in the database and is replayed
+	on the next connection. the database keeps its own copy of applied_seq
+	(monitor_journal), updated in the same transaction as the inserts, so a
+	replay never writes a row twice.
+
+	the file is a fixed size ring: record seq lives in slot seq % capacity.
+	when the database has been gone long enough to fill it, new records are
+	dropped and counted rather than overwriting ones that were never applied.
+*/
+
+struct journal_record {
+	uint64_t seq;
+	uint8_t kind;           // enum db_event_kind
+	uint8_t bay;
+	uint16_t reserved;
+	uint32_t check;         // checksum of the rest of the record, catches torn writes
+	int64_t wall_ns;        // CLOCK_REALTIME of the event
+	int64_t start_ns;       // DB_BAY_SESSION: CLOCK_REALTIME the session started, 0 when unknown
+	double timer_time;
+	double pump_time;
+};
+
+#define JOURNAL_DEFAULT_CAPACITY 65536
+
+// open (or create) the journal, trimming any records a crash left half written
+int journal_open(const char *path, uint64_t capacity);
+void journal_close(void);
+
+// copies the record in and stamps its seq, returns 0 (and counts a drop) when full
+uint64_t journal_append(struct journal_record *record);
+// flush appended records and the header to disk, cheap when nothing changed
+void journal_sync(void);
+
+const struct journal_record *journal_get(uint64_t seq);
+/*
+	for readers on other threads (the forwarder, forward.h), applied or not:
+	copies record seq out. 1 when copied, 0 when it is no longer in the
+	file (the ring wrapped past it), -1 when it has not been written yet
+*/
+int journal_read(uint64_t seq, struct journal_record *out);
+// every record up to and including seq is in the database
+void journal_set_applied(uint64_t seq);
+
+int64_t journal_id(void);
+uint64_t journal_next_seq(void);
+uint64_t journal_applied_seq(void);
+uint64_t journal_dropped(void);
+
+#endif
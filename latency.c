@@ -0,0 +1,78 @@
+#include <string.h>
+#include <inttypes.h>
+#include "latency.h"
+
+/*
+	LAYOUT: counts[index]
+	DEFINITION: {
+		0 .. 2 * SUB_COUNT - 1: exact values 0 .. 255,
+		after that: SUB_COUNT buckets per power of two, each 2^shift wide
+	}
+*/
+static int bucket_index(uint64_t v) {
+	if(v < 2 * LATENCY_SUB_COUNT) return (int)v;
+	int shift = 63 - __builtin_clzll(v) - LATENCY_SUB_BITS;
+	if(shift + LATENCY_SUB_BITS >= LATENCY_MAX_BITS) return LATENCY_BUCKETS - 1;
+	return 2 * LATENCY_SUB_COUNT + (shift - 1) * LATENCY_SUB_COUNT + (int)((v >> shift) - LATENCY_SUB_COUNT);
+}
+
+// the largest value that falls in a bucket
+static int64_t bucket_value(int index) {
+	if(index < 2 * LATENCY_SUB_COUNT) return index;
+	int shift = (index - 2 * LATENCY_SUB_COUNT) / LATENCY_SUB_COUNT + 1;
+	int64_t sub = (index - 2 * LATENCY_SUB_COUNT) % LATENCY_SUB_COUNT + LATENCY_SUB_COUNT;
+	return ((sub + 1) << shift) - 1;
+}
+
+void latency_reset(struct latency_histogram *h) {
+	memset(h, 0, sizeof(*h));
+}
+
+void latency_record(struct latency_histogram *h, int64_t ns) {
+	if(ns < 0) ns = 0;
+	h->counts[bucket_index((uint64_t)ns)]++;
+	if(h->total == 0 || ns < h->min) h->min = ns;
+	if(ns > h->max) h->max = ns;
+	h->total++;
+	h->sum += ns;
+}
+
+int64_t latency_percentile(const struct latency_histogram *h, double percentile) {
+	if(h->total == 0) return 0;
+	uint64_t wanted = (uint64_t)(percentile / 100.0 * h->total + 0.5);
+	if(wanted < 1) wanted = 1;
+	uint64_t seen = 0;
+	int i;
+	for(i = 0; i < LATENCY_BUCKETS; i++) {
+		seen += h->counts[i];
+		if(seen >= wanted) break;
+	}
+	// the bucket bound can overshoot what was actually recorded
+	int64_t value = bucket_value(i < LATENCY_BUCKETS ? i : LATENCY_BUCKETS - 1);
+	if(value > h->max) value = h->max;
+	if(value < h->min) value = h->min;
+	return value;
+}
+
+void latency_print(const struct latency_histogram *h, FILE *out, const char *label) {
+	if(h->total == 0) {
+		fprintf(out, "%s: no samples\n", label);
+		return;
+	}
+	fprintf(out, "%s: %" PRIu64 " samples, us: min %.1f  mean %.1f  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+		label, h->total, h->min / 1e3, h->sum / h->total / 1e3,
+		latency_percentile(h, 50) / 1e3, latency_percentile(h, 90) / 1e3, latency_percentile(h, 99) / 1e3,
+		latency_percentile(h, 99.9) / 1e3, h->max / 1e3);
+}
+
+void latency_print_json(const struct latency_histogram *h, FILE *out) {
+	if(h->total == 0) {
+		fprintf(out, "{\"count\": 0}");
+		return;
+	}
+	fprintf(out, "{\"count\": %" PRIu64 ", \"min_us\": %.1f, \"mean_us\": %.1f, \"p50_us\": %.1f, \"p90_us\": %.1f, "
+		"\"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f}",
+		h->total, h->min / 1e3, h->sum / h->total / 1e3,
+		latency_percentile(h, 50) / 1e3, latency_percentile(h, 90) / 1e3, latency_percentile(h, 99) / 1e3,
+		latency_percentile(h, 99.9) / 1e3, h->max / 1e3);
+}
@@ -0,0 +1,40 @@
+#ifndef CARWASH_LATENCY_H
+#define CARWASH_LATENCY_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+	LATENCY HISTOGRAM
+	HDR style: values in nanoseconds land in log-linear buckets, 128 per
+	power of two, so every recorded value is kept to within 1% from a few
+	ns up to minutes in a fixed 35 KB. recording is a couple of
+	shifts and an increment, cheap enough for every loop cycle, and the
+	exact min, max and mean are kept alongside.
+*/
+
+#define LATENCY_SUB_BITS 7
+#define LATENCY_SUB_COUNT (1 << LATENCY_SUB_BITS)
+// up to 2^40 ns, about 18 minutes, larger values are clamped into the top bucket
+#define LATENCY_MAX_BITS 40
+#define LATENCY_BUCKETS (2 * LATENCY_SUB_COUNT + (LATENCY_MAX_BITS - LATENCY_SUB_BITS - 1) * LATENCY_SUB_COUNT)
+
+struct latency_histogram {
+	uint64_t counts[LATENCY_BUCKETS];
+	uint64_t total;
+	int64_t min;
+	int64_t max;
+	double sum;
+};
+
+void latency_reset(struct latency_histogram *h);
+// negative values count as 0
+void latency_record(struct latency_histogram *h, int64_t ns);
+// smallest value (to bucket precision) that percentile% of the recorded values are at or below
+int64_t latency_percentile(const struct latency_histogram *h, double percentile);
+// one line: count, min/mean/p50/p90/p99/p99.9/max in microseconds
+void latency_print(const struct latency_histogram *h, FILE *out, const char *label);
+// the same as a JSON object: {"count": .., "min_us": .., "mean_us": .., "p50_us": .., ..}
+void latency_print_json(const struct latency_histogram *h, FILE *out);
+
+#endif
@@ -0,0 +1,407 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <libpq-fe.h>
+#include "bay.h"
+#include "gpio.h"
+#include "dbwriter.h"
+#include "latency.h"
+#include "schema.h"
+
+/*
+	END TO END LOAD GENERATOR
+	runs many simulated bays in real time through the monitor's own path:
+	the bay state machine (bay.c) debounces them, sessions and coins go
+	through the queue, writer thread, journal and pipelined batches
+	(dbwriter.c) into a local postgres set up with the monitor's schema
+	(schema.c), triggers and all.
+
+	each bay idles, runs a timer session with the pump on for part of it,
+	and gets maintenance coins at random (a poisson rate). at the end the
+	report goes to stdout as one JSON object, for keeping next to the ones
+	from earlier versions, with a readable summary on stderr:
+		edge to commit latency: from the sample that first saw the relay
+			switch (timer off, coin released) to the commit of its row,
+			the debounce window included
+		statements/sec and round trips of the writer
+		cpu: the whole process and the sampling thread, per bay
+
+	it writes rows and empties bay_sessions and bay_maintenance_inserts
+	before it starts, so it refuses the carwash database itself: give it a
+	scratch one (createdb carwash_load).
+
+	usage: cw-loadgen [-d conninfo] [-n bays] [-D seconds] [-S session secs] [-I idle secs]
+	                  [-p pump duty] [-i inserts per bay per hour] [-r hz] [-c copy threshold] [-t]
+*/
+
+#define LOADGEN_REPORT_VERSION 1
+// what the monitor is configured with out of the box
+#define RELAY_DEBOUNCE_MS 200
+#define COIN_DEBOUNCE_MS 50
+#define COIN_PULSE_NS 100000000L
+// -t: running bays refresh their runtime as often as the monitor's default, the writer holds it to whole seconds
+#define RUNTIME_REFRESH_MS 100
+#define RUNTIME_WRITE_MS 1000
+
+static volatile sig_atomic_t stopProgram = 0;
+
+static void sig_handler(int signo) {
+	stopProgram = 1;
+}
+
+static int bayCount = 16;
+static bool statusTable = false;
+
+// the writer runs this on every connection, the same as the monitor
+static int loadgen_setup(PGconn *conn) {
+	return db_setup_schema(conn, bayCount, statusTable);
+}
+
+static int64_t timespec_ns(const struct timespec *ts) {
+	return (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static uint64_t rngState = 88172645463325252ULL;
+
+static double random_unit(void) {
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 7;
+	rngState ^= rngState << 17;
+	return (rngState >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+	SIMULATED BAY
+	the relay schedule of the session in progress (or the next one) as
+	absolute CLOCK_MONOTONIC ns, and when the input last switched
+*/
+struct sim_bay {
+	int64_t sessionStart;
+	int64_t sessionEnd;
+	int64_t pumpStart;
+	int64_t pumpEnd;
+	int64_t nextCoin;
+	int64_t coinRelease;
+	unsigned levels;
+
+	struct timespec timerEdge;
+	struct timespec coinEdge;
+	long sessions;
+	long inserts;
+};
+// the state machine of every simulated bay, indexed like bays
+static struct bay_table bayStates;
+
+static double sessionSeconds = 90;
+static double idleSeconds = 20;
+static double pumpDuty = 0.5;
+static double insertsPerHour = 6;
+
+static int64_t seconds_ns(double seconds) {
+	return (int64_t)(seconds * 1e9);
+}
+
+// 0.5 to 1.5 times mean
+static double around(double mean) {
+	return mean * (0.5 + random_unit());
+}
+
+static void schedule_session(struct sim_bay *b, int64_t from) {
+	b->sessionStart = from + seconds_ns(around(idleSeconds));
+	int64_t length = seconds_ns(around(sessionSeconds));
+	b->sessionEnd = b->sessionStart + length;
+	int64_t pumpLength = (int64_t)(length * pumpDuty);
+	b->pumpStart = b->sessionStart + (int64_t)((length - pumpLength) * random_unit());
+	b->pumpEnd = b->pumpStart + pumpLength;
+}
+
+static void schedule_coin(struct sim_bay *b, int64_t from) {
+	if(insertsPerHour <= 0) {
+		b->nextCoin = INT64_MAX;
+		return;
+	}
+	// exponential gaps make the coins a poisson process
+	b->nextCoin = from + seconds_ns(-log(1 - random_unit()) * 3600 / insertsPerHour);
+	b->coinRelease = b->nextCoin + COIN_PULSE_NS;
+}
+
+// the bay's input levels at now, noting the sample each relay switched off at
+static unsigned sim_levels(struct sim_bay *b, int64_t now, const struct timespec *t) {
+	if(now >= b->sessionEnd) schedule_session(b, now);
+	if(now >= b->coinRelease) schedule_coin(b, now);
+
+	unsigned timer = (now >= b->sessionStart && now < b->sessionEnd) ? GPIO_LOW : GPIO_HIGH;
+	unsigned pump = (now >= b->pumpStart && now < b->pumpEnd) ? GPIO_LOW : GPIO_HIGH;
+	unsigned coin = (now >= b->nextCoin && now < b->coinRelease) ? GPIO_LOW : GPIO_HIGH;
+	unsigned levels = timer << BAY_TIMER | pump << BAY_PUMP | GPIO_HIGH << BAY_COIN_RELAY | coin << BAY_MAINTENANCE;
+
+	unsigned released = ~b->levels & levels;
+	if(released & (1u << BAY_TIMER)) b->timerEdge = *t;
+	if(released & (1u << BAY_MAINTENANCE)) b->coinEdge = *t;
+	b->levels = levels;
+	return levels;
+}
+
+// CLOCK_REALTIME less CLOCK_MONOTONIC at the start, puts event times on the wall clock the way the monitor does
+static int64_t wallOffset = 0;
+
+static void wall_time(const struct timespec *t, struct timespec *wall) {
+	int64_t ns = timespec_ns(t) + wallOffset;
+	wall->tv_sec = ns / 1000000000;
+	wall->tv_nsec = ns % 1000000000;
+}
+
+// started: when a session began, NULL for anything else
+static void queue(int kind, int i, const struct timespec *t, const struct timespec *started, double timerTime, double pumpTime) {
+	struct db_event event = {
+		.kind = kind,
+		.bay = i,
+		.timer_running = bayStates.running[i][BAY_TIMER],
+		.pump_running = bayStates.running[i][BAY_PUMP],
+		.time = *t,
+		.timer_time = timerTime,
+		.pump_time = pumpTime,
+	};
+	wall_time(t, &event.wall);
+	if(started != NULL) wall_time(started, &event.started);
+	db_queue_push(&event);
+}
+
+// what the monitor's bay_events does, with the relay edge as the event time
+static void handle_events(int i, struct sim_bay *b, const struct bay_event *events, int count) {
+	int e;
+	for(e = 0; e < count; e++) {
+		const struct bay_event *event = &events[e];
+		switch(event->kind) {
+			case BAY_TIMER_STOPPED:
+				if(event->session_timer > 0) {
+					queue(DB_BAY_SESSION, i, &b->timerEdge, &event->started, event->session_timer, event->session_pump);
+					b->sessions++;
+				}
+				if(statusTable) {
+					queue(DB_BAY_STATUS, i, &event->time, NULL, event->timer_time, event->pump_time);
+					queue(DB_BAY_RUNTIME, i, &event->time, NULL, 0, 0);
+				}
+				break;
+			case BAY_TIMER_STARTED:
+			case BAY_PUMP_STARTED:
+			case BAY_PUMP_STOPPED:
+				if(statusTable) queue(DB_BAY_STATUS, i, &event->time, NULL, event->timer_time, event->pump_time);
+				break;
+			case BAY_INSERT:
+				queue(DB_MAINTENANCE_INSERT, i, &b->coinEdge, NULL, 0, 0);
+				b->inserts++;
+				break;
+		}
+	}
+}
+
+static double cpu_seconds(int who) {
+	struct rusage usage;
+	getrusage(who, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+// the tables this run writes, emptied so counts and totals start from zero
+static int prepare_database(const char *conninfo) {
+	PGconn *conn = PQconnectdb(conninfo);
+	if(PQstatus(conn) == CONNECTION_BAD) {
+		fprintf(stderr, "Connection to database failed: %s", PQerrorMessage(conn));
+		PQfinish(conn);
+		return -1;
+	}
+	if(strcmp(PQdb(conn), "carwash") == 0) {
+		fprintf(stderr, "cw-loadgen empties the tables it writes, point it at a scratch database (-d \"dbname=carwash_load\")\n");
+		PQfinish(conn);
+		return -1;
+	}
+	if(db_setup_schema(conn, bayCount, statusTable) < 0) {
+		PQfinish(conn);
+		return -1;
+	}
+	PGresult *res = PQexec(conn, "TRUNCATE bay_sessions, bay_maintenance_inserts, monitor_journal;");
+	bool failed = (PQresultStatus(res) != PGRES_COMMAND_OK);
+	if(failed) fprintf(stderr, "PG_ERROR: %s\n", PQerrorMessage(conn));
+	PQclear(res);
+	PQfinish(conn);
+	return failed ? -1 : 0;
+}
+
+int main(int argc, char **argv) {
+	const char *conninfo = "user=washman password=cotton dbname=carwash_load";
+	double duration = 120;
+	int sampleRate = 100;
+	int copyThreshold = 64;
+
+	int opt;
+	while((opt = getopt(argc, argv, "d:n:D:S:I:p:i:r:c:th")) != -1) {
+		switch(opt) {
+			case 'd': conninfo = optarg; break;
+			case 'n': bayCount = atoi(optarg); break;
+			case 'D': duration = atof(optarg); break;
+			case 'S': sessionSeconds = atof(optarg); break;
+			case 'I': idleSeconds = atof(optarg); break;
+			case 'p': pumpDuty = atof(optarg); break;
+			case 'i': insertsPerHour = atof(optarg); break;
+			case 'r': sampleRate = atoi(optarg); break;
+			case 'c': copyThreshold = atoi(optarg); break;
+			case 't': statusTable = true; break;
+			default:
+				fprintf(stderr, "usage: %s [-d conninfo] [-n bays] [-D seconds] [-S session secs] [-I idle secs]\n", argv[0]);
+				fprintf(stderr, "       [-p pump duty 0-1] [-i inserts per bay per hour] [-r hz] [-c copy threshold] [-t also keep bay_status]\n");
+				exit(opt == 'h' ? 0 : 1);
+		}
+	}
+	// the writer keeps its per bay rows in 256 slots
+	if(bayCount < 1 || bayCount > 256 || duration <= 0 || sessionSeconds <= 0 || idleSeconds <= 0
+		|| pumpDuty < 0 || pumpDuty > 1 || insertsPerHour < 0 || sampleRate < 1 || sampleRate > 10000) {
+		fprintf(stderr, "bays 1-256, pump duty 0-1, sample rate 1-10000 hz, times and rates positive\n");
+		exit(1);
+	}
+
+	// the report gets stdout to itself, anything the monitor code prints goes to stderr
+	FILE *report = fdopen(dup(STDOUT_FILENO), "w");
+	dup2(STDERR_FILENO, STDOUT_FILENO);
+
+	if(prepare_database(conninfo) < 0) exit(1);
+
+	// a journal of its own, so nothing is replayed from an earlier run
+	char journalPath[] = "/tmp/cw-loadgen-journal-XXXXXX";
+	int journalFd = mkstemp(journalPath);
+	if(journalFd < 0) {
+		perror("journal");
+		exit(1);
+	}
+	close(journalFd);
+
+	long samplePeriod = 1000000000L / sampleRate;
+	struct bay_windows windows = {
+		.relay = RELAY_DEBOUNCE_MS * sampleRate / 1000,
+		.maintenance = COIN_DEBOUNCE_MS * sampleRate / 1000,
+	};
+
+	struct sim_bay *bays = calloc(bayCount, sizeof(*bays));
+	if(bays == NULL || bay_table_init(&bayStates, bayCount) < 0) {
+		fprintf(stderr, "out of memory for %d bays\n", bayCount);
+		exit(1);
+	}
+	struct timespec start, startWall;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	clock_gettime(CLOCK_REALTIME, &startWall);
+	wallOffset = timespec_ns(&startWall) - timespec_ns(&start);
+	int i;
+	for(i = 0; i < bayCount; i++) {
+		bays[i].levels = (1u << BAY_INPUTS) - 1;
+		// bays start at random points so their sessions do not line up
+		schedule_session(&bays[i], timespec_ns(&start) - seconds_ns(sessionSeconds * random_unit()));
+		schedule_coin(&bays[i], timespec_ns(&start));
+	}
+
+	signal(SIGINT, sig_handler);
+	if(db_writer_start(conninfo, journalPath, copyThreshold, RUNTIME_WRITE_MS, loadgen_setup, NULL) < 0) exit(1);
+	fprintf(stderr, "LOADGEN: %d bays for %.0f s at %d hz, sessions %.0f s (pump %.0f%%), idle %.0f s, %.1f inserts/bay/hour\n",
+		bayCount, duration, sampleRate, sessionSeconds, pumpDuty * 100, idleSeconds, insertsPerHour);
+
+	static struct latency_histogram late;
+	latency_reset(&late);
+	double cpuStart = cpu_seconds(RUSAGE_SELF);
+	double samplerStart = cpu_seconds(RUSAGE_THREAD);
+	int64_t end = timespec_ns(&start) + seconds_ns(duration);
+	struct timespec deadline = start;
+	long cycles = 0;
+	long refreshCycles = (sampleRate * RUNTIME_REFRESH_MS / 1000 > 0) ? sampleRate * RUNTIME_REFRESH_MS / 1000 : 1;
+	struct bay_event events[BAY_MAX_EVENTS];
+
+	while(!stopProgram) {
+		struct timespec t;
+		clock_gettime(CLOCK_MONOTONIC, &t);
+		int64_t now = timespec_ns(&t);
+		if(now >= end) break;
+		latency_record(&late, now - timespec_ns(&deadline));
+
+		bool refresh = statusTable && cycles % refreshCycles == 0;
+		for(i = 0; i < bayCount; i++) {
+			unsigned levels = sim_levels(&bays[i], now, &t);
+			handle_events(i, &bays[i], events, bay_step(&bayStates, i, levels, &t, &windows, events));
+			if(refresh && bayStates.running[i][BAY_TIMER]) {
+				double timerTime, pumpTime;
+				bay_runtime(&bayStates, i, &t, &timerTime, &pumpTime);
+				queue(DB_BAY_RUNTIME, i, &t, NULL, timerTime, pumpTime);
+			}
+		}
+		db_queue_flush();
+		cycles++;
+
+		// absolute deadlines, as the monitor's real time mode
+		deadline.tv_nsec += samplePeriod;
+		while(deadline.tv_nsec >= 1000000000) {
+			deadline.tv_nsec -= 1000000000;
+			deadline.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+	}
+
+	struct timespec stop;
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	double elapsed = (timespec_ns(&stop) - timespec_ns(&start)) / 1e9;
+	double samplerCpu = cpu_seconds(RUSAGE_THREAD) - samplerStart;
+	// everything still queued is written before the writer goes
+	db_writer_stop();
+	double processCpu = cpu_seconds(RUSAGE_SELF) - cpuStart;
+	unlink(journalPath);
+
+	struct db_queue_stats stats;
+	db_queue_stats(&stats);
+	static struct latency_histogram sessionLatency, insertLatency;
+	db_commit_latency(&sessionLatency, &insertLatency);
+	long sessions = 0, inserts = 0;
+	for(i = 0; i < bayCount; i++) {
+		sessions += bays[i].sessions;
+		inserts += bays[i].inserts;
+	}
+
+	fprintf(stderr, "LOADGEN: %ld cycles in %.1f s, %ld sessions and %ld inserts queued, %" PRIu64 " dropped\n",
+		cycles, elapsed, sessions, inserts, stats.dropped);
+	latency_print(&sessionLatency, stderr, "  edge to commit, sessions");
+	latency_print(&insertLatency, stderr, "  edge to commit, inserts");
+	fprintf(stderr, "  writer: %.1f statements/sec in %" PRIu64 " round trips, %" PRIu64 " errors\n",
+		stats.written / elapsed, stats.batches, stats.db_errors);
+	fprintf(stderr, "  cpu: %.2f%% of a core, %.3f%% per bay (sampling thread %.2f%%)\n",
+		processCpu / elapsed * 100, processCpu / elapsed * 100 / bayCount, samplerCpu / elapsed * 100);
+
+	fprintf(report, "{\"report_version\": %d, ", LOADGEN_REPORT_VERSION);
+	fprintf(report, "\"config\": {\"bays\": %d, \"duration_s\": %.1f, \"sample_hz\": %d, \"session_s\": %.1f, \"idle_s\": %.1f, "
+		"\"pump_duty\": %.2f, \"inserts_per_bay_hour\": %.2f, \"relay_debounce_ms\": %d, \"coin_debounce_ms\": %d, "
+		"\"copy_threshold\": %d, \"runtime_write_ms\": %d, \"status_table\": %s}, ",
+		bayCount, duration, sampleRate, sessionSeconds, idleSeconds, pumpDuty, insertsPerHour,
+		RELAY_DEBOUNCE_MS, COIN_DEBOUNCE_MS, copyThreshold, RUNTIME_WRITE_MS, statusTable ? "true" : "false");
+	fprintf(report, "\"elapsed_s\": %.3f, \"cycles\": %ld, ", elapsed, cycles);
+	fprintf(report, "\"sessions\": {\"queued\": %ld, \"edge_to_commit\": ", sessions);
+	latency_print_json(&sessionLatency, report);
+	fprintf(report, "}, \"inserts\": {\"queued\": %ld, \"edge_to_commit\": ", inserts);
+	latency_print_json(&insertLatency, report);
+	fprintf(report, "}, \"writer\": {\"statements\": %" PRIu64 ", \"statements_per_s\": %.1f, \"round_trips\": %" PRIu64 ", "
+		"\"coalesced\": %" PRIu64 ", \"copied\": %" PRIu64 ", \"runtime_written\": %" PRIu64 ", \"runtime_suppressed\": %" PRIu64 ", "
+		"\"dropped\": %" PRIu64 ", \"max_depth\": %u, \"errors\": %" PRIu64 "}, ",
+		stats.written, stats.written / elapsed, stats.batches, stats.coalesced, stats.copied, stats.runtime_written, stats.runtime_suppressed,
+		stats.dropped, stats.max_depth, stats.db_errors);
+	fprintf(report, "\"cpu\": {\"process_s\": %.3f, \"sampler_s\": %.3f, \"percent\": %.3f, \"percent_per_bay\": %.4f}, ",
+		processCpu, samplerCpu, processCpu / elapsed * 100, processCpu / elapsed * 100 / bayCount);
+	fprintf(report, "\"sample_late\": ");
+	latency_print_json(&late, report);
+	fprintf(report, "}\n");
+
+	fclose(report);
+	bay_table_free(&bayStates);
+	free(bays);
+	return stats.db_errors == 0 && stats.dropped == 0 ? 0 : 1;
+}
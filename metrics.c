@@ -0,0 +1,199 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "metrics.h"
+#include "service.h"
+
+struct metric_series {
+	char *family;
+	char *help;
+	enum metric_type type;
+	char *labels;
+	void *value;
+};
+
+static struct metric_series *registry = NULL;
+static int registered = 0;
+
+void metrics_histogram_init(struct metric_histogram *h, const double *bounds, int count) {
+	memset(h, 0, sizeof(*h));
+	h->buckets = (count > METRICS_MAX_BUCKETS) ? METRICS_MAX_BUCKETS : count;
+	int i;
+	for(i = 0; i < h->buckets; i++) {
+		h->bounds_ns[i] = (int64_t)(bounds[i] * 1e9 + 0.5);
+	}
+}
+
+int metrics_register(const char *family, const char *help, enum metric_type type, const char *labels, void *value) {
+	struct metric_series *grown = realloc(registry, (registered + 1) * sizeof(*registry));
+	if(grown == NULL) return -1;
+	registry = grown;
+	struct metric_series *s = &registry[registered];
+	s->family = strdup(family);
+	s->help = strdup(help);
+	s->type = type;
+	s->labels = (labels != NULL && labels[0] != '\0') ? strdup(labels) : NULL;
+	s->value = value;
+	if(s->family == NULL || s->help == NULL) return -1;
+	registered++;
+	return 0;
+}
+
+static const char *typeNames[] = {
+	[METRIC_COUNTER] = "counter",
+	[METRIC_GAUGE] = "gauge",
+	[METRIC_HISTOGRAM] = "histogram",
+};
+
+// {labels} or {labels,extra} or {extra} or nothing
+static void write_labels(FILE *out, const char *labels, const char *extra) {
+	if(labels == NULL && extra == NULL) return;
+	fprintf(out, "{%s%s%s}", labels != NULL ? labels : "", labels != NULL && extra != NULL ? "," : "", extra != NULL ? extra : "");
+}
+
+static void write_histogram(FILE *out, const struct metric_series *s) {
+	struct metric_histogram *h = s->value;
+	// the count is what the buckets add up to, so +Inf and _count always agree in one scrape
+	uint64_t cumulative = 0;
+	char le[48];
+	int i;
+	for(i = 0; i <= h->buckets; i++) {
+		cumulative += atomic_load_explicit(&h->counts[i], memory_order_relaxed);
+		if(i < h->buckets) snprintf(le, sizeof(le), "le=\"%g\"", h->bounds_ns[i] / 1e9);
+		else strcpy(le, "le=\"+Inf\"");
+		fprintf(out, "%s_bucket", s->family);
+		write_labels(out, s->labels, le);
+		fprintf(out, " %llu\n", (unsigned long long)cumulative);
+	}
+	fprintf(out, "%s_count", s->family);
+	write_labels(out, s->labels, NULL);
+	fprintf(out, " %llu\n", (unsigned long long)cumulative);
+	fprintf(out, "%s_sum", s->family);
+	write_labels(out, s->labels, NULL);
+	fprintf(out, " %.9f\n", atomic_load_explicit(&h->sum_ns, memory_order_relaxed) / 1e9);
+}
+
+void metrics_write(FILE *out) {
+	int i;
+	for(i = 0; i < registered; i++) {
+		const struct metric_series *s = &registry[i];
+		if(i == 0 || strcmp(s->family, registry[i - 1].family) != 0) {
+			fprintf(out, "# TYPE %s %s\n", s->family, typeNames[s->type]);
+			fprintf(out, "# HELP %s %s\n", s->family, s->help);
+		}
+		switch(s->type) {
+			case METRIC_COUNTER:
+			case METRIC_GAUGE:
+				fprintf(out, "%s%s", s->family, s->type == METRIC_COUNTER ? "_total" : "");
+				write_labels(out, s->labels, NULL);
+				fprintf(out, " %llu\n", (unsigned long long)atomic_load_explicit((_Atomic uint64_t *)s->value, memory_order_relaxed));
+				break;
+			case METRIC_HISTOGRAM:
+				write_histogram(out, s);
+				break;
+		}
+	}
+	fprintf(out, "# EOF\n");
+}
+
+/*
+	SERVER
+	a plain HTTP/1.0 responder: every request, whatever its path, gets the
+	whole registry and the connection is closed. the listening socket is
+	non-blocking and polled with a short timeout so metrics_stop is seen,
+	a client gets CLIENT_TIMEOUT_MS to send its request and as long again
+	to take the answer, so a stuck scraper costs a scrape and nothing else
+*/
+#define POLL_MS 250
+#define CLIENT_TIMEOUT_MS 1000
+#define CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+static int listenFd = -1;
+static char unixPath[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static pthread_t serverThread;
+static atomic_bool serving = false;
+
+// read until the end of the request headers, or give up
+static bool read_request(int fd) {
+	char request[2048];
+	size_t used = 0;
+	while(used < sizeof(request) - 1) {
+		struct pollfd pfd = {fd, POLLIN, 0};
+		if(poll(&pfd, 1, CLIENT_TIMEOUT_MS) <= 0) return false;
+		ssize_t n = recv(fd, request + used, sizeof(request) - 1 - used, 0);
+		if(n <= 0) return false;
+		used += n;
+		request[used] = '\0';
+		if(strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL) return true;
+	}
+	// headers this long are not a scraper, answer anyway
+	return true;
+}
+
+static void answer(int fd) {
+	if(!read_request(fd)) return;
+
+	char *body = NULL;
+	size_t bodyLength = 0;
+	FILE *out = open_memstream(&body, &bodyLength);
+	if(out == NULL) return;
+	metrics_write(out);
+	fclose(out);
+
+	char header[256];
+	int headerLength = snprintf(header, sizeof(header),
+		"HTTP/1.0 200 OK\r\nContent-Type: " CONTENT_TYPE "\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", bodyLength);
+	if(service_send_all(fd, header, headerLength, CLIENT_TIMEOUT_MS, -1) == 0) service_send_all(fd, body, bodyLength, CLIENT_TIMEOUT_MS, -1);
+	free(body);
+}
+
+static void *server_main(void *arg) {
+	while(atomic_load(&serving)) {
+		struct pollfd pfd = {listenFd, POLLIN, 0};
+		if(poll(&pfd, 1, POLL_MS) <= 0) continue;
+		int fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(fd < 0) continue;
+		answer(fd);
+		close(fd);
+	}
+	return NULL;
+}
+
+int metrics_serve(const char *address) {
+	bool unixSocket = strncmp(address, "unix:", 5) == 0;
+	if(unixSocket && strlen(address + 5) >= sizeof(unixPath)) {
+		fprintf(stderr, "METRICS: socket path too long: %s\n", address + 5);
+		return -1;
+	}
+	listenFd = unixSocket ? service_listen_unix("METRICS", address + 5, 8) : service_listen_tcp("METRICS", address, "127.0.0.1", 8);
+	if(listenFd < 0) return -1;
+	if(unixSocket) strcpy(unixPath, address + 5);
+
+	atomic_store(&serving, true);
+	if(service_thread_start("METRICS", &serverThread, server_main, NULL) < 0) {
+		atomic_store(&serving, false);
+		close(listenFd);
+		listenFd = -1;
+		if(unixPath[0] != '\0') unlink(unixPath);
+		unixPath[0] = '\0';
+		return -1;
+	}
+	return 0;
+}
+
+void metrics_stop(void) {
+	if(listenFd < 0) return;
+	atomic_store(&serving, false);
+	pthread_join(serverThread, NULL);
+	close(listenFd);
+	listenFd = -1;
+	if(unixPath[0] != '\0') unlink(unixPath);
+	unixPath[0] = '\0';
+}
@@ -0,0 +1,77 @@
+#ifndef CARWASH_METRICS_H
+#define CARWASH_METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdatomic.h>
+
+/*
+	METRICS
+	an in-process registry of counters, gauges and fixed-bucket histograms,
+	served in OpenMetrics text format by a thread of its own. every value
+	is a relaxed atomic owned by whoever updates it (the sampling loop, the
+	writer thread), so updating one is an add and reading them all never
+	takes a lock or waits on either thread.
+
+	everything is registered at startup, before metrics_serve; the
+	registry does not change while it is being served.
+*/
+
+enum metric_type {
+	METRIC_COUNTER,
+	METRIC_GAUGE,
+	METRIC_HISTOGRAM,
+};
+
+#define METRICS_MAX_BUCKETS 16
+
+/*
+	fixed buckets: bounds_ns are the upper bounds (le) in nanoseconds,
+	counts[i] is observations at or below bound i and above the one before,
+	counts[buckets] everything larger. exposed cumulatively in seconds
+*/
+struct metric_histogram {
+	int buckets;
+	int64_t bounds_ns[METRICS_MAX_BUCKETS];
+	_Atomic uint64_t counts[METRICS_MAX_BUCKETS + 1];
+	_Atomic uint64_t count;
+	_Atomic int64_t sum_ns;
+};
+
+// bounds in seconds, ascending, at most METRICS_MAX_BUCKETS
+void metrics_histogram_init(struct metric_histogram *h, const double *bounds, int count);
+
+static inline void metrics_observe(struct metric_histogram *h, int64_t ns) {
+	int i = 0;
+	while(i < h->buckets && ns > h->bounds_ns[i]) i++;
+	atomic_fetch_add_explicit(&h->counts[i], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&h->sum_ns, ns, memory_order_relaxed);
+}
+
+static inline void metrics_inc(_Atomic uint64_t *counter) {
+	atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+}
+
+/*
+	add one series to the registry. family is the metric name (counters
+	without _total, it is added), labels the inside of {...} or NULL, value
+	an _Atomic uint64_t for counters and gauges or a struct metric_histogram.
+	series of one family are written under one TYPE/HELP, so register them
+	one after another. strings are copied
+*/
+int metrics_register(const char *family, const char *help, enum metric_type type, const char *labels, void *value);
+
+// everything registered, in OpenMetrics text format ending with # EOF
+void metrics_write(FILE *out);
+
+/*
+	serve metrics_write over HTTP at address: "unix:/path" for a unix
+	socket, otherwise "[host:]port" on TCP (host defaults to 127.0.0.1).
+	one client at a time with short timeouts, from a thread that only ever
+	reads the registry
+*/
+int metrics_serve(const char *address);
+void metrics_stop(void);
+
+#endif
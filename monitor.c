@@ -1,4 +1,3 @@
-#include <wiringPi.h>
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
@@ -8,28 +7,38 @@
 #include <signal.h>
 #include <libpq-fe.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "gpio.h"
+#include "dbwriter.h"
+#include "config.h"
+#include "status.h"
+#include "latency.h"
+#include "trace.h"
+#include "bay.h"
+#include "schema.h"
+#include "metrics.h"
+#include "stream.h"
+#include "forward.h"
 
 bool stopProgram = false;
+// SIGUSR2: print the loop timing at the end of the current cycle
+volatile sig_atomic_t dumpLoopTiming = 0;
 
 void sig_handler(int signo)
 {
 	if (signo == SIGINT || signo == SIGUSR1) {
   		printf("\n");
 		stopProgram = true;
+	} else if (signo == SIGUSR2) {
+		dumpLoopTiming = 1;
 	}
 }
 
-void pg_exit(PGconn *conn, PGresult *res) {
-	PQclear(res);
-	PQfinish(conn);
-}
-
-void do_exit(PGconn *conn, PGresult *res) {
-	pg_exit(conn, res);
-	fprintf(stderr, "PG_ERROR: %s\n", PQerrorMessage(conn));
-	exit(1);
-}
-
 bool pg_bad_result(PGresult *res) {
 	return (PQresultStatus(res) != PGRES_COMMAND_OK) ? true : false;
 }
@@ -38,477 +47,924 @@ bool pg_bad_data(PGresult *res) {
 	return (PQresultStatus(res) != PGRES_TUPLES_OK) ? true : false;
 }
 
-static double TimeSpecToSeconds(struct timespec* ts)
-{
-    return (double)ts->tv_sec + (double)ts->tv_nsec / 1000000000.0;
-}
-
-static double getElapsedTime(struct timespec* start, struct timespec* end, bool roundToMinute)
-{
-	double exact_total = TimeSpecToSeconds(end) - TimeSpecToSeconds(start);
-	if(!roundToMinute) {
-		return exact_total;
-	} else {
-		int total = round(exact_total);
-		int roundTo = 60;
-		int leftover = total % roundTo;
-		if(leftover > 30) {
-			return total + roundTo - (total % roundTo);
-		} else {
-			return total - leftover;
-		}
+// simulated backends must never reboot or wipe the machine they run on
+void run_command(const struct gpio_backend *gpio, const char *command) {
+	if(gpio->simulated) {
+		printf("SIMULATED: %s\n", command);
+		return;
 	}
+	system(command);
 }
 
-void databaseSetup(PGconn *conn) {
-	// create the bay status table
-	PGresult *res = PQexec(conn, "CREATE TABLE IF NOT EXISTS bay_status (bay INT NOT NULL, timer_running BOOLEAN NOT NULL DEFAULT FALSE, pump_running BOOLEAN NOT NULL DEFAULT FALSE, timer_runtime NUMERIC(12, 2) NOT NULL DEFAULT 0, pump_runtime NUMERIC(12, 2) NOT NULL DEFAULT 0, PRIMARY KEY (bay));");
-	if(pg_bad_result(res)) do_exit(conn, res);
-	PQclear(res);
+static int compare_latency(const void *a, const void *b) {
+	double la = *(const double *)a;
+	double lb = *(const double *)b;
+	return (la > lb) - (la < lb);
+}
 
-	// create the bay status entries
-	res = PQexec(conn, "SELECT bay FROM bay_status WHERE bay = 1");
-	if(pg_bad_data(res)) do_exit(conn, res);
-	if(PQntuples(res) < 1) {
-		PQclear(res);
-		res = PQexec(conn, "INSERT INTO bay_status (bay, timer_running, pump_running) VALUES (1, false, false);");
-		if(pg_bad_result(res)) {
-			printf("\nCould not create status for Bay 1\n");
-			do_exit(conn, res);
-		}
+void print_bench_report(const struct gpio_backend *gpio, double *latencies, long cycles, double total) {
+	qsort(latencies, cycles, sizeof(double), compare_latency);
+	double sum = 0;
+	long i;
+	for(i = 0; i < cycles; i++) {
+		sum += latencies[i];
 	}
-	PQclear(res);
-	
-	res = PQexec(conn, "SELECT bay FROM bay_status WHERE bay = 2");
-	if(pg_bad_data(res)) do_exit(conn, res);
-	if(PQntuples(res) < 1) {
-		PQclear(res);
-		res = PQexec(conn, "INSERT INTO bay_status (bay, timer_running, pump_running) VALUES (2, false, false);");
-		if(pg_bad_result(res)) {
-			printf("\nCould not create status for Bay 2\n");
-			do_exit(conn, res);
-		}
+	printf("BENCH (%s backend): %ld cycles in %.3f seconds\n", gpio->name, cycles, total);
+	printf("  cycles/sec: %.0f\n", cycles / total);
+	printf("  cycle latency us: min %.2f  mean %.2f  p50 %.2f  p99 %.2f  max %.2f\n",
+		latencies[0] * 1e6, sum / cycles * 1e6, latencies[cycles / 2] * 1e6,
+		latencies[(long)(cycles * 0.99)] * 1e6, latencies[cycles - 1] * 1e6);
+}
+
+void print_queue_stats(void) {
+	struct db_queue_stats stats;
+	db_queue_stats(&stats);
+	printf("DB QUEUE: %" PRIu64 " queued, %" PRIu64 " dropped, depth %u (max %u of %d)\n",
+		stats.pushed, stats.dropped, stats.depth, stats.max_depth, DB_QUEUE_SIZE);
+	printf("DB WRITES: %" PRIu64 " statements in %" PRIu64 " round trips, %" PRIu64 " updates coalesced, %" PRIu64 " rows copied\n",
+		stats.written, stats.batches, stats.coalesced, stats.copied);
+	// only with -t, nothing else writes runtime rows
+	if(stats.runtime_written + stats.runtime_suppressed > 0) {
+		printf("DB RUNTIME: %" PRIu64 " bay_status runtime rows written, %" PRIu64 " updates suppressed\n",
+			stats.runtime_written, stats.runtime_suppressed);
 	}
-	PQclear(res);
-	
-	res = PQexec(conn, "SELECT bay FROM bay_status WHERE bay = 3");
-	if(pg_bad_data(res)) do_exit(conn, res);
-	if(PQntuples(res) < 1) {
-		PQclear(res);
-		res = PQexec(conn, "INSERT INTO bay_status (bay, timer_running, pump_running) VALUES (3, false, false);");
-		if(pg_bad_result(res)) {
-			printf("\nCould not create status for Bay 3\n");
-			do_exit(conn, res);
-		}
+	printf("DB JOURNAL: %" PRIu64 " waiting, %" PRIu64 " lost to a full journal, %" PRIu64 " connections, %" PRIu64 " write errors, %s\n",
+		stats.journal_pending, stats.journal_dropped, stats.reconnects, stats.db_errors, stats.connected ? "connected" : "not connected");
+}
+
+// relay edge to committed row, the event times have to be real ones
+void print_commit_latency(void) {
+	static struct latency_histogram sessions, inserts;
+	db_commit_latency(&sessions, &inserts);
+	latency_print(&sessions, stdout, "DB COMMIT sessions");
+	latency_print(&inserts, stdout, "DB COMMIT inserts");
+}
+
+/*
+	LOOP TIMING
+	every polling cycle is meant to start one sample period after the last.
+	period is start to start, late is how far past its deadline a cycle
+	started, and missed counts deadlines that went by without a cycle at
+	all. debounce and hold windows are counted in cycles, so these are
+	what say whether they still hold
+*/
+struct latency_histogram loopPeriod;
+struct latency_histogram loopLate;
+_Atomic uint64_t loopMissed = 0;
+
+void print_loop_timing(long samplePeriod) {
+	printf("LOOP TIMING (%.3f ms period):\n", samplePeriod / 1e6);
+	latency_print(&loopPeriod, stdout, "  period");
+	latency_print(&loopLate, stdout, "  late");
+	printf("  missed deadlines: %" PRIu64 ", worst case %.1f us late\n", (uint64_t)loopMissed, loopLate.max / 1e3);
+	fflush(stdout);
+}
+
+/*
+	METRICS (metrics.h)
+	the sampling loop only ever adds to these, the -M endpoint reads them
+	from its own thread. work is a polling cycle from waking to going back
+	to sleep, late the same as LOOP TIMING's
+*/
+static const double loopSeconds[] = {0.00001, 0.000025, 0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1};
+struct metric_histogram loopWork;
+struct metric_histogram loopLateness;
+_Atomic uint64_t sessionsRecorded[CONFIG_MAX_BAYS];
+_Atomic uint64_t insertsRecorded[CONFIG_MAX_BAYS];
+
+static int64_t timespec_ns(const struct timespec *ts) {
+	return (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+/*
+	REAL TIME MODE: lock every page in memory so a cycle never waits on a
+	page fault, and put the sampling thread (only) on SCHED_FIFO. the
+	writer thread is already running and keeps its normal priority
+*/
+void enter_realtime(int priority) {
+	if(mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+		fprintf(stderr, "REALTIME: could not lock memory: %s\n", strerror(errno));
 	}
-	PQclear(res);
-	
-	res = PQexec(conn, "SELECT bay FROM bay_status WHERE bay = 4");
-	if(pg_bad_data(res)) do_exit(conn, res);
-	if(PQntuples(res) < 1) {
-		PQclear(res);
-		res = PQexec(conn, "INSERT INTO bay_status (bay, timer_running, pump_running) VALUES (4, false, false);");
-		if(pg_bad_result(res)) {
-			printf("\nCould not create status for Bay 4\n");
-			do_exit(conn, res);
-		}
+	struct sched_param param = {.sched_priority = priority};
+	int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if(err != 0) {
+		fprintf(stderr, "REALTIME: could not set SCHED_FIFO priority %d: %s\n", priority, strerror(err));
 	}
-	PQclear(res);
+}
 
-	// set all statuses to false
-	res = PQexec(conn, "UPDATE bay_status SET timer_running = false, pump_running = false;");
-	if(pg_bad_result(res)) do_exit(conn, res);
-	PQclear(res);
+void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [-f config] [-d conninfo] [-j journal] [-s schedule] [-b cycles] [-r hz] [-c gpiochip] [-e] [-t] [-R priority] [-T trace] [-P trace] [-M address] [-S socket] [-V]\n", prog);
+	fprintf(stderr, "  -f config    site configuration: bays, pins, windows, pricing (default: the original 4 bays)\n");
+	fprintf(stderr, "  -d conninfo  postgres connection string\n");
+	fprintf(stderr, "  -V           check the bay totals against the full session history and exit\n");
+	fprintf(stderr, "  -j journal   session journal file, replayed into postgres (default cwmonitor.journal)\n");
+	fprintf(stderr, "  -s schedule  use the simulated GPIO backend driven by a pin schedule\n");
+	fprintf(stderr, "  -b cycles    run the main loop flat out for this many cycles and report timing\n");
+	fprintf(stderr, "  -r hz        input sample rate (default 100), debounce windows keep their length\n");
+	fprintf(stderr, "  -c gpiochip  use the GPIO character device backend (default /dev/gpiochip0)\n");
+	fprintf(stderr, "  -e           block on debounced, timestamped edges instead of polling\n");
+	fprintf(stderr, "  -R priority  real time: absolute deadlines, SCHED_FIFO at this priority (1-99), memory locked\n");
+	fprintf(stderr, "               (SIGUSR2 prints the polling loop timing, real time or not)\n");
+	fprintf(stderr, "  -T trace     record every sampled pin change to a trace file (polling only)\n");
+	fprintf(stderr, "  -P trace     replay a trace through the debounce and session logic as fast as it goes,\n");
+	fprintf(stderr, "               printing the sessions and inserts instead of writing them (same -f config)\n");
+	fprintf(stderr, "  -t           also keep the bay_status table current, for dashboards that cannot map " STATUS_SHM_NAME "\n");
+	fprintf(stderr, "  -M address   serve OpenMetrics on [host:]port (host defaults to 127.0.0.1) or unix:/path\n");
+	fprintf(stderr, "  -S socket    publish every edge, session and insert as binary records on this unix socket (cw-tail reads it)\n");
+}
 
+// pins, windows and pricing for this site (config.h)
+struct carwash_config config;
 
-	res = PQexec(conn, "CREATE TABLE IF NOT EXISTS bay_sessions (id BIGSERIAL, bay INT NOT NULL, timer_time NUMERIC(14,2), pump_time NUMERIC(14,2), timestamp TIMESTAMP DEFAULT current_timestamp, PRIMARY KEY (id));");
-	if(pg_bad_result(res)) do_exit(conn, res);
-	PQclear(res);
+// live status goes to the shared memory segment (status.h), the bay_status table is opt in
+bool statusTable = false;
 
+// -S: edges, sessions and inserts also go out on the event stream socket
+bool streaming = false;
+bool forwarding = false;
 
-	res = PQexec(conn, "CREATE TABLE IF NOT EXISTS bay_maintenance_inserts (id BIGSERIAL, bay INT NOT NULL, timestamp TIMESTAMP DEFAULT current_timestamp, PRIMARY KEY (id));");
-	if(pg_bad_result(res)) do_exit(conn, res);
-	PQclear(res);
-}
+// -P: sessions and inserts are printed, nothing is published or written
+bool replaying = false;
+long replayedSessions = 0;
+long replayedInserts = 0;
 
-int main (void)
-{
-	if (signal(SIGINT, sig_handler) == SIG_ERR)
-		printf("\ncan't catch SIGINT\n");
-	if (signal(SIGUSR1, sig_handler) == SIG_ERR)
-		printf("\ncan't catch SIGUSR1\n");
+// the writer thread runs this on every new connection (schema.h)
+int databaseSetup(PGconn *conn) {
+	return db_setup_schema(conn, config.bay_count, statusTable);
+}
 
-	// CONNECT TO POSTGRESQL
-	PGconn *conn = PQconnectdb("user=washman password=cotton dbname=carwash");
+// and hourly after that: next months' partitions, old ones dropped past retention_months
+int databaseMaintain(PGconn *conn) {
+	return db_maintain_partitions(conn, config.retention_months);
+}
 
+/*
+	-V: check bay_totals against a full recompute of the history, both read
+	in one statement so they come from the same snapshot
+*/
+int verify_totals(const char *conninfo) {
+	PGconn *conn = PQconnectdb(conninfo);
 	if(PQstatus(conn) == CONNECTION_BAD) {
 		fprintf(stderr, "Connection to database failed: %s\n", PQerrorMessage(conn));
 		PQfinish(conn);
-		exit(1);
+		return -1;
 	}
 
-	// MAKE SURE WE HAVE OUR TABLES
-	databaseSetup(conn);
+	PGresult *res = PQexec(conn,
+		"SELECT COALESCE(t.bay, r.bay) AS bay, "
+		"t.timer_time, COALESCE(r.timer_time, 0), t.pump_time, COALESCE(r.pump_time, 0), "
+		"t.sessions, COALESCE(r.sessions, 0), t.maintenance_inserts, COALESCE(r.maintenance_inserts, 0), "
+		"(t.timer_time, t.pump_time, t.sessions, t.maintenance_inserts) IS NOT DISTINCT FROM "
+		"(COALESCE(r.timer_time, 0), COALESCE(r.pump_time, 0), COALESCE(r.sessions, 0), COALESCE(r.maintenance_inserts, 0)) AS ok "
+		"FROM bay_totals t FULL JOIN (" BAY_TOTALS_RECOMPUTE ") r ON t.bay = r.bay ORDER BY 1;");
+	if(pg_bad_data(res)) {
+		fprintf(stderr, "PG_ERROR: %s\n", PQerrorMessage(conn));
+		PQclear(res);
+		PQfinish(conn);
+		return -1;
+	}
 
-	// SET UP PREPARED STATEMENT FOR BAY STATUS
-	char *statement = "UPDATE bay_status SET timer_running = $1, pump_running = $2 WHERE bay = $3;";
-	PGresult *res = PQprepare(conn, "UPDATE_BAY_STATUS", statement, 3, NULL);
-	if(pg_bad_result(res)) do_exit(conn, res);
+	int bad = 0, x;
+	for(x = 0; x < PQntuples(res); x++) {
+		if(strcmp(PQgetvalue(res, x, 9), "t") == 0) continue;
+		bad++;
+		printf("BAY %s: totals timer %s pump %s sessions %s inserts %s, history timer %s pump %s sessions %s inserts %s\n",
+			PQgetvalue(res, x, 0),
+			PQgetisnull(res, x, 1) ? "missing" : PQgetvalue(res, x, 1), PQgetvalue(res, x, 3), PQgetvalue(res, x, 5), PQgetvalue(res, x, 7),
+			PQgetvalue(res, x, 2), PQgetvalue(res, x, 4), PQgetvalue(res, x, 6), PQgetvalue(res, x, 8));
+	}
+	printf("TOTALS: %d bays checked, %d out of step with the history\n", PQntuples(res), bad);
 	PQclear(res);
+	PQfinish(conn);
+	return bad > 0 ? 1 : 0;
+}
 
+const struct gpio_backend *gpio;
 
-	// SET UP PREPARED STATEMENT FOR BAY STATUS RUNTIME
-	char *statement2 = "UPDATE bay_status SET timer_runtime = $1, pump_runtime = $2 WHERE bay = $3;";
-	res = PQprepare(conn, "UPDATE_BAY_STATUS_RUNTIME", statement2, 3, NULL);
-	if(pg_bad_result(res)) do_exit(conn, res);
-	PQclear(res);
+/*
+	LAYOUT: every input is one bit of the per-cycle sample
+	DEFINITION: {
+		bay * 4 + pin index: the bay pins from the config,
+		bay count * 4: REBOOT_PIN,
+		bay count * 4 + 1: WIPE_PIN
+	}
+*/
+#define BAY_SLOT(bay, pin) ((bay) * 4 + (pin))
+#define REBOOT_SLOT (config.bay_count * 4)
+#define WIPE_SLOT (config.bay_count * 4 + 1)
+#define INPUT_COUNT (config.bay_count * 4 + 2)
+// how long the wipe pin waits for the database before rebooting anyway
+#define WIPE_TIMEOUT_SECONDS 10
+// how often the edge loop wakes to check on a pending wipe
+#define WIPE_CHECK_MS 50
+
+// the timer/pump/maintenance logic of every bay (bay.h)
+struct bay_table bays;
+
+/*
+	EVENT TIME ON THE WALL CLOCK
+	stored rows say when things happened, not when the writer got to them:
+	sample and edge times are put on the wall clock through a pair of
+	readings (sample clock, CLOCK_REALTIME) taken together. real hardware
+	retakes the pair every second, so a stepped wall clock (NTP, a Pi with
+	no RTC setting its time late) shows within a second while a slow or
+	missing database never moves a stored time. simulated time keeps its
+	first pair so its made up timeline stays whole, replays use the trace's
+*/
+struct timespec anchorSample;
+struct timespec anchorWall;
+bool anchored = false;
+
+// now is the current time on the sample clock
+void refresh_wall_anchor(const struct timespec *now) {
+	if(anchored && (gpio->simulated || timespec_ns(now) - timespec_ns(&anchorSample) < 1000000000)) return;
+	anchorSample = *now;
+	clock_gettime(CLOCK_REALTIME, &anchorWall);
+	anchored = true;
+}
 
+void event_wall_time(const struct timespec *t, struct timespec *wall) {
+	if(replaying) {
+		gpio_trace_wall_time(t, wall);
+		return;
+	}
+	int64_t ns = timespec_ns(&anchorWall) + timespec_ns(t) - timespec_ns(&anchorSample);
+	wall->tv_sec = ns / 1000000000;
+	wall->tv_nsec = ns % 1000000000;
+}
 
-	// SET UP PREPARED STATEMENT FOR BAY MAINTENANCE INSERTS
-	char *statement3 = "INSERT INTO bay_sessions (bay, timer_time, pump_time) VALUES ($1, $2, $3);";
-	res = PQprepare(conn, "BAY_SESSION_INSERT", statement3, 3, NULL);
-	if(pg_bad_result(res)) do_exit(conn, res);
-	PQclear(res);
+// BAY ACTIONS: shared by the polling and event driven loops, t is when the input changed
+// none of these touch the database, they queue records for the writer thread
+
+void print_replayed(int kind, int i, struct timespec *t, double timerTime, double pumpTime) {
+	struct timespec wall;
+	gpio_trace_wall_time(t, &wall);
+	char when[32];
+	strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&wall.tv_sec));
+	if(kind == DB_BAY_SESSION) {
+		printf("REPLAY %s.%03ld BAY %d SESSION timer %.2f pump %.2f\n", when, wall.tv_nsec / 1000000, i + 1, timerTime, pumpTime);
+		replayedSessions++;
+	} else if(kind == DB_MAINTENANCE_INSERT) {
+		printf("REPLAY %s.%03ld BAY %d INSERT\n", when, wall.tv_nsec / 1000000, i + 1);
+		replayedInserts++;
+	}
+}
 
+// started: when a session began, NULL for anything else
+void queue_event(int kind, int i, struct timespec *t, struct timespec *started, double timerTime, double pumpTime) {
+	if(replaying) {
+		print_replayed(kind, i, t, timerTime, pumpTime);
+		return;
+	}
+	struct db_event event = {
+		.kind = kind,
+		.bay = i,
+		.timer_running = bays.running[i][BAY_TIMER],
+		.pump_running = bays.running[i][BAY_PUMP],
+		.time = *t,
+		.timer_time = timerTime,
+		.pump_time = pumpTime,
+	};
+	event_wall_time(t, &event.wall);
+	if(started != NULL) event_wall_time(started, &event.started);
+	db_queue_push(&event);
+}
 
-	// SET UP PREPARED STATEMENT FOR BAY MAINTENANCE INSERTS
-	char *statement4 = "INSERT INTO bay_maintenance_inserts (bay) VALUES ($1);";
-	res = PQprepare(conn, "MAINTENANCE_INSERT", statement4, 1, NULL);
-	if(pg_bad_result(res)) do_exit(conn, res);
-	PQclear(res);
+/*
+	EVENT STREAM (stream.h): edges, sessions and inserts to local
+	subscribers as they happen, on the same wall clock as the rows.
+	times are what the event says, started NULL when it has none
+*/
+int64_t stream_wall_ns(const struct timespec *t) {
+	struct timespec wall;
+	event_wall_time(t, &wall);
+	return timespec_ns(&wall);
+}
 
+void stream_event(int kind, int i, const struct bay_event *event, const struct timespec *started, double timerTime, double pumpTime) {
+	struct stream_record record = {
+		.kind = kind,
+		.bay = i + 1,
+		.flags = (event->timer_running ? STREAM_TIMER_RUNNING : 0) | (event->pump_running ? STREAM_PUMP_RUNNING : 0),
+		.time_ns = stream_wall_ns(&event->time),
+		.started_ns = (started != NULL) ? stream_wall_ns(started) : 0,
+		.timer_ms = (uint32_t)lround(fmax(timerTime, 0) * 1000),
+		.pump_ms = (uint32_t)lround(fmax(pumpTime, 0) * 1000),
+	};
+	stream_publish(&record);
+}
 
+// the session so far goes along with the status so dashboards can run the clocks themselves
+void bay_status_changed(int i, struct bay_event *event) {
+	// readers run the clocks on CLOCK_MONOTONIC, which simulated time is not
+	int64_t at = gpio->simulated ? status_now_ns() : (int64_t)event->time.tv_sec * 1000000000 + event->time.tv_nsec;
+	status_publish(i, event->timer_running, event->pump_running, event->timer_time, event->pump_time, at);
+	if(statusTable) queue_event(DB_BAY_STATUS, i, &event->time, NULL, event->timer_time, event->pump_time);
+}
 
-	// INITIAL SETUP
+// only the bay_status table needs the running clocks pushed, the segment carries start times
+void bay_runtime_update(int i, struct timespec *now) {
+	if(!statusTable) return;
+	double timerTime, pumpTime;
+	bay_runtime(&bays, i, now, &timerTime, &pumpTime);
+	queue_event(DB_BAY_RUNTIME, i, now, NULL, timerTime, pumpTime);
+}
 
-	printf("INITIALIZING...\n");
-	/* 
-	    LAYOUT: bayPins[bay][GPIO pin]
-	    PIN DEFINTIONS: {
-			0: TIMER_ON_RELAY_INPUT,	// records total paid time
-			1: PUMP_ON_RELAY_INPUT,		// records total pump time
-			2: INSERT_COIN_RELAY_OUTPUT,// NOT USED! remotely "inserts" a coin
-			3: MAINTENANCE_INSERT		// records when a coin is "inserted" from pump room
+// what one sample or edge did to a bay
+void bay_events(int i, struct bay_event *events, int count) {
+	int e;
+	for(e = 0; e < count; e++) {
+		struct bay_event *event = &events[e];
+		switch(event->kind) {
+			case BAY_TIMER_STOPPED:
+				printf("BAY %d TIMER ELAPSED: %f seconds\n", i + 1, event->session_timer);
+				stream_event(STREAM_TIMER_STOPPED, i, event, &event->started, event->run_time, event->session_pump);
+				// record session
+				if(event->session_timer > 0) {
+					metrics_inc(&sessionsRecorded[i]);
+					stream_event(STREAM_SESSION, i, event, &event->started, event->session_timer, event->session_pump);
+					queue_event(DB_BAY_SESSION, i, &event->time, &event->started, event->session_timer, event->session_pump);
+				}
+				// update bay status and zero its runtime
+				bay_status_changed(i, event);
+				if(statusTable) queue_event(DB_BAY_RUNTIME, i, &event->time, NULL, 0, 0);
+				break;
+			case BAY_PUMP_STOPPED:
+				printf("BAY %d PUMP ELAPSED: %f seconds\n", i + 1, event->run_time);
+				stream_event(STREAM_PUMP_STOPPED, i, event, &event->started, event->timer_time, event->pump_time);
+				bay_status_changed(i, event);
+				break;
+			case BAY_TIMER_STARTED:
+			case BAY_PUMP_STARTED:
+				stream_event(event->kind == BAY_TIMER_STARTED ? STREAM_TIMER_STARTED : STREAM_PUMP_STARTED, i, event, NULL, event->timer_time, event->pump_time);
+				bay_status_changed(i, event);
+				break;
+			case BAY_INSERT:
+				printf("Bay %d insert\n", i + 1);
+				metrics_inc(&insertsRecorded[i]);
+				stream_event(STREAM_INSERT, i, event, NULL, 0, 0);
+				queue_event(DB_MAINTENANCE_INSERT, i, &event->time, NULL, 0, 0);
+				break;
 		}
-		pins listed are GPIO numbers not physical numbers (physical commented to right)
-	*/
+	}
+}
 
-	int REBOOT_PIN = 25; // 37
-	int WIPE_PIN = 14; // 23
+/*
+	PENDING WIPE
+	the wipe pin queues the wipe and the loops keep sampling, rebooting once
+	the writer has committed it or WIPE_TIMEOUT_SECONDS have passed
+*/
+bool wipePending = false;
+uint64_t wipeTicket;
+struct timespec wipeDeadline;
+
+// reboot/wipe pins act on release, depending on how long they were held. true when it acted
+bool hold_pin_released(int slot, double heldSeconds) {
+	if(slot == REBOOT_SLOT) {
+		if(heldSeconds > config.reboot_hold_ms / 1000.0 && heldSeconds < config.shutdown_hold_ms / 1000.0) {
+			run_command(gpio, "shutdown -r now");
+			return true;
+		} else if(heldSeconds > config.shutdown_hold_ms / 1000.0) {
+			run_command(gpio, "shutdown now");
+			return true;
+		}
+	} else if(slot == WIPE_SLOT) {
+		if(heldSeconds > config.wipe_hold_ms / 1000.0) {
+			// through the writer's journal, so the wipe lands after everything recorded before it
+			if(gpio->simulated) {
+				printf("SIMULATED: wipe history\n");
+				run_command(gpio, "shutdown -r now");
+			} else if(!wipePending) {
+				if(db_wipe_queue(&wipeTicket)) {
+					clock_gettime(CLOCK_MONOTONIC, &wipeDeadline);
+					wipeDeadline.tv_sec += WIPE_TIMEOUT_SECONDS;
+					wipePending = true;
+				} else {
+					printf("WIPE: the database queue is full, not wiped\n");
+					run_command(gpio, "shutdown -r now");
+				}
+			}
+			return true;
+		}
+	}
+	return false;
+}
 
-	int bayPins[4][4] = {
-		{7, 0, 2, 3},     // 7, 11, 13, 15
-		{1, 4, 5, 6},     // 12, 16, 18, 22
-		{21, 22, 23, 24}, // 29, 31, 33, 35
-		{26, 27, 28, 29}, // 32, 36, 38, 40
-	};
+// called every pass of either loop: reboots once a pending wipe is in or has waited long enough
+void wipe_reboot_check(void) {
+	if(!wipePending) return;
+	bool applied = db_wipe_applied(wipeTicket);
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if(!applied && getElapsedTime(&wipeDeadline, &now, false) < 0) return;
+	if(!applied) printf("WIPE: not in the database yet, it is journaled and goes in once the database is back\n");
+	wipePending = false;
+	run_command(gpio, "shutdown -r now");
+}
 
-	/*
-		LAYOUT: bayTimers[bay][timer]
-		DEFINITION: {
-			0: TIMER_START,
-			1: TIMER_END,
-			2: PUMP_START,
-			3: PUMP_END
+/*
+	EVENT DRIVEN INPUT
+	the kernel has already debounced every edge, so each one is acted on
+	directly and stamped with the time the relay actually switched
+*/
+struct timespec holdPinPressed[2];
+bool holdPinDown[2] = {false, false};
+
+void handle_edge(struct gpio_edge *edge) {
+	if(edge->slot == REBOOT_SLOT || edge->slot == WIPE_SLOT) {
+		int h = edge->slot - REBOOT_SLOT;
+		if(edge->level == GPIO_LOW) {
+			holdPinPressed[h] = edge->time;
+			holdPinDown[h] = true;
+		} else if(holdPinDown[h]) {
+			holdPinDown[h] = false;
+			hold_pin_released(edge->slot, getElapsedTime(&holdPinPressed[h], &edge->time, false));
 		}
-	*/
-	struct timespec bayTimers[4][4];
-
-	/*
-		LAYOUT: bayTimerThresholds[bay][timer/pump start/stop]
-		DEFINITION: {
-			0: TIMER_START_COUNT,
-			1: TIMER_STOP_COUNT,
-			2: PUMP_START_COUNT,
-			3: PUMP_STOP_COUNT
+		return;
+	}
+
+	int i = edge->slot / 4;
+	struct bay_event events[BAY_MAX_EVENTS];
+	bay_events(i, events, bay_edge(&bays, i, edge->slot % 4, edge->level, &edge->time, events));
+}
+
+// runs until stopProgram, -1 when the edge source failed
+int run_event_loop(void) {
+	int fd = gpio->event_fd();
+	struct gpio_edge edges[GPIO_MAX_INPUTS * 2];
+	struct timespec now, nextRefresh = {0, 0};
+	int i, n;
+
+	// inputs that are already active at startup produce no edge
+	struct gpio_sample sample;
+	gpio->sample(&sample);
+	refresh_wall_anchor(&sample.time);
+	for(i = 0; i < INPUT_COUNT; i++) {
+		if(GPIO_LEVEL(&sample, i) == GPIO_LOW) {
+			struct gpio_edge edge = {i, GPIO_LOW, sample.time};
+			handle_edge(&edge);
 		}
-	*/
-	int bayTimerThresholds[4][4] = {
-		{0,0,0,0},
-		{0,0,0,0},
-		{0,0,0,0},
-		{0,0,0,0},
-	};
+	}
 
-	/*
-		LAYOUT: elapsedTime[bay][timer or pump]
-		DEFINITION: {
-			0: TIMER_ELAPSED_TIME,
-			1: PUMP_ELAPSED_TIME
+	while (stopProgram == false) {
+		// sleep until an edge arrives, waking only to refresh the bay_status runtime of running bays
+		bool anyRunning = false;
+		for(i = 0; i < config.bay_count && statusTable; i++) {
+			if(bays.running[i][BAY_TIMER]) anyRunning = true;
+		}
+		int timeout = -1;
+		if(anyRunning) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			double wait = getElapsedTime(&now, &nextRefresh, false);
+			timeout = (wait > 0) ? (int)ceil(wait * 1000) : 0;
+		}
+		if(wipePending && (timeout < 0 || timeout > WIPE_CHECK_MS)) timeout = WIPE_CHECK_MS;
+
+		struct pollfd pfd = {fd, POLLIN, 0};
+		if(poll(&pfd, 1, timeout) < 0) {
+			if(errno == EINTR) continue;
+			perror("poll");
+			stopProgram = true;
+			return -1;
 		}
-	*/
-	double elapsedTime[4][2] = {
-		{0,0},
-		{0,0},
-		{0,0},
-		{0,0},
-	};
 
-	double pumpSessionElapsedTime[4] = {0,0,0,0};
+		if(pfd.revents & POLLIN) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			refresh_wall_anchor(&now);
+			while((n = gpio->read_edges(edges, GPIO_MAX_INPUTS * 2)) > 0) {
+				for(i = 0; i < n; i++) {
+					handle_edge(&edges[i]);
+				}
+			}
+		}
 
-	/*
-		LAYOUT: bayRunning[bay][timer or pump]
-		DEFINITION: {
-			0: TIMER_RUNNING,
-			1: PUMP_RUNNING
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if(getElapsedTime(&nextRefresh, &now, false) >= 0) {
+			for(i = 0; i < config.bay_count; i++) {
+				if(bays.running[i][BAY_TIMER]) bay_runtime_update(i, &now);
+			}
+			nextRefresh = now;
+			nextRefresh.tv_nsec += config.runtime_refresh_ms * 1000000L;
+			if(nextRefresh.tv_nsec >= 1000000000L) {
+				nextRefresh.tv_sec++;
+				nextRefresh.tv_nsec -= 1000000000L;
+			}
 		}
-	*/
-	bool bayRunning[4][2] = {
-		{false, false},
-		{false, false},
-		{false, false},
-		{false, false},
-	};
 
-	bool bayInsertState[4] = {true, true, true, true};
+		// everything this wakeup produced goes to the database in one round trip
+		db_queue_flush();
+		stream_flush();
+		wipe_reboot_check();
+	}
+	return 0;
+}
+
+// everything -M serves: the polling loop, every bay's inputs and records, and the writer's own (dbwriter.h)
+int register_metrics(void) {
+	static const char *inputNames[BAY_INPUTS] = {[BAY_TIMER] = "timer", [BAY_PUMP] = "pump", [BAY_MAINTENANCE] = "coin"};
+	static const int inputs[] = {BAY_TIMER, BAY_PUMP, BAY_MAINTENANCE};
+	char labels[96];
+	int failed = 0, i, n;
+
+	failed |= metrics_register("carwash_loop_work_seconds", "polling cycles from waking to going back to sleep", METRIC_HISTOGRAM, NULL, &loopWork);
+	failed |= metrics_register("carwash_loop_late_seconds", "how far past its deadline each polling cycle started", METRIC_HISTOGRAM, NULL, &loopLateness);
+	failed |= metrics_register("carwash_loop_missed_deadlines", "sample periods that went by without a polling cycle", METRIC_COUNTER, NULL, &loopMissed);
+	for(n = 0; n < 3; n++) {
+		for(i = 0; i < config.bay_count; i++) {
+			snprintf(labels, sizeof(labels), "bay=\"%d\",input=\"%s\",pin=\"%d\"", i + 1, inputNames[inputs[n]], config.bay_pins[i][inputs[n]]);
+			failed |= metrics_register("carwash_debounce_rejections", "input changes that did not last their debounce window (polling, edges arrive debounced)",
+				METRIC_COUNTER, labels, &bays.rejected[i][inputs[n]]);
+		}
+	}
+	for(i = 0; i < config.bay_count; i++) {
+		snprintf(labels, sizeof(labels), "bay=\"%d\"", i + 1);
+		failed |= metrics_register("carwash_sessions", "timer sessions recorded", METRIC_COUNTER, labels, &sessionsRecorded[i]);
+	}
+	for(i = 0; i < config.bay_count; i++) {
+		snprintf(labels, sizeof(labels), "bay=\"%d\"", i + 1);
+		failed |= metrics_register("carwash_maintenance_inserts", "maintenance coin inserts recorded", METRIC_COUNTER, labels, &insertsRecorded[i]);
+	}
+	if(!replaying) failed |= db_register_metrics();
+	if(streaming) failed |= stream_register_metrics();
+	if(forwarding) failed |= forward_register_metrics();
+	return failed ? -1 : 0;
+}
+
+int main (int argc, char **argv)
+{
+	const char *conninfo = "user=washman password=cotton dbname=carwash";
+	const char *journalPath = "cwmonitor.journal";
+	const char *configPath = NULL;
+	const char *schedulePath = NULL;
+	const char *chipPath = NULL;
+	bool eventMode = false;
+	bool verifyTotals = false;
+	long benchCycles = 0;
+	int sampleRate = 100;
+	int realtimePriority = 0;
+	const char *tracePath = NULL;
+	const char *replayPath = NULL;
+	const char *metricsAddress = NULL;
+	const char *streamPath = NULL;
+	int i = 0;
+
+	int opt;
+	while((opt = getopt(argc, argv, "f:d:j:s:b:r:c:etR:T:P:M:S:Vh")) != -1) {
+		switch(opt) {
+			case 'f': configPath = optarg; break;
+			case 'd': conninfo = optarg; break;
+			case 'j': journalPath = optarg; break;
+			case 's': schedulePath = optarg; break;
+			case 'b': benchCycles = atol(optarg); break;
+			case 'r': sampleRate = atoi(optarg); break;
+			case 'c': chipPath = optarg; break;
+			case 'e': eventMode = true; break;
+			case 't': statusTable = true; break;
+			case 'R': realtimePriority = atoi(optarg); break;
+			case 'T': tracePath = optarg; break;
+			case 'P': replayPath = optarg; break;
+			case 'M': metricsAddress = optarg; break;
+			case 'S': streamPath = optarg; break;
+			case 'V': verifyTotals = true; break;
+			default: usage(argv[0]); exit(opt == 'h' ? 0 : 1);
+		}
+	}
+
+	if(verifyTotals) exit(verify_totals(conninfo) == 0 ? 0 : 1);
+	if(config_load(configPath, &config) < 0) exit(1);
+
+	if(sampleRate < 10 || sampleRate > 10000) {
+		fprintf(stderr, "sample rate must be between 10 and 10000 Hz\n");
+		exit(1);
+	}
+	long samplePeriod = 1000000000L / sampleRate;
+
+	// a replay runs at the rate it was recorded at, so every window is the same number of cycles
+	if(replayPath != NULL) {
+		int traceBays;
+		if(gpio_trace_load(replayPath, &samplePeriod, &traceBays) < 0) exit(1);
+		sampleRate = (int)lround(1e9 / samplePeriod);
+		if(traceBays != config.bay_count) {
+			fprintf(stderr, "%s was recorded with %d bays, replay it with the same -f config\n", replayPath, traceBays);
+			exit(1);
+		}
+		if(eventMode || tracePath != NULL || schedulePath != NULL || benchCycles > 0 || realtimePriority != 0) {
+			fprintf(stderr, "a replay is a polling run of its own, it cannot be combined with -e, -T, -s, -b or -R\n");
+			exit(1);
+		}
+		replaying = true;
+	}
+	if(tracePath != NULL && eventMode) {
+		fprintf(stderr, "traces record the polling loop's samples, -T cannot be used with -e\n");
+		exit(1);
+	}
+	if(realtimePriority != 0 && (realtimePriority < 1 || realtimePriority > 99 || eventMode || benchCycles > 0)) {
+		fprintf(stderr, "real time mode needs a priority between 1 and 99 and the polling loop\n");
+		exit(1);
+	}
+
+	// PICK GPIO BACKEND
+#ifdef HAVE_WIRINGPI
+	gpio = (chipPath != NULL || eventMode) ? &gpio_cdev : &gpio_wiringpi;
+#else
+	gpio = &gpio_cdev;
+#endif
+	if(chipPath != NULL) gpio_cdev_set_chip(chipPath);
+#ifdef HAVE_WIRINGPI
+	for(i = 0; i < config.expander_count; i++) {
+		gpio_wiringpi_add_mcp23017(config.expanders[i].pin_base, config.expanders[i].i2c_address);
+	}
+#endif
+	if(schedulePath != NULL) {
+		if(gpio_sim_load(schedulePath, samplePeriod) != 0) exit(1);
+		gpio = &gpio_sim;
+	}
+	if(replaying) gpio = &gpio_trace;
+	if(eventMode && (gpio->event_fd == NULL || benchCycles > 0)) {
+		fprintf(stderr, "event mode needs the cdev or sim backend and cannot be benchmarked\n");
+		exit(1);
+	}
 
-	int bayInsertCounter[4] = {0,0,0,0};
+	if (signal(SIGINT, sig_handler) == SIG_ERR)
+		printf("\ncan't catch SIGINT\n");
+	if (signal(SIGUSR1, sig_handler) == SIG_ERR)
+		printf("\ncan't catch SIGUSR1\n");
+	if (signal(SIGUSR2, sig_handler) == SIG_ERR)
+		printf("\ncan't catch SIGUSR2\n");
+
+	// INITIAL SETUP
+
+	printf("INITIALIZING...\n");
 
+	// windows are set in milliseconds and counted in cycles, so they hold at any sample rate
+	#define MS_TO_CYCLES(ms) ((int)((ms) * (long)sampleRate / 1000))
 	// how many cycles to wait before confirming a start or stop of relay
-	int threshold = 20;
+	int threshold = MS_TO_CYCLES(config.relay_debounce_ms);
 	// how many cycles to wait before confirming a coin insert
-	int MAINTENANCE_THRESHOLD = 5;
+	int MAINTENANCE_THRESHOLD = MS_TO_CYCLES(config.maintenance_debounce_ms);
+	struct bay_windows windows = {.relay = threshold, .maintenance = MAINTENANCE_THRESHOLD};
 
 	// SETUP GPIO PINS
-	wiringPiSetup();
-	// activate shutdown pin
-	pinMode(REBOOT_PIN, INPUT);
-	pullUpDnControl(REBOOT_PIN, PUD_UP);
-	pinMode(WIPE_PIN, INPUT);
-	pullUpDnControl(WIPE_PIN, PUD_UP);
-	int i = 0;
-	for(i = 0; i < 4; i++) {
-		pinMode(bayPins[i][0], INPUT);
-		pinMode(bayPins[i][1], INPUT);
-		pinMode(bayPins[i][2], INPUT);
-		pinMode(bayPins[i][3], INPUT);
-		pullUpDnControl(bayPins[i][0], PUD_UP);
-		pullUpDnControl(bayPins[i][1], PUD_UP);
-		pullUpDnControl(bayPins[i][2], PUD_UP);
-		pullUpDnControl(bayPins[i][3], PUD_UP);
+	if(gpio->setup() < 0) {
+		fprintf(stderr, "GPIO setup failed (%s backend)\n", gpio->name);
+		exit(1);
+	}
+	int inputPins[GPIO_MAX_INPUTS];
+	int debounceTimes[GPIO_MAX_INPUTS];
+	for(i = 0; i < config.bay_count; i++) {
+		inputPins[BAY_SLOT(i, 0)] = config.bay_pins[i][0];
+		inputPins[BAY_SLOT(i, 1)] = config.bay_pins[i][1];
+		inputPins[BAY_SLOT(i, 2)] = config.bay_pins[i][2];
+		inputPins[BAY_SLOT(i, 3)] = config.bay_pins[i][3];
+		debounceTimes[BAY_SLOT(i, 0)] = config.relay_debounce_ms * 1000;
+		debounceTimes[BAY_SLOT(i, 1)] = config.relay_debounce_ms * 1000;
+		debounceTimes[BAY_SLOT(i, 2)] = 0;
+		debounceTimes[BAY_SLOT(i, 3)] = config.maintenance_debounce_ms * 1000;
 	};
+	if(bay_table_init(&bays, config.bay_count) < 0) {
+		fprintf(stderr, "out of memory for %d bays\n", config.bay_count);
+		exit(1);
+	}
+	// activate shutdown pin
+	inputPins[REBOOT_SLOT] = config.reboot_pin;
+	inputPins[WIPE_SLOT] = config.wipe_pin;
+	debounceTimes[REBOOT_SLOT] = config.hold_pin_debounce_ms * 1000;
+	debounceTimes[WIPE_SLOT] = config.hold_pin_debounce_ms * 1000;
+	if(gpio->open_inputs(inputPins, eventMode ? debounceTimes : NULL, INPUT_COUNT) < 0) {
+		fprintf(stderr, "could not open input pins (%s backend)\n", gpio->name);
+		exit(1);
+	}
+	struct gpio_sample sample;
+
+	if(tracePath != NULL && trace_open(tracePath, config.trace_max_kb * 1024L, inputPins, INPUT_COUNT, config.bay_count, samplePeriod) < 0) {
+		exit(1);
+	}
+
+	// LIVE STATUS: without it the gui can still fall back to the bay_status table
+	if(!replaying && status_create(config.bay_count) < 0) {
+		fprintf(stderr, "no live status segment, dashboards need -t to see running bays\n");
+	}
+
+	// EVENT STREAM: published from a thread of its own, subscribers never hold up the loop
+	if(streamPath != NULL) {
+		if(stream_open(streamPath, config.bay_count) < 0) {
+			status_destroy();
+			gpio->close_inputs();
+			gpio->teardown();
+			exit(1);
+		}
+		streaming = true;
+	}
+
+	// CONNECT TO POSTGRESQL: the writer thread connects, sets up the tables and
+	// prepares statements, retrying in the background while the database is down
+	if(!replaying && db_writer_start(conninfo, journalPath, config.copy_threshold, config.runtime_write_ms, databaseSetup, databaseMaintain) < 0) {
+		stream_close();
+		status_destroy();
+		gpio->close_inputs();
+		gpio->teardown();
+		exit(1);
+	}
+
+	// FORWARDING: a thread of its own reads the journal behind the writer and sends it to the collector
+	if(!replaying && config.collector[0] != '\0') {
+		if(forward_start(config.collector, config.site) < 0) {
+			fprintf(stderr, "not forwarding to %s, the local database still gets everything\n", config.collector);
+		} else {
+			forwarding = true;
+		}
+	}
+
+	// METRICS: served from a thread of its own, started before real time mode like the writer
+	metrics_histogram_init(&loopWork, loopSeconds, sizeof(loopSeconds) / sizeof(loopSeconds[0]));
+	metrics_histogram_init(&loopLateness, loopSeconds, sizeof(loopSeconds) / sizeof(loopSeconds[0]));
+	if(metricsAddress != NULL && (register_metrics() < 0 || metrics_serve(metricsAddress) < 0)) {
+		fprintf(stderr, "no metrics endpoint\n");
+	}
 
-	printf("RUNNING\n");
+	long replayCycles = 0;
+	struct timespec replayStart;
+	clock_gettime(CLOCK_MONOTONIC, &replayStart);
 
-	const char *strue = "true";
-	const char *sfalse = "false";
+	// after the writer thread exists, so it does not inherit the priority
+	if(realtimePriority > 0) enter_realtime(realtimePriority);
 
-	char bay_string[1];
-	char bay_timer_runtime[16];
-	char bay_pump_runtime[16];
-	char bay_session_timer_time[16];
-	char bay_session_pump_time[16];
+	printf("RUNNING (%d bays, %s backend, %s%s)\n", config.bay_count, gpio->name, eventMode ? "edge events" : "polling",
+		realtimePriority > 0 ? ", real time" : "");
 
 	int counter = 0;
-	int COUNTER_MAX = 10;
+	int COUNTER_MAX = MS_TO_CYCLES(config.runtime_refresh_ms);
 
 	int reboot_pin_counter = 0;
-	int reboot_threshold = 100;
-	int shutdown_threshold = 500;
 	int wipe_pin_counter = 0;
-	int wipe_threshold = 1000;
+
+	// benchmark: time every pass of the loop and skip the sleep
+	double *benchLatencies = NULL;
+	long benchCycle = 0;
+	struct timespec benchStart, benchEnd, cycleStart, cycleEnd;
+	if(benchCycles > 0) {
+		benchLatencies = malloc(benchCycles * sizeof(double));
+		if(benchLatencies == NULL) {
+			fprintf(stderr, "could not allocate %ld bench samples\n", benchCycles);
+			exit(1);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &benchStart);
+	}
+
+	int exitStatus = 0;
+	if(eventMode && run_event_loop() < 0) exitStatus = 1;
+
+	// the first cycle is due now, each one after a sample period after the one before
+	latency_reset(&loopPeriod);
+	latency_reset(&loopLate);
+	struct timespec deadline, wake, lastWake;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	bool firstCycle = true;
 
 	// main loop
 	while (stopProgram == false) {
+		if(benchLatencies != NULL) clock_gettime(CLOCK_MONOTONIC, &cycleStart);
+		if(benchLatencies == NULL && !replaying) {
+			clock_gettime(CLOCK_MONOTONIC, &wake);
+			int64_t late = timespec_ns(&wake) - timespec_ns(&deadline);
+			if(!firstCycle) latency_record(&loopPeriod, timespec_ns(&wake) - timespec_ns(&lastWake));
+			latency_record(&loopLate, late);
+			metrics_observe(&loopLateness, late > 0 ? late : 0);
+			// a relative sleep starts its period only once the work is done, every whole period late is a missed cycle
+			// (real time mode counts the deadlines it skips instead)
+			if(realtimePriority == 0 && late >= samplePeriod) loopMissed += late / samplePeriod;
+			lastWake = wake;
+			firstCycle = false;
+		}
+		if(dumpLoopTiming) {
+			dumpLoopTiming = 0;
+			print_loop_timing(samplePeriod);
+		}
+		// one consistent snapshot of every input for this cycle
+		gpio->sample(&sample);
+		refresh_wall_anchor(&sample.time);
+		if(tracePath != NULL) trace_sample(&sample);
+		// the last recorded cycle still goes through the loop
+		if(replaying && gpio_trace_finished()) stopProgram = true;
+
 		counter ++;
 		if(counter > COUNTER_MAX) {
 			counter = 0;
 		}
 		
 		// loop over each bay
-		for(i = 0; i < 4; i++) {
-
-			// convert the bay number to const char for PG use
-			sprintf(bay_string, "%d", i + 1);
-
-			if(bayRunning[i][0] == true && counter > COUNTER_MAX - 1) {
-				clock_gettime(CLOCK_MONOTONIC, &bayTimers[i][1]);
-				clock_gettime(CLOCK_MONOTONIC, &bayTimers[i][3]);
-				elapsedTime[i][0] = getElapsedTime(&bayTimers[i][0], &bayTimers[i][1], false);
-				elapsedTime[i][1] = getElapsedTime(&bayTimers[i][2], &bayTimers[i][3], false);
-
-				double elapsedPumpTime = (bayRunning[i][1] == true)
-					? pumpSessionElapsedTime[i] + elapsedTime[i][1]
-					: pumpSessionElapsedTime[i];
-
-				sprintf(bay_timer_runtime, "%lf", elapsedTime[i][0]);
-				sprintf(bay_pump_runtime, "%lf", elapsedPumpTime);
-
-				const char *updateRuntimeParamValues[3] = {bay_timer_runtime, bay_pump_runtime, bay_string};
-		        PGresult *res = PQexecPrepared(conn, "UPDATE_BAY_STATUS_RUNTIME", 3, updateRuntimeParamValues, NULL, NULL, 0);
-		        if(pg_bad_result(res)) do_exit(conn, res);
-		        PQclear(res);
-			}
-
-			// HANDLE TIMER RELAY (INDEX 0)
-			if(digitalRead(bayPins[i][0]) == LOW && bayRunning[i][0] == false) {
-				if(bayTimerThresholds[i][0] < threshold) {
-					bayTimerThresholds[i][0]++;
-				} else {
-					bayTimerThresholds[i][0] = 0;
-					bayRunning[i][0] = true;
-					clock_gettime(CLOCK_MONOTONIC, &bayTimers[i][0]);
-
-					// update bay status
-					const char *updateParamValues[3] = {bayRunning[i][0] == true ? strue : sfalse, bayRunning[i][1] == true ? strue : sfalse, bay_string};
-			        PGresult *res = PQexecPrepared(conn, "UPDATE_BAY_STATUS", 3, updateParamValues, NULL, NULL, 0);
-			        if(pg_bad_result(res)) do_exit(conn, res);
-			        PQclear(res);
-				}
-			} else if(digitalRead(bayPins[i][0]) == HIGH && bayRunning[i][0] == true) {
-
-				if(bayTimerThresholds[i][1] < threshold) {
-					bayTimerThresholds[i][1]++;
-				} else {
-					bayTimerThresholds[i][1] = 0;
-					clock_gettime(CLOCK_MONOTONIC, &bayTimers[i][1]);
-					clock_gettime(CLOCK_MONOTONIC, &bayTimers[i][3]);
-					elapsedTime[i][0] = getElapsedTime(&bayTimers[i][0], &bayTimers[i][1], true);
-					elapsedTime[i][1] = getElapsedTime(&bayTimers[i][2], &bayTimers[i][3], false) + pumpSessionElapsedTime[i];
-					printf("BAY %d TIMER ELAPSED: %f seconds\n", (int)i + 1, elapsedTime[i][0]);
-					bayRunning[i][0] = false;
-					
-					if(elapsedTime[i][1] < 1) {
-						elapsedTime[i][1] = 0;
-					}
-
-					// record session
-					if(elapsedTime[i][0] > 0) {
-
-						sprintf(bay_session_timer_time, "%lf", elapsedTime[i][0]);
-						sprintf(bay_session_pump_time, "%lf", elapsedTime[i][1]);
-						const char *insertParamValues[3] = {bay_string, bay_session_timer_time, bay_session_pump_time};
-				        	PGresult *res = PQexecPrepared(conn, "BAY_SESSION_INSERT", 3, insertParamValues, NULL, NULL, 0);
-					        if(pg_bad_result(res)) do_exit(conn, res);
-			       			 PQclear(res);
-					}
-
-					// update bay status
-					const char *updateParamValues[3] = {bayRunning[i][0] == true ? strue : sfalse, bayRunning[i][1] == true ? strue : sfalse, bay_string};
-			        res = PQexecPrepared(conn, "UPDATE_BAY_STATUS", 3, updateParamValues, NULL, NULL, 0);
-			        if(pg_bad_result(res)) do_exit(conn, res);
-			        PQclear(res);
-
-		        	// update bay status timer_runtime
-					const char *updateRuntimeParamValues[3] = {"0", "0", bay_string};
-			        res = PQexecPrepared(conn, "UPDATE_BAY_STATUS_RUNTIME", 3, updateRuntimeParamValues, NULL, NULL, 0);
-			        if(pg_bad_result(res)) do_exit(conn, res);
-			        PQclear(res);
-				}
-			}
-
-			// HANDLE PUMP RELAY (INDEX 1)
-			if(digitalRead(bayPins[i][1]) == LOW && bayRunning[i][1] == false) {
-				if(bayTimerThresholds[i][2] < threshold) {
-					bayTimerThresholds[i][2]++;
-				} else {
-					bayTimerThresholds[i][2] = 0;
-					bayRunning[i][1] = true;
-					clock_gettime(CLOCK_MONOTONIC, &bayTimers[i][2]);
-
+		for(i = 0; i < config.bay_count; i++) {
 
-					// update bay status
-					const char *updateParamValues[3] = {bayRunning[i][0] == true ? strue : sfalse, bayRunning[i][1] == true ? strue : sfalse, bay_string};
-			        PGresult *res = PQexecPrepared(conn, "UPDATE_BAY_STATUS", 3, updateParamValues, NULL, NULL, 0);
-			        if(pg_bad_result(res)) do_exit(conn, res);
-			        PQclear(res);
-				}
-			} else if(digitalRead(bayPins[i][1]) == HIGH && bayRunning[i][1] == true) {
-
-				if(bayTimerThresholds[i][3] < threshold) {
-					bayTimerThresholds[i][3]++;
-				} else {
-					bayTimerThresholds[i][3] = 0;
-					clock_gettime(CLOCK_MONOTONIC, &bayTimers[i][3]);
-					elapsedTime[i][1] = getElapsedTime(&bayTimers[i][2], &bayTimers[i][3], false);
-					printf("BAY %d PUMP ELAPSED: %f seconds\n", (int)i + 1, elapsedTime[i][1]);
-					bayRunning[i][1] = false;
-
-					if(bayRunning[i][0] == false) {
-						pumpSessionElapsedTime[i] = 0;
-						elapsedTime[i][1] = 0;
-					} else {
-						pumpSessionElapsedTime[i] = pumpSessionElapsedTime[i] + elapsedTime[i][1];
-						bayTimers[i][2] = bayTimers[i][3];
-					}
-
-
-					// update bay status
-					const char *updateParamValues[3] = {bayRunning[i][0] == true ? strue : sfalse, bayRunning[i][1] == true ? strue : sfalse, bay_string};
-			        PGresult *res = PQexecPrepared(conn, "UPDATE_BAY_STATUS", 3, updateParamValues, NULL, NULL, 0);
-			        if(pg_bad_result(res)) do_exit(conn, res);
-			        PQclear(res);
-				}
+			if(bays.running[i][BAY_TIMER] && counter > COUNTER_MAX - 1) {
+				bay_runtime_update(i, &sample.time);
 			}
 
-			// HANDLE REMOTE INSERT COIN RELAY (INDEX 2)
-			// hehe nothing here
-
-			// HANDLE MAINTENANCE COIN INSERT (INDEX 3)
-			if(digitalRead(bayPins[i][3]) == LOW) {
-				bayInsertCounter[i] = 0;
-				bayInsertState[i] = false;
-			} else if(digitalRead(bayPins[i][3]) == HIGH) {
-				if(bayInsertState[i] == false) {
-					if(bayInsertCounter[i] < MAINTENANCE_THRESHOLD) {
-						bayInsertCounter[i]++;
-					} else {
-						bayInsertCounter[i] = 0;
-						bayInsertState[i] = true;
-						printf("Bay %d insert\n", i + 1);
-						// update bay status
-				        PGresult *res = PQexecPrepared(conn, "MAINTENANCE_INSERT", 1, (const char*[1]){bay_string}, NULL, NULL, 0);
-				        if(pg_bad_result(res)) do_exit(conn, res);
-				        PQclear(res);
-					}
-				}
-			}
+			// timer and pump relays (index 0, 1), maintenance coin insert (index 3)
+			struct bay_event events[BAY_MAX_EVENTS];
+			unsigned levels = (sample.levels >> BAY_SLOT(i, 0)) & ((1u << BAY_INPUTS) - 1);
+			bay_events(i, events, bay_step(&bays, i, levels, &sample.time, &windows, events));
 
 		} // end for loop
 
+		// everything this cycle produced goes to the database in one round trip
+		db_queue_flush();
+		stream_flush();
+
 		// handle reboot pin
-		if(digitalRead(REBOOT_PIN) == LOW) {
+		if(GPIO_LEVEL(&sample, REBOOT_SLOT) == GPIO_LOW) {
 			reboot_pin_counter++;
-		} else if(digitalRead(REBOOT_PIN) == HIGH) {
-			if(reboot_pin_counter > reboot_threshold && reboot_pin_counter < shutdown_threshold) {
-				system("shutdown -r now");
-			} else if(reboot_pin_counter > shutdown_threshold) {
-				system("shutdown now");
-			}
-			if(reboot_pin_counter > 0) {
+		} else if(GPIO_LEVEL(&sample, REBOOT_SLOT) == GPIO_HIGH) {
+			// a release that acted starts the hold over, the counter only decays while it is too short
+			if(hold_pin_released(REBOOT_SLOT, (double)reboot_pin_counter / sampleRate)) {
+				reboot_pin_counter = 0;
+			} else if(reboot_pin_counter > 0) {
 				reboot_pin_counter --;
 			}
 		}
 
 		// handle wipe pin
-		if(digitalRead(WIPE_PIN) == LOW) {
+		if(GPIO_LEVEL(&sample, WIPE_SLOT) == GPIO_LOW) {
 			wipe_pin_counter++;
-		} else if(digitalRead(WIPE_PIN) == HIGH) {
-			if(wipe_pin_counter > wipe_threshold) {
-				system("PGPASSWORD=cotton psql -U washman -d carwash -c 'DELETE FROM bay_sessions; DELETE FROM bay_maintenance_inserts;'");
-				system("shutdown -r now");
-			}
-			if(wipe_pin_counter > 0) {
+		} else if(GPIO_LEVEL(&sample, WIPE_SLOT) == GPIO_HIGH) {
+			if(hold_pin_released(WIPE_SLOT, (double)wipe_pin_counter / sampleRate)) {
+				wipe_pin_counter = 0;
+			} else if(wipe_pin_counter > 0) {
 				wipe_pin_counter --;
 			}
 		}
+		wipe_reboot_check();
 
-		nanosleep((const struct timespec[]){{0, 10000000L}}, NULL);
-	} // end while
+		if(benchLatencies != NULL) {
+			clock_gettime(CLOCK_MONOTONIC, &cycleEnd);
+			benchLatencies[benchCycle++] = getElapsedTime(&cycleStart, &cycleEnd, false);
+			if(benchCycle >= benchCycles) stopProgram = true;
+			continue;
+		}
+		if(replaying) {
+			replayCycles++;
+			continue;
+		}
 
-	PQfinish(conn);
+		// the cycle's work is done, the rest of the period is sleep
+		clock_gettime(CLOCK_MONOTONIC, &cycleEnd);
+		metrics_observe(&loopWork, timespec_ns(&cycleEnd) - timespec_ns(&wake));
+
+		if(realtimePriority > 0) {
+			// absolute deadlines never drift: a long cycle eats into the next sleep, not the schedule.
+			// a cycle that overran whole periods skips them rather than running back to back
+			int64_t next = timespec_ns(&deadline) + samplePeriod;
+			if(timespec_ns(&cycleEnd) >= next) {
+				int64_t behind = (timespec_ns(&cycleEnd) - next) / samplePeriod + 1;
+				loopMissed += behind;
+				next += behind * samplePeriod;
+			}
+			deadline.tv_sec = next / 1000000000;
+			deadline.tv_nsec = next % 1000000000;
+			while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR && stopProgram == false);
+		} else {
+			nanosleep((const struct timespec[]){{0, samplePeriod}}, NULL);
+			// where the next cycle should start, to measure how far the relative sleep drifts from it
+			deadline = wake;
+			deadline.tv_nsec += samplePeriod;
+			if(deadline.tv_nsec >= 1000000000L) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000L;
+			}
+		}
+	} // end while
 
-	// CLEANUP: pull down pins on exit
-	for(i = 0; i < 4; i++) {
-		pullUpDnControl(bayPins[i][0], PUD_DOWN);
-		pullUpDnControl(bayPins[i][1], PUD_DOWN);
-		pullUpDnControl(bayPins[i][2], PUD_DOWN);
-		pullUpDnControl(bayPins[i][3], PUD_DOWN);
+	if(benchLatencies != NULL && benchCycle > 0) {
+		clock_gettime(CLOCK_MONOTONIC, &benchEnd);
+		print_bench_report(gpio, benchLatencies, benchCycle, getElapsedTime(&benchStart, &benchEnd, false));
+	}
+	free(benchLatencies);
+
+	if(replaying) {
+		struct timespec replayEnd;
+		clock_gettime(CLOCK_MONOTONIC, &replayEnd);
+		double took = getElapsedTime(&replayStart, &replayEnd, false);
+		double recorded = replayCycles * (samplePeriod / 1e9);
+		printf("REPLAY: %ld cycles (%.1f s recorded) in %.3f s, %.0fx real time: %ld sessions, %ld inserts\n",
+			replayCycles, recorded, took, took > 0 ? recorded / took : 0, replayedSessions, replayedInserts);
+	} else {
+		// the forwarder reads the journal, the writer closes it
+		forward_stop();
+		db_writer_stop();
+		print_queue_stats();
+		if(!gpio->simulated || eventMode) print_commit_latency();
+		if(benchLatencies == NULL && !eventMode) print_loop_timing(samplePeriod);
+		status_destroy();
 	}
+	metrics_stop();
+	stream_close();
+	trace_close();
+	// the metrics endpoint read the rejection counters until it stopped
+	bay_table_free(&bays);
 
-	pullUpDnControl(REBOOT_PIN, PUD_DOWN);
-	pullUpDnControl(WIPE_PIN, PUD_DOWN);
+	// CLEANUP: pull down pins on exit
+	gpio->close_inputs();
+	gpio->teardown();
 
 	printf("FINISHED \n");
-	return 0;
+	return exitStatus;
 }
@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <libpq-fe.h>
+#include "schema.h"
+#include "dbwriter.h"
+
+static int setup_failed(PGconn *conn, PGresult *res) {
+	fprintf(stderr, "PG_ERROR: %s\n", PQerrorMessage(conn));
+	PQclear(res);
+	return -1;
+}
+
+static bool pg_bad_result(PGresult *res) {
+	return (PQresultStatus(res) != PGRES_COMMAND_OK) ? true : false;
+}
+
+static bool pg_bad_data(PGresult *res) {
+	return (PQresultStatus(res) != PGRES_TUPLES_OK) ? true : false;
+}
+
+// months past the current one that always have a partition waiting
+#define DB_PARTITIONS_AHEAD "2"
+
+/*
+	HISTORY PARTITIONS
+	bay_sessions and bay_maintenance_inserts are range partitioned by month
+	on timestamp, named <table>_YYYY_MM, with a BRIN index on timestamp
+	(rows arrive in time order, so a few pages of summary cover months).
+	a DEFAULT partition catches anything no month covers, so a late
+	partition never fails an insert.
+
+	a plain table left by an older monitor is renamed <table>_before and
+	attached as the partition for everything up to the end of its newest
+	month, all in one transaction. that is one scan of the old history,
+	once.
+
+	retiring a month is a DROP TABLE, which fires no triggers, so its rows
+	come off bay_totals first and listeners are told to reload.
+*/
+static const char *PARTITION_SETUP =
+	"CREATE OR REPLACE FUNCTION bay_partition_table(tbl TEXT, cols TEXT) RETURNS void AS $$ "
+	"DECLARE kind \"char\"; trig RECORD; bound TIMESTAMP; BEGIN "
+		"SELECT relkind INTO kind FROM pg_class WHERE oid = to_regclass(tbl); "
+		"IF kind = 'p' THEN RETURN; END IF; "
+		"EXECUTE format('CREATE SEQUENCE IF NOT EXISTS %I', tbl || '_id_seq'); "
+		"IF kind = 'r' THEN "
+			"EXECUTE format('LOCK TABLE %I IN ACCESS EXCLUSIVE MODE', tbl); "
+			"EXECUTE format('ALTER TABLE %I RENAME TO %I', tbl, tbl || '_before'); "
+			"EXECUTE format('ALTER TABLE %I DROP CONSTRAINT %I', tbl || '_before', tbl || '_pkey'); "
+			"EXECUTE format('UPDATE %I SET timestamp = ''-infinity'' WHERE timestamp IS NULL', tbl || '_before'); "
+			"EXECUTE format('ALTER TABLE %I ALTER COLUMN timestamp SET NOT NULL', tbl || '_before'); "
+			// the parent's triggers are cloned onto it when it is attached
+			"FOR trig IN SELECT tgname FROM pg_trigger WHERE tgrelid = to_regclass(tbl || '_before') AND NOT tgisinternal LOOP "
+				"EXECUTE format('DROP TRIGGER %I ON %I', trig.tgname, tbl || '_before'); "
+			"END LOOP; "
+			"EXECUTE format('SELECT GREATEST(date_trunc(''month'', MAX(timestamp)), date_trunc(''month'', localtimestamp)) + interval ''1 month'' FROM %I', tbl || '_before') INTO bound; "
+		"END IF; "
+		"EXECUTE format('CREATE TABLE %I (id BIGINT NOT NULL DEFAULT nextval(%L), %s, timestamp TIMESTAMP NOT NULL DEFAULT current_timestamp, "
+			"PRIMARY KEY (id, timestamp)) PARTITION BY RANGE (timestamp)', tbl, tbl || '_id_seq', cols); "
+		// owned by the parent, so dropping the old table never takes the sequence with it
+		"EXECUTE format('ALTER SEQUENCE %I OWNED BY %I.id', tbl || '_id_seq', tbl); "
+		"EXECUTE format('CREATE INDEX %I ON %I USING brin (timestamp)', tbl || '_timestamp_brin', tbl); "
+		"EXECUTE format('CREATE TABLE %I PARTITION OF %I DEFAULT', tbl || '_default', tbl); "
+		"IF kind = 'r' THEN "
+			"EXECUTE format('ALTER TABLE %I ATTACH PARTITION %I FOR VALUES FROM (MINVALUE) TO (%L)', tbl, tbl || '_before', bound); "
+		"END IF; "
+	"END $$ LANGUAGE plpgsql;"
+	// partitions for this month and the next ahead ones, returns how many were made
+	"CREATE OR REPLACE FUNCTION bay_partitions_ensure(ahead INT) RETURNS INT AS $$ "
+	"DECLARE tbl TEXT; first_day TIMESTAMP; made INT := 0; BEGIN "
+		"FOREACH tbl IN ARRAY ARRAY['bay_sessions', 'bay_maintenance_inserts'] LOOP "
+			"FOR i IN 0..ahead LOOP "
+				"first_day := date_trunc('month', localtimestamp) + make_interval(months => i); "
+				"CONTINUE WHEN to_regclass(tbl || to_char(first_day, '\"_\"YYYY\"_\"MM')) IS NOT NULL; "
+				"BEGIN "
+					"EXECUTE format('CREATE TABLE %I PARTITION OF %I FOR VALUES FROM (%L) TO (%L)', "
+						"tbl || to_char(first_day, '\"_\"YYYY\"_\"MM'), tbl, first_day, first_day + interval '1 month'); "
+					"made := made + 1; "
+				// still inside the old history, or rows for it already went to the default partition
+				"EXCEPTION WHEN invalid_object_definition OR check_violation THEN NULL; "
+				"END; "
+			"END LOOP; "
+		"END LOOP; "
+		"RETURN made; "
+	"END $$ LANGUAGE plpgsql;"
+	// drop every month that ended keep whole months before this one, returns how many went
+	"CREATE OR REPLACE FUNCTION bay_partitions_retire(keep INT) RETURNS INT AS $$ "
+	"DECLARE part RECORD; ends TIMESTAMP; dropped INT := 0; "
+		"cutoff TIMESTAMP := date_trunc('month', localtimestamp) - make_interval(months => keep); BEGIN "
+		"FOR part IN SELECT c.relname, p.relname AS parent, pg_get_expr(c.relpartbound, c.oid) AS bound "
+			"FROM pg_inherits i JOIN pg_class c ON c.oid = i.inhrelid JOIN pg_class p ON p.oid = i.inhparent "
+			"WHERE p.relname IN ('bay_sessions', 'bay_maintenance_inserts') LOOP "
+			// FOR VALUES FROM (...) TO ('2024-05-01 00:00:00'), the default partition has no bounds
+			"ends := substring(part.bound FROM 'TO \\(''([^'']+)''\\)')::timestamp; "
+			"CONTINUE WHEN ends IS NULL OR ends > cutoff; "
+			"EXECUTE format('LOCK TABLE %I IN ACCESS EXCLUSIVE MODE', part.relname); "
+			"IF part.parent = 'bay_sessions' THEN "
+				"EXECUTE format('UPDATE bay_totals t SET timer_time = t.timer_time - o.timer_time, pump_time = t.pump_time - o.pump_time, sessions = t.sessions - o.sessions "
+					"FROM (SELECT bay, COALESCE(SUM(timer_time), 0) AS timer_time, COALESCE(SUM(pump_time), 0) AS pump_time, COUNT(*) AS sessions FROM %I GROUP BY bay) o "
+					"WHERE t.bay = o.bay', part.relname); "
+			"ELSE "
+				"EXECUTE format('UPDATE bay_totals t SET maintenance_inserts = t.maintenance_inserts - o.inserts "
+					"FROM (SELECT bay, COUNT(*) AS inserts FROM %I GROUP BY bay) o WHERE t.bay = o.bay', part.relname); "
+			"END IF; "
+			"EXECUTE format('DROP TABLE %I', part.relname); "
+			"dropped := dropped + 1; "
+		"END LOOP; "
+		"IF dropped > 0 THEN PERFORM pg_notify('" DB_NOTIFY_CHANNEL "', 'r'); END IF; "
+		"RETURN dropped; "
+	"END $$ LANGUAGE plpgsql;";
+
+static const char *BAY_TOTALS_SETUP =
+	"LOCK TABLE bay_sessions, bay_maintenance_inserts IN SHARE ROW EXCLUSIVE MODE;"
+	"CREATE TABLE IF NOT EXISTS bay_totals (bay INT NOT NULL, timer_time NUMERIC(16,2) NOT NULL DEFAULT 0, pump_time NUMERIC(16,2) NOT NULL DEFAULT 0, "
+		"sessions BIGINT NOT NULL DEFAULT 0, maintenance_inserts BIGINT NOT NULL DEFAULT 0, PRIMARY KEY (bay));"
+	"CREATE OR REPLACE FUNCTION bay_totals_sessions() RETURNS trigger AS $$ BEGIN "
+		"IF TG_OP IN ('UPDATE', 'DELETE') THEN "
+			"UPDATE bay_totals SET timer_time = timer_time - COALESCE(OLD.timer_time, 0), pump_time = pump_time - COALESCE(OLD.pump_time, 0), "
+			"sessions = sessions - 1 WHERE bay = OLD.bay; "
+		"END IF; "
+		"IF TG_OP IN ('INSERT', 'UPDATE') THEN "
+			"INSERT INTO bay_totals (bay, timer_time, pump_time, sessions) VALUES (NEW.bay, COALESCE(NEW.timer_time, 0), COALESCE(NEW.pump_time, 0), 1) "
+			"ON CONFLICT (bay) DO UPDATE SET timer_time = bay_totals.timer_time + EXCLUDED.timer_time, "
+			"pump_time = bay_totals.pump_time + EXCLUDED.pump_time, sessions = bay_totals.sessions + 1; "
+		"END IF; "
+		"RETURN NULL; "
+	"END $$ LANGUAGE plpgsql;"
+	"CREATE OR REPLACE FUNCTION bay_totals_inserts() RETURNS trigger AS $$ BEGIN "
+		"IF TG_OP IN ('UPDATE', 'DELETE') THEN "
+			"UPDATE bay_totals SET maintenance_inserts = maintenance_inserts - 1 WHERE bay = OLD.bay; "
+		"END IF; "
+		"IF TG_OP IN ('INSERT', 'UPDATE') THEN "
+			"INSERT INTO bay_totals (bay, maintenance_inserts) VALUES (NEW.bay, 1) "
+			"ON CONFLICT (bay) DO UPDATE SET maintenance_inserts = bay_totals.maintenance_inserts + 1; "
+		"END IF; "
+		"RETURN NULL; "
+	"END $$ LANGUAGE plpgsql;"
+	"CREATE OR REPLACE FUNCTION bay_totals_truncate() RETURNS trigger AS $$ BEGIN "
+		"IF TG_TABLE_NAME = 'bay_sessions' THEN "
+			"UPDATE bay_totals SET timer_time = 0, pump_time = 0, sessions = 0; "
+		"ELSE "
+			"UPDATE bay_totals SET maintenance_inserts = 0; "
+		"END IF; "
+		"RETURN NULL; "
+	"END $$ LANGUAGE plpgsql;"
+	// triggers are recreated rather than CREATE OR REPLACE, which needs postgres 14
+	"DROP TRIGGER IF EXISTS bay_totals_sessions ON bay_sessions;"
+	"CREATE TRIGGER bay_totals_sessions AFTER INSERT OR UPDATE OR DELETE ON bay_sessions FOR EACH ROW EXECUTE PROCEDURE bay_totals_sessions();"
+	"DROP TRIGGER IF EXISTS bay_totals_sessions_truncate ON bay_sessions;"
+	"CREATE TRIGGER bay_totals_sessions_truncate AFTER TRUNCATE ON bay_sessions FOR EACH STATEMENT EXECUTE PROCEDURE bay_totals_truncate();"
+	"DROP TRIGGER IF EXISTS bay_totals_inserts ON bay_maintenance_inserts;"
+	"CREATE TRIGGER bay_totals_inserts AFTER INSERT OR UPDATE OR DELETE ON bay_maintenance_inserts FOR EACH ROW EXECUTE PROCEDURE bay_totals_inserts();"
+	"DROP TRIGGER IF EXISTS bay_totals_inserts_truncate ON bay_maintenance_inserts;"
+	"CREATE TRIGGER bay_totals_inserts_truncate AFTER TRUNCATE ON bay_maintenance_inserts FOR EACH STATEMENT EXECUTE PROCEDURE bay_totals_truncate();"
+	// an empty table has never been seeded (an empty history seeds nothing, which is also right)
+	"INSERT INTO bay_totals (bay, timer_time, pump_time, sessions, maintenance_inserts) "
+		BAY_TOTALS_RECOMPUTE " WHERE NOT EXISTS (SELECT 1 FROM bay_totals);";
+
+int db_setup_schema(PGconn *conn, int bayCount, bool statusTable) {
+	PGresult *res;
+	char bay_count_string[12];
+	sprintf(bay_count_string, "%d", bayCount);
+	const char *params[1] = {bay_count_string};
+
+	if(statusTable) {
+		/*
+			create the bay status table. it is rewritten all day and rebuilt
+			on every connection, so it skips the WAL (UNLOGGED, emptied by a
+			crash) and leaves half of each page free, so updates stay HOT on
+			the page and vacuum has little to do. an older logged table is
+			converted once, the rewrite applies the fillfactor
+		*/
+		res = PQexec(conn,
+			"CREATE UNLOGGED TABLE IF NOT EXISTS bay_status (bay INT NOT NULL, timer_running BOOLEAN NOT NULL DEFAULT FALSE, pump_running BOOLEAN NOT NULL DEFAULT FALSE, "
+				"timer_runtime NUMERIC(12, 2) NOT NULL DEFAULT 0, pump_runtime NUMERIC(12, 2) NOT NULL DEFAULT 0, PRIMARY KEY (bay)) WITH (fillfactor = 50);"
+			"DO $$ BEGIN "
+				"IF (SELECT relpersistence FROM pg_class WHERE oid = 'bay_status'::regclass) = 'p' THEN "
+					"ALTER TABLE bay_status SET (fillfactor = 50); "
+					"ALTER TABLE bay_status SET UNLOGGED; "
+				"END IF; "
+			"END $$;");
+		if(pg_bad_result(res)) return setup_failed(conn, res);
+		PQclear(res);
+
+		// create the bay status entries, every configured bay in one statement
+		res = PQexecParams(conn, "INSERT INTO bay_status (bay, timer_running, pump_running) SELECT generate_series(1, $1::int), false, false ON CONFLICT (bay) DO NOTHING;", 1, NULL, params, NULL, NULL, 0);
+		if(pg_bad_result(res)) {
+			printf("\nCould not create bay statuses\n");
+			return setup_failed(conn, res);
+		}
+		PQclear(res);
+
+		// set all statuses to false
+		res = PQexec(conn, "UPDATE bay_status SET timer_running = false, pump_running = false;");
+		if(pg_bad_result(res)) return setup_failed(conn, res);
+		PQclear(res);
+	}
+
+
+	// monthly partitions of the session and insert history, a plain table from before is moved in whole
+	res = PQexec(conn, PARTITION_SETUP);
+	if(pg_bad_result(res)) {
+		printf("\nCould not partition the history tables\n");
+		return setup_failed(conn, res);
+	}
+	PQclear(res);
+	res = PQexec(conn,
+		"SELECT bay_partition_table('bay_sessions', 'bay INT NOT NULL, timer_time NUMERIC(14,2), pump_time NUMERIC(14,2)'), "
+		"bay_partition_table('bay_maintenance_inserts', 'bay INT NOT NULL'), "
+		"bay_partitions_ensure(" DB_PARTITIONS_AHEAD ");");
+	if(pg_bad_data(res)) {
+		printf("\nCould not partition the history tables\n");
+		return setup_failed(conn, res);
+	}
+	PQclear(res);
+
+	// timestamp is when a session ended, started_at when it started (NULL for sessions from before it was kept)
+	res = PQexec(conn, "ALTER TABLE bay_sessions ADD COLUMN IF NOT EXISTS started_at TIMESTAMP;");
+	if(pg_bad_result(res)) return setup_failed(conn, res);
+	PQclear(res);
+
+	// running totals per bay, kept by triggers in the same transaction as every insert
+	res = PQexec(conn, BAY_TOTALS_SETUP);
+	if(pg_bad_result(res)) {
+		printf("\nCould not set up bay totals\n");
+		return setup_failed(conn, res);
+	}
+	PQclear(res);
+	res = PQexecParams(conn, "INSERT INTO bay_totals (bay) SELECT generate_series(1, $1::int) ON CONFLICT (bay) DO NOTHING;", 1, NULL, params, NULL, NULL, 0);
+	if(pg_bad_result(res)) return setup_failed(conn, res);
+	PQclear(res);
+
+	// how far each journal file has been applied, moved in the same transaction as its inserts
+	res = PQexec(conn, "CREATE TABLE IF NOT EXISTS monitor_journal (journal_id BIGINT NOT NULL, applied_seq BIGINT NOT NULL DEFAULT 0, PRIMARY KEY (journal_id));");
+	if(pg_bad_result(res)) return setup_failed(conn, res);
+	PQclear(res);
+	return 0;
+}
+
+int db_maintain_partitions(PGconn *conn, int retentionMonths) {
+	char keep_string[12];
+	sprintf(keep_string, "%d", retentionMonths);
+	const char *params[1] = {keep_string};
+	PGresult *res = PQexecParams(conn,
+		"SELECT bay_partitions_ensure(" DB_PARTITIONS_AHEAD "), CASE WHEN $1::int > 0 THEN bay_partitions_retire($1::int) ELSE 0 END;",
+		1, NULL, params, NULL, NULL, 0);
+	if(pg_bad_data(res) || PQntuples(res) != 1) return setup_failed(conn, res);
+	int made = atoi(PQgetvalue(res, 0, 0));
+	int retired = atoi(PQgetvalue(res, 0, 1));
+	PQclear(res);
+	if(made > 0) printf("DB: created %d history partitions\n", made);
+	if(retired > 0) printf("DB: dropped %d history partitions older than %d months\n", retired, retentionMonths);
+	return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef CARWASH_SCHEMA_H
+#define CARWASH_SCHEMA_H
+
+#include <stdbool.h>
+#include <libpq-fe.h>
+
+/*
+	DATABASE SCHEMA
+	every table the monitor writes, created if missing. the writer thread
+	runs this on each new connection, so it has to be safe to repeat.
+	cw-loadgen sets up its scratch database with the same statements.
+	bay_sessions and bay_maintenance_inserts are partitioned by month,
+	which needs postgres 11 or newer.
+*/
+
+/*
+	BAY TOTALS
+	the gui reads one row per bay instead of summing the whole history.
+	triggers keep bay_totals in step with bay_sessions and
+	bay_maintenance_inserts, so every insert (replays and manual fixes
+	included) moves the totals in its own transaction, and a wipe by
+	TRUNCATE zeroes them. the first setup seeds the table from history
+	while both tables are locked against writes.
+*/
+#define BAY_TOTALS_RECOMPUTE \
+	"SELECT COALESCE(s.bay, m.bay) AS bay, COALESCE(s.timer_time, 0) AS timer_time, COALESCE(s.pump_time, 0) AS pump_time, " \
+	"COALESCE(s.sessions, 0) AS sessions, COALESCE(m.maintenance_inserts, 0) AS maintenance_inserts " \
+	"FROM (SELECT bay, SUM(timer_time) AS timer_time, SUM(pump_time) AS pump_time, COUNT(*) AS sessions FROM bay_sessions GROUP BY bay) s " \
+	"FULL JOIN (SELECT bay, COUNT(*) AS maintenance_inserts FROM bay_maintenance_inserts GROUP BY bay) m ON s.bay = m.bay"
+
+/*
+	create what is missing for bayCount bays. bay_status only when the
+	monitor keeps it (-t). returns -1 (and prints why) on any failure, the
+	writer tries again on its next connection
+*/
+int db_setup_schema(PGconn *conn, int bayCount, bool statusTable);
+/*
+	create the coming months' history partitions and, with retentionMonths
+	above 0, drop the ones that ended more than that many whole months ago.
+	the writer runs it hourly, so a monitor left up for months keeps going
+*/
+int db_maintain_partitions(PGconn *conn, int retentionMonths);
+
+#endif
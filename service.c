@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "service.h"
+
+int service_thread_start(const char *who, pthread_t *thread, void *(*threadMain)(void *), void *arg) {
+	// the new thread inherits the mask it is created with, everything blocked
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	int err = pthread_create(thread, NULL, threadMain, arg);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if(err != 0) {
+		fprintf(stderr, "%s: could not start thread: %s\n", who, strerror(err));
+		return -1;
+	}
+	return 0;
+}
+
+int service_listen_tcp(const char *who, const char *address, const char *defaultHost, int backlog) {
+	char host[256];
+	const char *port = address;
+	const char *colon = strrchr(address, ':');
+	if(colon != NULL) {
+		snprintf(host, sizeof(host), "%.*s", (int)(colon - address), address);
+		port = colon + 1;
+	} else {
+		snprintf(host, sizeof(host), "%s", defaultHost);
+	}
+
+	struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE | AI_NUMERICSERV};
+	struct addrinfo *found;
+	int err = getaddrinfo(host, port, &hints, &found);
+	if(err != 0) {
+		fprintf(stderr, "%s: %s: %s\n", who, address, gai_strerror(err));
+		return -1;
+	}
+	int fd = socket(found->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	int one = 1;
+	if(fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if(fd < 0 || bind(fd, found->ai_addr, found->ai_addrlen) < 0 || listen(fd, backlog) < 0) {
+		fprintf(stderr, "%s: could not listen on %s: %s\n", who, address, strerror(errno));
+		if(fd >= 0) close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(found);
+	return fd;
+}
+
+int service_listen_unix(const char *who, const char *path, int backlog) {
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if(strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: socket path too long: %s\n", who, path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	// a monitor that crashed leaves its socket behind, it is simply taken over
+	if(fd >= 0) unlink(path);
+	if(fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, backlog) < 0) {
+		fprintf(stderr, "%s: could not listen on %s: %s\n", who, path, strerror(errno));
+		if(fd >= 0) close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int service_send_all(int fd, const void *data, size_t length, int timeoutMs, int stopFd) {
+	const char *next = data;
+	while(length > 0) {
+		struct pollfd pfds[2] = {{fd, POLLOUT, 0}, {stopFd, POLLIN, 0}};
+		int n = poll(pfds, stopFd >= 0 ? 2 : 1, timeoutMs);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0 || (pfds[1].revents & POLLIN)) return -1;
+		ssize_t sent = send(fd, next, length, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if(sent < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+		if(sent <= 0) return -1;
+		next += sent;
+		length -= sent;
+	}
+	return 0;
+}
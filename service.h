@@ -0,0 +1,39 @@
+#ifndef CARWASH_SERVICE_H
+#define CARWASH_SERVICE_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+	BACKGROUND SERVICES
+	what the monitor's threads (database writer, metrics, event stream,
+	forwarder) and the stand-alone servers (cw-web, cw-collector) all need:
+	a thread started the same way, listening sockets set up the same way
+	and a send that cannot hang on a peer that stopped reading.
+
+	every failure is printed with who in front (METRICS, WEB, ...) and
+	returned as -1.
+*/
+
+/*
+	start a thread that never sees a signal: SIGINT, SIGUSR1 and SIGUSR2
+	are for the sampling loop and must land there
+*/
+int service_thread_start(const char *who, pthread_t *thread, void *(*threadMain)(void *), void *arg);
+
+/*
+	a non-blocking listening TCP socket on [host:]port, host defaults to
+	defaultHost. SO_REUSEADDR, so a restart does not wait out TIME_WAIT
+*/
+int service_listen_tcp(const char *who, const char *address, const char *defaultHost, int backlog);
+// the same on a unix socket path
+int service_listen_unix(const char *who, const char *path, int backlog);
+
+/*
+	send all of data, waiting at most timeoutMs each time the socket is
+	full. with stopFd >= 0, stopFd becoming readable gives up as well.
+	0 once everything is sent, -1 otherwise
+*/
+int service_send_all(int fd, const void *data, size_t length, int timeoutMs, int stopFd);
+
+#endif
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "status.h"
+
+// torn copies a reader retries before it gives up on the segment
+#define STATUS_READ_TRIES 100000
+
+static struct status_segment *published = NULL;
+
+int status_create(int bayCount) {
+	// no O_EXCL: the segment of a monitor that died is reused, every field is rewritten below
+	int fd = shm_open(STATUS_SHM_NAME, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if(fd < 0) {
+		fprintf(stderr, "STATUS: could not open %s: %s\n", STATUS_SHM_NAME, strerror(errno));
+		return -1;
+	}
+	if(ftruncate(fd, sizeof(struct status_segment)) < 0) {
+		fprintf(stderr, "STATUS: could not size %s: %s\n", STATUS_SHM_NAME, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	void *map = mmap(NULL, sizeof(struct status_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) {
+		fprintf(stderr, "STATUS: could not map %s: %s\n", STATUS_SHM_NAME, strerror(errno));
+		return -1;
+	}
+	published = map;
+
+	// hide the segment from readers while it is rebuilt, the magic goes in last
+	atomic_store_explicit(&published->seq, atomic_load_explicit(&published->seq, memory_order_relaxed) | 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	memset(published->magic, 0, sizeof(published->magic));
+	published->version = STATUS_VERSION;
+	published->bay_count = bayCount;
+	published->pid = getpid();
+	memset(published->bays, 0, sizeof(published->bays));
+	memcpy(published->magic, STATUS_MAGIC, sizeof(published->magic));
+	atomic_store_explicit(&published->seq, (atomic_load_explicit(&published->seq, memory_order_relaxed) | 1) + 1, memory_order_release);
+	return 0;
+}
+
+void status_publish(int bay, bool timerRunning, bool pumpRunning, double timerTime, double pumpTime, int64_t now_ns) {
+	if(published == NULL) return;
+	uint32_t seq = atomic_load_explicit(&published->seq, memory_order_relaxed);
+	atomic_store_explicit(&published->seq, seq + 1, memory_order_relaxed);
+	// readers that see any of the writes below also see seq odd
+	atomic_thread_fence(memory_order_release);
+
+	struct status_bay *b = &published->bays[bay];
+	b->timer_running = timerRunning;
+	b->pump_running = pumpRunning;
+	b->changes++;
+	b->timer_started_ns = now_ns - (int64_t)(timerTime * 1e9);
+	b->pump_started_ns = now_ns - (int64_t)(pumpTime * 1e9);
+	b->timer_time = timerTime;
+	b->pump_time = pumpTime;
+
+	atomic_store_explicit(&published->seq, seq + 2, memory_order_release);
+}
+
+void status_destroy(void) {
+	if(published == NULL) return;
+	uint32_t seq = atomic_load_explicit(&published->seq, memory_order_relaxed);
+	atomic_store_explicit(&published->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	published->pid = 0;
+	atomic_store_explicit(&published->seq, seq + 2, memory_order_release);
+
+	munmap(published, sizeof(struct status_segment));
+	published = NULL;
+	shm_unlink(STATUS_SHM_NAME);
+}
+
+const struct status_segment *status_attach(void) {
+	int fd = shm_open(STATUS_SHM_NAME, O_RDONLY | O_CLOEXEC, 0);
+	if(fd < 0) return NULL;
+	struct stat st;
+	if(fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct status_segment)) {
+		close(fd);
+		return NULL;
+	}
+	const struct status_segment *segment = mmap(NULL, sizeof(struct status_segment), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(segment == MAP_FAILED) return NULL;
+	if(memcmp(segment->magic, STATUS_MAGIC, sizeof(segment->magic)) != 0 || segment->version != STATUS_VERSION) {
+		status_detach(segment);
+		return NULL;
+	}
+	return segment;
+}
+
+void status_detach(const struct status_segment *segment) {
+	munmap((void *)segment, sizeof(struct status_segment));
+}
+
+bool status_read(const struct status_segment *segment, struct status_bay *bays, int *bayCount) {
+	int32_t pid;
+	uint32_t before, after;
+	int tries = 0;
+	do {
+		// an update takes nanoseconds, a seq that stays odd this long is a monitor killed halfway through one
+		if(tries++ == STATUS_READ_TRIES) return false;
+		before = atomic_load_explicit(&((struct status_segment *)segment)->seq, memory_order_acquire);
+		if(before & 1) continue;
+		pid = segment->pid;
+		*bayCount = segment->bay_count;
+		memcpy(bays, segment->bays, sizeof(segment->bays));
+		// the copy has to be done before seq is looked at again
+		atomic_thread_fence(memory_order_acquire);
+		after = atomic_load_explicit(&((struct status_segment *)segment)->seq, memory_order_relaxed);
+	} while((before & 1) || before != after);
+
+	if(*bayCount > CONFIG_MAX_BAYS) *bayCount = CONFIG_MAX_BAYS;
+	return pid != 0;
+}
+
+bool status_alive(const struct status_segment *segment) {
+	int32_t pid = segment->pid;
+	// EPERM: alive, just not ours to signal
+	return pid != 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+double status_timer_runtime(const struct status_bay *bay, int64_t now_ns) {
+	if(!bay->timer_running) return bay->timer_time;
+	return (double)(now_ns - bay->timer_started_ns) / 1e9;
+}
+
+double status_pump_runtime(const struct status_bay *bay, int64_t now_ns) {
+	if(!bay->pump_running) return bay->pump_time;
+	return (double)(now_ns - bay->pump_started_ns) / 1e9;
+}
+
+int64_t status_now_ns(void) {
+	struct timespec ts;
+	// vdso, no syscall
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
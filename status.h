@@ -0,0 +1,70 @@
+#ifndef CARWASH_STATUS_H
+#define CARWASH_STATUS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "config.h"
+
+/*
+	LIVE STATUS SEGMENT
+	the monitor publishes what every bay is doing right now in a POSIX
+	shared memory segment. local readers (the gui) map it read only and
+	copy it out without a syscall or a database round trip; postgres only
+	sees the durable session data.
+
+	the segment is one writer, many readers, guarded by a seqlock: the
+	writer makes seq odd, changes the bays and makes it even again. a reader
+	copies everything between two reads of seq and retries if the copy was
+	torn (seq odd or changed). readers never block the monitor.
+
+	clocks are not pushed every refresh: a running bay carries the
+	CLOCK_MONOTONIC time its session started from, and readers run it on
+	themselves. CLOCK_MONOTONIC is the same for every process on the box.
+*/
+
+#define STATUS_SHM_NAME "/carwash-status"
+#define STATUS_MAGIC "CWSTATUS"
+// bump when the layout below changes, readers refuse other versions
+#define STATUS_VERSION 1
+
+struct status_bay {
+	bool timer_running;
+	bool pump_running;
+	uint32_t changes;               // status changes published for this bay
+	int64_t timer_started_ns;       // while the timer runs: CLOCK_MONOTONIC it counts from
+	int64_t pump_started_ns;        // while the pump runs: the session's pump time counts from here
+	double timer_time;              // session so far at the last change, what shows while stopped
+	double pump_time;
+};
+
+struct status_segment {
+	char magic[8];
+	uint32_t version;
+	uint32_t bay_count;
+	int32_t pid;                    // the publishing monitor, 0 once it has shut down
+	_Atomic uint32_t seq;           // odd while the writer is in the middle of an update
+	struct status_bay bays[CONFIG_MAX_BAYS];
+};
+
+// WRITER: the monitor only
+int status_create(int bayCount);
+// publish one bay, now_ns is CLOCK_MONOTONIC the times were taken at
+void status_publish(int bay, bool timerRunning, bool pumpRunning, double timerTime, double pumpTime, int64_t now_ns);
+// unmap and remove the segment, readers see the monitor go away
+void status_destroy(void);
+
+// READERS: NULL when there is no segment (yet) or it is a layout we do not know
+const struct status_segment *status_attach(void);
+void status_detach(const struct status_segment *segment);
+// consistent copy of the bays without a syscall, false once the monitor has shut down
+// or when it died in the middle of an update and the copy never settles
+bool status_read(const struct status_segment *segment, struct status_bay *bays, int *bayCount);
+// one kill(pid, 0): catches a monitor that died without taking the segment down
+bool status_alive(const struct status_segment *segment);
+// what a bay's clocks read at now_ns
+double status_timer_runtime(const struct status_bay *bay, int64_t now_ns);
+double status_pump_runtime(const struct status_bay *bay, int64_t now_ns);
+int64_t status_now_ns(void);
+
+#endif
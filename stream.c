@@ -0,0 +1,249 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "stream.h"
+#include "service.h"
+#include "metrics.h"
+
+/*
+	LAYOUT: record seq lives in slot seq % STREAM_RING_SIZE
+	one producer (the sampling loop), read by the publisher thread only.
+	the producer never looks at the readers and simply writes over the
+	oldest record, so a copy taken while head - seq >= STREAM_RING_SIZE may
+	be torn and is thrown away, the same idea as the status seqlock
+*/
+// must be a power of two
+#define STREAM_RING_SIZE 4096
+#define STREAM_RING_MASK (STREAM_RING_SIZE - 1)
+static struct stream_record ring[STREAM_RING_SIZE];
+// the next seq to publish, only written by the producer
+static _Atomic uint64_t head = 0;
+
+static bool streaming = false;
+// producer only: something was published since the last flush
+static bool unflushed = false;
+static int wakeFd = -1;
+static int listenFd = -1;
+static char socketPath[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static int streamBays = 0;
+static pthread_t publisherThread;
+static atomic_bool stopping = false;
+
+static _Atomic uint64_t subscriberCount = 0;
+static _Atomic uint64_t skipped = 0;
+static _Atomic uint64_t droppedSubscribers = 0;
+
+/*
+	LAYOUT: one slot per connected subscriber, fd -1 when free
+	cursor is the next seq it gets, out holds whole records copied from
+	the ring that the socket has not taken yet (sent bytes of outLength)
+*/
+#define STREAM_MAX_SUBSCRIBERS 16
+#define STREAM_BATCH 64
+struct subscriber {
+	int fd;
+	uint64_t cursor;
+	struct stream_record out[STREAM_BATCH];
+	size_t outLength;
+	size_t sent;
+};
+static struct subscriber subscribers[STREAM_MAX_SUBSCRIBERS];
+
+void stream_publish(struct stream_record *record) {
+	if(!streaming) return;
+	uint64_t h = atomic_load_explicit(&head, memory_order_relaxed);
+	record->seq = h;
+	ring[h & STREAM_RING_MASK] = *record;
+	atomic_store_explicit(&head, h + 1, memory_order_release);
+	unflushed = true;
+}
+
+void stream_flush(void) {
+	if(!unflushed) return;
+	unflushed = false;
+	// an eventfd write only adds to a counter, it never blocks
+	uint64_t one = 1;
+	if(write(wakeFd, &one, sizeof(one)) < 0) unflushed = true;
+}
+
+static void drop(struct subscriber *s) {
+	close(s->fd);
+	s->fd = -1;
+	atomic_fetch_sub(&subscriberCount, 1);
+}
+
+// fill out with the next records from the ring, skipping ahead if the producer lapped the cursor
+static void refill(struct subscriber *s) {
+	uint64_t h = atomic_load_explicit(&head, memory_order_acquire);
+	if(h - s->cursor > STREAM_RING_SIZE) {
+		atomic_fetch_add_explicit(&skipped, h - s->cursor - STREAM_RING_SIZE, memory_order_relaxed);
+		s->cursor = h - STREAM_RING_SIZE;
+	}
+	uint64_t n = h - s->cursor;
+	if(n > STREAM_BATCH) n = STREAM_BATCH;
+	uint64_t i;
+	for(i = 0; i < n; i++) s->out[i] = ring[(s->cursor + i) & STREAM_RING_MASK];
+
+	// anything the producer may have been writing over while it was copied is gone
+	atomic_thread_fence(memory_order_acquire);
+	uint64_t now = atomic_load_explicit(&head, memory_order_relaxed);
+	uint64_t torn = 0;
+	if(now - s->cursor >= STREAM_RING_SIZE) torn = now - s->cursor - STREAM_RING_SIZE + 1;
+	if(torn >= n) {
+		// the whole copy, start over from the oldest that is safe
+		atomic_fetch_add_explicit(&skipped, torn, memory_order_relaxed);
+		s->cursor += torn;
+		s->outLength = 0;
+		s->sent = 0;
+		return;
+	}
+	if(torn > 0) {
+		atomic_fetch_add_explicit(&skipped, torn, memory_order_relaxed);
+		memmove(s->out, s->out + torn, (n - torn) * sizeof(s->out[0]));
+	}
+	s->cursor += n;
+	s->outLength = (n - torn) * sizeof(s->out[0]);
+	s->sent = 0;
+}
+
+// send what the subscriber can take without blocking. -1 when it has to go
+static int pump(struct subscriber *s) {
+	for(;;) {
+		if(s->sent == s->outLength) {
+			refill(s);
+			if(s->outLength == 0) return 0;
+		}
+		ssize_t n = send(s->fd, (char *)s->out + s->sent, s->outLength - s->sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if(n < 0) return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+		s->sent += n;
+		if(s->sent < s->outLength) return 0;
+	}
+}
+
+static void accept_subscriber(void) {
+	int fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if(fd < 0) return;
+	int i;
+	for(i = 0; i < STREAM_MAX_SUBSCRIBERS && subscribers[i].fd >= 0; i++);
+	if(i == STREAM_MAX_SUBSCRIBERS) {
+		close(fd);
+		atomic_fetch_add(&droppedSubscribers, 1);
+		return;
+	}
+	struct subscriber *s = &subscribers[i];
+	s->fd = fd;
+	s->cursor = atomic_load_explicit(&head, memory_order_acquire);
+	memset(&s->out[0], 0, sizeof(s->out[0]));
+	s->out[0].kind = STREAM_HELLO;
+	s->out[0].seq = s->cursor;
+	s->out[0].bay = streamBays;
+	s->out[0].timer_ms = STREAM_VERSION;
+	s->outLength = sizeof(s->out[0]);
+	s->sent = 0;
+	atomic_fetch_add(&subscriberCount, 1);
+}
+
+static void *publisher_main(void *arg) {
+	struct pollfd pfds[2 + STREAM_MAX_SUBSCRIBERS];
+	while(!atomic_load(&stopping)) {
+		int i, n = 0;
+		pfds[n++] = (struct pollfd){wakeFd, POLLIN, 0};
+		pfds[n++] = (struct pollfd){listenFd, POLLIN, 0};
+		for(i = 0; i < STREAM_MAX_SUBSCRIBERS; i++) {
+			struct subscriber *s = &subscribers[i];
+			// readable is a hangup (subscribers send nothing), writable only matters with something left to send
+			if(s->fd >= 0) pfds[n++] = (struct pollfd){s->fd, POLLIN | (s->sent < s->outLength ? POLLOUT : 0), 0};
+		}
+		if(poll(pfds, n, -1) < 0 && errno != EINTR) break;
+
+		if(pfds[0].revents & POLLIN) {
+			uint64_t count;
+			if(read(wakeFd, &count, sizeof(count)) < 0) count = 0;
+		}
+		if(pfds[1].revents & POLLIN) accept_subscriber();
+
+		// everyone gets what is new, whichever descriptor woke us
+		for(i = 0; i < STREAM_MAX_SUBSCRIBERS; i++) {
+			struct subscriber *s = &subscribers[i];
+			if(s->fd < 0) continue;
+			char discard[64];
+			ssize_t got = recv(s->fd, discard, sizeof(discard), MSG_DONTWAIT);
+			bool gone = got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+			if(gone || pump(s) < 0) {
+				drop(s);
+				atomic_fetch_add(&droppedSubscribers, 1);
+			}
+		}
+	}
+
+	int i;
+	for(i = 0; i < STREAM_MAX_SUBSCRIBERS; i++) {
+		if(subscribers[i].fd >= 0) drop(&subscribers[i]);
+	}
+	return NULL;
+}
+
+int stream_open(const char *path, int bayCount) {
+	if(strlen(path) >= sizeof(socketPath)) {
+		fprintf(stderr, "STREAM: socket path too long: %s\n", path);
+		return -1;
+	}
+	int i;
+	for(i = 0; i < STREAM_MAX_SUBSCRIBERS; i++) subscribers[i].fd = -1;
+	streamBays = bayCount;
+
+	wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(wakeFd < 0) {
+		fprintf(stderr, "STREAM: could not create wakeup: %s\n", strerror(errno));
+		return -1;
+	}
+	listenFd = service_listen_unix("STREAM", path, 8);
+	if(listenFd < 0) {
+		close(wakeFd);
+		wakeFd = -1;
+		return -1;
+	}
+	strcpy(socketPath, path);
+
+	if(service_thread_start("STREAM", &publisherThread, publisher_main, NULL) < 0) {
+		close(wakeFd);
+		close(listenFd);
+		unlink(socketPath);
+		wakeFd = listenFd = -1;
+		return -1;
+	}
+	streaming = true;
+	return 0;
+}
+
+void stream_close(void) {
+	if(!streaming) return;
+	streaming = false;
+	atomic_store(&stopping, true);
+	uint64_t one = 1;
+	if(write(wakeFd, &one, sizeof(one)) < 0) perror("STREAM");
+	pthread_join(publisherThread, NULL);
+	close(listenFd);
+	close(wakeFd);
+	unlink(socketPath);
+	wakeFd = listenFd = -1;
+}
+
+int stream_register_metrics(void) {
+	int failed = 0;
+	failed |= metrics_register("carwash_stream_subscribers", "event stream subscribers connected", METRIC_GAUGE, NULL, &subscriberCount);
+	// head is the count of records published
+	failed |= metrics_register("carwash_stream_records", "event stream records published", METRIC_COUNTER, NULL, &head);
+	failed |= metrics_register("carwash_stream_skipped", "records subscribers were skipped past for falling a whole ring behind", METRIC_COUNTER, NULL, &skipped);
+	failed |= metrics_register("carwash_stream_dropped_subscribers", "subscribers that hung up, errored or found every slot taken", METRIC_COUNTER, NULL, &droppedSubscribers);
+	return failed ? -1 : 0;
+}
@@ -0,0 +1,72 @@
+#ifndef CARWASH_STREAM_H
+#define CARWASH_STREAM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+	EVENT STREAM
+	every debounced edge, recorded session and maintenance insert goes out
+	as a fixed size binary record on a unix stream socket, to any number of
+	local subscribers (the gui, loggers, test harnesses) as it happens,
+	instead of them polling postgres.
+
+	the sampling loop only copies records into a ring and wakes the
+	publisher thread once per cycle. the publisher sends each subscriber
+	what it has not had yet with non-blocking writes, so nothing a
+	subscriber does can hold up the loop: one that falls a whole ring
+	behind is skipped ahead to the oldest record still there (it sees the
+	gap in seq), one that hangs up or errors is dropped.
+
+	a subscriber connects and reads. the first record is STREAM_HELLO,
+	after that records follow back to back, each STREAM_RECORD_SIZE bytes
+	in the monitor's byte order (the socket never leaves the machine).
+	only records published after it connected are sent.
+*/
+
+// bump when the record layout changes, readers check it in STREAM_HELLO
+#define STREAM_VERSION 1
+
+enum stream_kind {
+	STREAM_HELLO,           // first record on a connection: bay is the bay count, timer_ms STREAM_VERSION, seq the next record
+	STREAM_TIMER_STARTED,
+	STREAM_TIMER_STOPPED,   // started_ns: when the timer started, timer_ms/pump_ms: the session as it ran
+	STREAM_PUMP_STARTED,
+	STREAM_PUMP_STOPPED,    // started_ns: when the pump started
+	STREAM_SESSION,         // a session was recorded: timer_ms/pump_ms as billed, started_ns when it began
+	STREAM_INSERT,          // a maintenance insert was recorded
+};
+
+// flags
+#define STREAM_TIMER_RUNNING 0x01
+#define STREAM_PUMP_RUNNING 0x02
+
+struct stream_record {
+	uint64_t seq;           // counts every record published, a gap is records this subscriber was skipped past
+	int64_t time_ns;        // CLOCK_REALTIME of the event
+	int64_t started_ns;     // CLOCK_REALTIME a stopped run or recorded session began, 0 when not applicable
+	uint32_t timer_ms;      // edges: the session so far once applied, SESSION: as billed
+	uint32_t pump_ms;
+	uint8_t kind;
+	uint8_t bay;            // 1 based like the tables
+	uint8_t flags;          // running once the event is applied
+	uint8_t reserved[5];
+};
+#define STREAM_RECORD_SIZE 40
+_Static_assert(sizeof(struct stream_record) == STREAM_RECORD_SIZE, "stream records are 40 bytes on every platform");
+
+/*
+	listen on path (any old socket there is replaced) and start the
+	publisher thread. bayCount goes out in every STREAM_HELLO
+*/
+int stream_open(const char *path, int bayCount);
+// producer side, never blocks and never fails: seq is filled in. a no-op without stream_open
+void stream_publish(struct stream_record *record);
+// producer side, once per cycle: wake the publisher if anything was published
+void stream_flush(void);
+// stop the publisher, close every subscriber and remove the socket
+void stream_close(void);
+// subscribers, records published, records skipped and subscribers dropped, for the metrics registry (metrics.h)
+int stream_register_metrics(void);
+
+#endif
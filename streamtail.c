@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "stream.h"
+#include "latency.h"
+
+/*
+	EVENT STREAM SUBSCRIBER
+	connects to the monitor's event stream (monitor -S, stream.h) and prints
+	every record as it arrives. at the end (SIGINT, -n records, or the
+	monitor going away) it says how many records it got, how many it was
+	skipped past for not keeping up, and how long records took from their
+	event time to getting here. -w makes it a deliberately slow subscriber,
+	to watch the monitor skip it ahead instead of waiting for it.
+
+	usage: cw-tail [-q] [-n records] [-w ms per record] socket
+*/
+
+static volatile sig_atomic_t stopProgram = 0;
+
+static void sig_handler(int signo) {
+	stopProgram = 1;
+}
+
+static const char *kindNames[] = {
+	[STREAM_HELLO] = "HELLO",
+	[STREAM_TIMER_STARTED] = "TIMER STARTED",
+	[STREAM_TIMER_STOPPED] = "TIMER STOPPED",
+	[STREAM_PUMP_STARTED] = "PUMP STARTED",
+	[STREAM_PUMP_STOPPED] = "PUMP STOPPED",
+	[STREAM_SESSION] = "SESSION",
+	[STREAM_INSERT] = "INSERT",
+};
+
+static int64_t wall_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void print_record(const struct stream_record *r) {
+	time_t seconds = r->time_ns / 1000000000;
+	char when[32];
+	strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&seconds));
+	const char *name = r->kind < sizeof(kindNames) / sizeof(kindNames[0]) ? kindNames[r->kind] : "UNKNOWN";
+	printf("%" PRIu64 " %s.%03d BAY %d %s timer %.3f pump %.3f%s%s", r->seq, when, (int)(r->time_ns / 1000000 % 1000), r->bay, name,
+		r->timer_ms / 1000.0, r->pump_ms / 1000.0,
+		(r->flags & STREAM_TIMER_RUNNING) ? " [timer]" : "", (r->flags & STREAM_PUMP_RUNNING) ? " [pump]" : "");
+	if(r->started_ns != 0) printf(" started %.3f s before", (r->time_ns - r->started_ns) / 1e9);
+	printf("\n");
+}
+
+int main(int argc, char **argv) {
+	bool quiet = false;
+	long limit = 0;
+	long waitMs = 0;
+
+	int opt;
+	while((opt = getopt(argc, argv, "qn:w:h")) != -1) {
+		switch(opt) {
+			case 'q': quiet = true; break;
+			case 'n': limit = atol(optarg); break;
+			case 'w': waitMs = atol(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-q] [-n records] [-w ms per record] socket\n", argv[0]);
+				exit(opt == 'h' ? 0 : 1);
+		}
+	}
+	if(optind != argc - 1) {
+		fprintf(stderr, "usage: %s [-q] [-n records] [-w ms per record] socket\n", argv[0]);
+		exit(1);
+	}
+
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if(strlen(argv[optind]) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "socket path too long: %s\n", argv[optind]);
+		exit(1);
+	}
+	strcpy(addr.sun_path, argv[optind]);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "could not connect to %s: %s\n", argv[optind], strerror(errno));
+		exit(1);
+	}
+
+	// no SA_RESTART, so a blocked read returns on SIGINT
+	struct sigaction action = {.sa_handler = sig_handler};
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	static struct latency_histogram latency;
+	latency_reset(&latency);
+	struct stream_record record;
+	size_t have = 0;
+	bool hello = false;
+	uint64_t expected = 0, received = 0, skipped = 0;
+
+	while(!stopProgram && (limit == 0 || (long)received < limit)) {
+		ssize_t n = read(fd, (char *)&record + have, sizeof(record) - have);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) {
+			if(n < 0) perror("read");
+			else fprintf(stderr, "the monitor closed the stream\n");
+			break;
+		}
+		have += n;
+		if(have < sizeof(record)) continue;
+		have = 0;
+
+		if(!hello) {
+			if(record.kind != STREAM_HELLO || record.timer_ms != STREAM_VERSION) {
+				fprintf(stderr, "not a version %d event stream\n", STREAM_VERSION);
+				exit(1);
+			}
+			hello = true;
+			expected = record.seq;
+			fprintf(stderr, "CONNECTED: %d bays, records from %" PRIu64 "\n", record.bay, record.seq);
+			continue;
+		}
+
+		latency_record(&latency, wall_now_ns() - record.time_ns);
+		if(record.seq != expected) {
+			skipped += record.seq - expected;
+			if(!quiet) printf("SKIPPED %" PRIu64 " records\n", record.seq - expected);
+		}
+		expected = record.seq + 1;
+		received++;
+		if(!quiet) print_record(&record);
+		fflush(stdout);
+		if(waitMs > 0) nanosleep(&(struct timespec){waitMs / 1000, waitMs % 1000 * 1000000L}, NULL);
+	}
+
+	fprintf(stderr, "STREAM: %" PRIu64 " records received, %" PRIu64 " skipped\n", received, skipped);
+	latency_print(&latency, stderr, "STREAM event to subscriber");
+	close(fd);
+	return 0;
+}
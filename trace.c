@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "trace.h"
+
+// RECORDING
+static FILE *out = NULL;
+static char *outPath = NULL;
+static long maxSize = 0;
+static long written = 0;
+static struct trace_header header;
+static bool started = false;
+static uint64_t lastLevels = 0;
+static int64_t lastChangeNs = 0;
+static int64_t lastSampleNs = 0;
+static uint64_t cyclesSinceChange = 0;
+
+static int64_t timespec_ns(const struct timespec *ts) {
+	return (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static void put_varint(uint64_t v) {
+	unsigned char buf[10];
+	int n = 0;
+	do {
+		buf[n] = v & 0x7f;
+		v >>= 7;
+		if(v != 0) buf[n] |= 0x80;
+		n++;
+	} while(v != 0);
+	fwrite(buf, 1, n, out);
+	written += n;
+}
+
+static void put_record(uint64_t cycles, int64_t ns, uint64_t changed) {
+	put_varint(cycles);
+	put_varint(ns < 0 ? 0 : (uint64_t)ns);
+	put_varint(changed);
+}
+
+static int start_file(void) {
+	out = fopen(outPath, "w");
+	if(out == NULL) {
+		fprintf(stderr, "TRACE: could not open %s: %s\n", outPath, strerror(errno));
+		return -1;
+	}
+	written = 0;
+	started = false;
+	return 0;
+}
+
+int trace_open(const char *path, long maxBytes, const int *pins, int inputCount, int bayCount, long samplePeriod) {
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+	header.version = TRACE_VERSION;
+	header.input_count = inputCount;
+	header.bay_count = bayCount;
+	header.sample_period_ns = samplePeriod;
+	int i;
+	for(i = 0; i < inputCount; i++) header.pins[i] = pins[i];
+
+	outPath = strdup(path);
+	maxSize = maxBytes;
+	return start_file();
+}
+
+void trace_sample(const struct gpio_sample *sample) {
+	if(out == NULL) return;
+	int64_t now = timespec_ns(&sample->time);
+	lastSampleNs = now;
+
+	if(!started) {
+		struct timespec wall;
+		clock_gettime(CLOCK_REALTIME, &wall);
+		header.start_mono_ns = now;
+		header.start_wall_ns = timespec_ns(&wall);
+		header.start_levels = sample->levels;
+		fwrite(&header, sizeof(header), 1, out);
+		fflush(out);
+		written += sizeof(header);
+		lastLevels = sample->levels;
+		lastChangeNs = now;
+		cyclesSinceChange = 0;
+		started = true;
+		return;
+	}
+
+	cyclesSinceChange++;
+	if(sample->levels == lastLevels) return;
+
+	put_record(cyclesSinceChange, now - lastChangeNs, sample->levels ^ lastLevels);
+	// changes are rare, every one goes to the kernel right away so a crash keeps it
+	fflush(out);
+	lastLevels = sample->levels;
+	lastChangeNs = now;
+	cyclesSinceChange = 0;
+
+	if(written >= maxSize) {
+		// end this file on the change just written and carry on in a fresh one from the same levels
+		fclose(out);
+		out = NULL;
+		char *previous = malloc(strlen(outPath) + 3);
+		sprintf(previous, "%s.1", outPath);
+		if(rename(outPath, previous) < 0) {
+			fprintf(stderr, "TRACE: could not move %s aside: %s\n", outPath, strerror(errno));
+		}
+		free(previous);
+		if(start_file() < 0) return;
+		trace_sample(sample);
+	}
+}
+
+void trace_close(void) {
+	if(out != NULL) {
+		if(started) put_record(cyclesSinceChange, lastSampleNs - lastChangeNs, 0);
+		fclose(out);
+		out = NULL;
+	}
+	free(outPath);
+	outPath = NULL;
+}
+
+// REPLAY
+static FILE *in = NULL;
+
+int trace_replay_open(const char *path, struct trace_header *h) {
+	in = fopen(path, "r");
+	if(in == NULL) {
+		fprintf(stderr, "TRACE: could not open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if(fread(h, sizeof(*h), 1, in) != 1 || memcmp(h->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0
+		|| h->version != TRACE_VERSION || h->input_count > GPIO_MAX_INPUTS || h->sample_period_ns == 0) {
+		fprintf(stderr, "TRACE: %s is not a trace this version can read\n", path);
+		fclose(in);
+		in = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+// 1 with a value, 0 at a clean end of file, -1 part way through one
+static int get_varint(uint64_t *v) {
+	*v = 0;
+	int shift, c;
+	for(shift = 0; shift < 64; shift += 7) {
+		if((c = getc(in)) == EOF) return shift == 0 ? 0 : -1;
+		*v |= (uint64_t)(c & 0x7f) << shift;
+		if((c & 0x80) == 0) return 1;
+	}
+	return -1;
+}
+
+int trace_replay_next(uint64_t *cycles, int64_t *ns, uint64_t *changed) {
+	uint64_t delta;
+	int got = get_varint(cycles);
+	if(got <= 0) return got;
+	if(get_varint(&delta) <= 0 || get_varint(changed) <= 0) return -1;
+	*ns = (int64_t)delta;
+	return 1;
+}
+
+void trace_replay_close(void) {
+	if(in != NULL) fclose(in);
+	in = NULL;
+}
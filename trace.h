@@ -0,0 +1,53 @@
+#ifndef CARWASH_TRACE_H
+#define CARWASH_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "gpio.h"
+
+/*
+	PIN TRACE
+	a binary record of every sample the polling loop took, so a disputed
+	session or a miscounted coin can be replayed through the same debounce
+	and session logic later (monitor -P).
+
+	the header holds the slot layout, the sample period and the levels at
+	the first cycle. after that only changes are written, run length style:
+		<cycles since the last record> <ns since the last record> <levels xor the last levels>
+	each an unsigned LEB128 varint, so a change costs a handful of bytes and
+	an idle bay costs nothing. a record with no changed bits marks where the
+	trace ended. the loop's timestamps are CLOCK_MONOTONIC, the header pairs
+	the first one with the wall clock so replays can print real times.
+
+	the file is bounded: once it passes its size limit it is closed, moved
+	to <path>.1 (replacing the one before) and a new trace starts from the
+	current levels, so at most twice the limit is ever on disk.
+*/
+
+#define TRACE_MAGIC "CWTRACE"
+#define TRACE_VERSION 1
+
+struct trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t input_count;
+	uint32_t bay_count;
+	uint32_t sample_period_ns;
+	int64_t start_mono_ns;          // time of the first cycle
+	int64_t start_wall_ns;          // CLOCK_REALTIME at that same moment
+	uint64_t start_levels;
+	int32_t pins[GPIO_MAX_INPUTS];  // slot n is this pin
+};
+
+// RECORDING: the polling loop, one call per cycle
+int trace_open(const char *path, long maxBytes, const int *pins, int inputCount, int bayCount, long samplePeriod);
+void trace_sample(const struct gpio_sample *sample);
+void trace_close(void);
+
+// REPLAY: read the header, then one record at a time
+int trace_replay_open(const char *path, struct trace_header *header);
+// 1 with a record, 0 at the end of the trace, -1 when the file is cut short
+int trace_replay_next(uint64_t *cycles, int64_t *ns, uint64_t *changed);
+void trace_replay_close(void);
+
+#endif
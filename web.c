@@ -0,0 +1,585 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <libpq-fe.h>
+#include "config.h"
+#include "dbwriter.h"
+#include "dashboard.h"
+#include "service.h"
+
+/*
+	WEB DASHBOARD
+	serves the bays to browsers and phones: GET /status is the current
+	snapshot as JSON, GET /events pushes every new snapshot as Server-Sent
+	Events, GET / is a page that shows them. one poll loop, one database
+	connection, one snapshot.
+
+	the snapshot is the same data the gui shows, from the same places
+	(dashboard.h). it is rebuilt when
+	something actually changed, not per viewer and not per second: running
+	clocks go out as the time so far at as_of and the page runs them on.
+	each viewer is only handed the text already built, so the database and
+	the Pi see the same load for one phone or fifty. a viewer that cannot
+	keep up gets the newest snapshot when it can, never a queue of old ones.
+
+	usage: cw-web [-f config] [-d conninfo] [-l [host:]port]
+*/
+
+#define WEB_MAX_CLIENTS 64
+// a request line and headers, anything longer is not a dashboard
+#define WEB_REQUEST_MAX 2048
+#define WEB_OUT_MAX 16384
+// how often the live status segment is looked at, a copy with no syscall
+#define WEB_LIVE_POLL_MS 100
+// SSE comment lines keep proxies and phones from giving up on a quiet stream
+#define WEB_KEEPALIVE_SECONDS 15
+// a viewer that has not taken a byte for this long is gone
+#define WEB_STALL_SECONDS 60
+#define RECONNECT_MAX_SECONDS 60
+// connecting, the TCP handshake and authentication included
+#define WEB_CONNECT_TIMEOUT_SECONDS 10
+
+static volatile sig_atomic_t stopProgram = 0;
+
+static void sig_handler(int signo) {
+	stopProgram = 1;
+}
+
+static const char PAGE[] =
+	"<!DOCTYPE html><html><head><meta charset=\"utf-8\"><meta name=\"viewport\" content=\"width=device-width,initial-scale=1\">"
+	"<title>carwash</title><style>"
+	"body{font-family:sans-serif;background:#111;color:#eee;margin:8px}"
+	".bays{display:flex;flex-wrap:wrap;gap:8px}.bay{background:#222;padding:8px;min-width:150px;flex:1}"
+	".on{background:#2a2;color:#000}.off{background:#a22}h2,h3{margin:4px 0;padding:4px;text-align:center}"
+	"td:last-child{text-align:right}#total{font-size:1.4em;margin-top:8px}#state{color:#888}"
+	"</style></head><body><div id=\"state\">connecting</div><div class=\"bays\" id=\"bays\"></div><div id=\"total\"></div><script>"
+	"var snap=null,offset=0;"
+	"function clock(s){s=Math.floor(s);var h=Math.floor(s/3600),m=Math.floor(s%3600/60);"
+	"return (h?h+' h ':'')+(h||m?m+' min ':'')+(s%60)+' s';}"
+	"function draw(){if(!snap)return;var now=Date.now()/1000-offset,since=Math.max(0,now-snap.as_of),html='';"
+	"snap.bays.forEach(function(b){"
+	"var t=b.timer_time+(b.timer_running?since:0),p=b.pump_time+(b.pump_running?since:0);"
+	"html+='<div class=\"bay\"><h2 class=\"'+(b.timer_running?'on':'off')+'\">BAY '+b.bay+'</h2>'"
+	"+'<div>'+(b.timer_running?clock(t):'&nbsp;')+'</div>'"
+	"+'<h3 class=\"'+(b.pump_running?'on':'off')+'\">PUMP</h3><div>'+(b.timer_running?clock(p):'&nbsp;')+'</div><table>'"
+	"+'<tr><td>timer total</td><td>'+clock(b.total_timer)+'</td></tr><tr><td>pump total</td><td>'+clock(b.total_pump)+'</td></tr>'"
+	"+'<tr><td>gross</td><td>$'+b.gross.toFixed(2)+'</td></tr><tr><td>manual coins</td><td>-$'+b.maintenance.toFixed(2)+'</td></tr>'"
+	"+'<tr><td>net</td><td>$'+b.net.toFixed(2)+'</td></tr></table></div>';});"
+	"document.getElementById('bays').innerHTML=html;"
+	"document.getElementById('total').textContent='TOTAL REVENUE: $'+snap.total_revenue.toFixed(2);}"
+	"var es=new EventSource('events');"
+	"es.onmessage=function(e){snap=JSON.parse(e.data);offset=Date.now()/1000-snap.as_of;"
+	"document.getElementById('state').textContent=snap.live?'live':(snap.database?'from the database':'no monitor');draw();};"
+	"es.onerror=function(){document.getElementById('state').textContent='reconnecting';};"
+	"setInterval(draw,1000);"
+	"</script></body></html>";
+
+/*
+	LAYOUT: one slot per connected viewer, fd -1 when free
+	request collects the request until its blank line. out holds whole
+	responses or events (sent bytes of outLength). an event viewer that is
+	still sending when a newer snapshot comes is marked behind and gets the
+	newest once out drains
+*/
+struct client {
+	int fd;
+	bool events;
+	bool behind;
+	time_t lastProgress;
+	time_t lastSent;
+	size_t requestLength;
+	char request[WEB_REQUEST_MAX];
+	size_t outLength;
+	size_t sent;
+	char out[WEB_OUT_MAX];
+};
+static struct client clients[WEB_MAX_CLIENTS];
+
+/* MAIN DATA STORAGE: what the snapshot is built from */
+static struct carwash_config config;
+static struct dashboard_bays bays;
+// LIVE STATUS: copied out of shared memory every WEB_LIVE_POLL_MS
+static struct dashboard_live liveStatus;
+
+// the snapshot as JSON, and the same as an SSE event, both rebuilt together
+static char snapshot[WEB_OUT_MAX / 2];
+static char snapshotEvent[WEB_OUT_MAX / 2 + 32];
+static size_t snapshotEventLength = 0;
+static bool changed = true;
+
+static uint64_t requests = 0;
+static uint64_t snapshots = 0;
+static uint64_t eventsSent = 0;
+static uint64_t eventsSkipped = 0;
+static uint64_t queries = 0;
+
+static double wall_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void build_snapshot(bool database) {
+	double now = wall_now();
+	double totalRevenue = 0;
+	size_t used = 0;
+	int x;
+	used += snprintf(snapshot + used, sizeof(snapshot) - used, "{\"as_of\":%.3f,\"live\":%s,\"database\":%s,\"bays\":[",
+		now, liveStatus.live ? "true" : "false", database ? "true" : "false");
+	for(x = 0; x < config.bay_count; x++) {
+		double timer = dashboard_runtime(&bays, x, 0, now);
+		double pump = dashboard_runtime(&bays, x, 1, now);
+		double gross, maintenance;
+		dashboard_money(&bays, &config, x, &gross, &maintenance);
+		totalRevenue += gross - maintenance;
+		used += snprintf(snapshot + used, sizeof(snapshot) - used,
+			"%s{\"bay\":%d,\"timer_running\":%s,\"pump_running\":%s,\"timer_time\":%.2f,\"pump_time\":%.2f,"
+			"\"total_timer\":%.2f,\"total_pump\":%.2f,\"maintenance_inserts\":%.0f,\"gross\":%.2f,\"maintenance\":%.2f,\"net\":%.2f}",
+			x > 0 ? "," : "", x + 1, bays.running[x][0] ? "true" : "false", bays.running[x][1] ? "true" : "false", timer, pump,
+			bays.total_runtime[x][0], bays.total_runtime[x][1], bays.maintenance_inserts[x], gross, maintenance, gross - maintenance);
+	}
+	snprintf(snapshot + used, sizeof(snapshot) - used, "],\"total_revenue\":%.2f}", totalRevenue);
+	snapshotEventLength = snprintf(snapshotEvent, sizeof(snapshotEvent), "data: %s\n\n", snapshot);
+	snapshots++;
+}
+
+static void drop(struct client *c) {
+	close(c->fd);
+	c->fd = -1;
+}
+
+static void respond(struct client *c, const char *status, const char *type, const char *body, size_t length) {
+	int head = snprintf(c->out, sizeof(c->out), "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n",
+		status, type, length);
+	if(head + length > sizeof(c->out)) length = 0;
+	memcpy(c->out + head, body, length);
+	c->outLength = head + length;
+	c->sent = 0;
+}
+
+static void handle_request(struct client *c) {
+	char method[8], path[256];
+	requests++;
+	if(sscanf(c->request, "%7s %255s", method, path) != 2) {
+		respond(c, "400 Bad Request", "text/plain", "bad request\n", 12);
+		return;
+	}
+	if(strcmp(method, "GET") != 0) {
+		respond(c, "405 Method Not Allowed", "text/plain", "GET only\n", 9);
+		return;
+	}
+	path[strcspn(path, "?")] = '\0';
+	if(strcmp(path, "/") == 0) {
+		respond(c, "200 OK", "text/html; charset=utf-8", PAGE, sizeof(PAGE) - 1);
+	} else if(strcmp(path, "/status") == 0) {
+		respond(c, "200 OK", "application/json", snapshot, strlen(snapshot));
+	} else if(strcmp(path, "/events") == 0) {
+		int head = snprintf(c->out, sizeof(c->out), "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n"
+			"Connection: keep-alive\r\nAccess-Control-Allow-Origin: *\r\n\r\nretry: 2000\n\n");
+		memcpy(c->out + head, snapshotEvent, snapshotEventLength);
+		c->outLength = head + snapshotEventLength;
+		c->sent = 0;
+		c->events = true;
+		eventsSent++;
+	} else {
+		respond(c, "404 Not Found", "text/plain", "not found\n", 10);
+	}
+}
+
+// send what the viewer can take without blocking. -1 when it has to go
+static int pump(struct client *c, time_t now) {
+	while(c->sent < c->outLength) {
+		ssize_t n = send(c->fd, c->out + c->sent, c->outLength - c->sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if(n < 0) return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+		c->sent += n;
+		c->lastProgress = now;
+	}
+	// a plain response is done, an event stream waits for the next snapshot
+	if(!c->events) return c->outLength > 0 ? -1 : 0;
+	if(c->behind) {
+		c->behind = false;
+		memcpy(c->out, snapshotEvent, snapshotEventLength);
+		c->outLength = snapshotEventLength;
+		c->sent = 0;
+		c->lastSent = now;
+		eventsSent++;
+		return pump(c, now);
+	}
+	return 0;
+}
+
+// everyone watching gets the new snapshot, or gets it later if they are still busy with the last one
+static void publish(time_t now) {
+	int i;
+	for(i = 0; i < WEB_MAX_CLIENTS; i++) {
+		struct client *c = &clients[i];
+		if(c->fd < 0 || !c->events) continue;
+		if(c->sent < c->outLength) {
+			if(c->behind) eventsSkipped++;
+			c->behind = true;
+			continue;
+		}
+		memcpy(c->out, snapshotEvent, snapshotEventLength);
+		c->outLength = snapshotEventLength;
+		c->sent = 0;
+		c->lastSent = now;
+		eventsSent++;
+		if(pump(c, now) < 0) drop(c);
+	}
+}
+
+static void keepalive(time_t now) {
+	static const char comment[] = ": keepalive\n\n";
+	int i;
+	for(i = 0; i < WEB_MAX_CLIENTS; i++) {
+		struct client *c = &clients[i];
+		if(c->fd < 0 || !c->events || c->sent < c->outLength || now - c->lastSent < WEB_KEEPALIVE_SECONDS) continue;
+		memcpy(c->out, comment, sizeof(comment) - 1);
+		c->outLength = sizeof(comment) - 1;
+		c->sent = 0;
+		c->lastSent = now;
+		if(pump(c, now) < 0) drop(c);
+	}
+}
+
+static void client_read(struct client *c, time_t now) {
+	if(c->outLength > 0) {
+		// viewers have nothing more to say once they asked, readable is a hangup
+		char discard[256];
+		ssize_t n = recv(c->fd, discard, sizeof(discard), MSG_DONTWAIT);
+		if(n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) drop(c);
+		return;
+	}
+	ssize_t n = recv(c->fd, c->request + c->requestLength, sizeof(c->request) - 1 - c->requestLength, MSG_DONTWAIT);
+	if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+	if(n <= 0) {
+		drop(c);
+		return;
+	}
+	c->requestLength += n;
+	c->request[c->requestLength] = '\0';
+	c->lastProgress = now;
+	if(strstr(c->request, "\r\n\r\n") == NULL && strstr(c->request, "\n\n") == NULL) {
+		if(c->requestLength == sizeof(c->request) - 1) drop(c);
+		return;
+	}
+	handle_request(c);
+	if(pump(c, now) < 0) drop(c);
+}
+
+static void accept_client(int listenFd, time_t now) {
+	int fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if(fd < 0) return;
+	int i;
+	for(i = 0; i < WEB_MAX_CLIENTS && clients[i].fd >= 0; i++);
+	if(i == WEB_MAX_CLIENTS) {
+		close(fd);
+		return;
+	}
+	struct client *c = &clients[i];
+	c->fd = fd;
+	c->events = false;
+	c->behind = false;
+	c->requestLength = 0;
+	c->outLength = 0;
+	c->sent = 0;
+	c->lastProgress = now;
+	c->lastSent = now;
+}
+
+/*
+	DATABASE
+	one connection, LISTEN on the monitor's channel. connecting goes through
+	PQconnectStart/PQconnectPoll, the LISTEN and every query out with
+	PQsendQuery, and all of it is taken in the same poll loop as the
+	viewers, so a slow or unreachable database never holds up a page (a
+	host name in conninfo is still looked up blocking, hostaddr avoids
+	that). one query at a time: totals (and bay_status without the live
+	segment) are asked for again only after a notification says they
+	changed, however many arrived
+*/
+static PGconn *conn = NULL;
+// PQconnectPoll still has to be called, connectWant says when the socket is ready for it
+static bool connecting = false;
+static PostgresPollingStatusType connectWant = PGRES_POLLING_WRITING;
+static double connectStarted = 0;
+static enum {QUERY_NONE, QUERY_LISTEN, QUERY_STATUS, QUERY_TOTALS} inFlight = QUERY_NONE;
+static bool reloadStatus = true;
+static bool reloadTotals = true;
+// nonblocking: a query can be left part sent, PQflush goes on with it when the socket takes more
+static bool flushing = false;
+static double nextConnect = 0;
+static double backoff = 1;
+
+static void db_lost(void) {
+	if(conn != NULL) {
+		fprintf(stderr, "PG_ERROR: %s", PQerrorMessage(conn));
+		PQfinish(conn);
+	}
+	conn = NULL;
+	connecting = false;
+	inFlight = QUERY_NONE;
+	flushing = false;
+	nextConnect = wall_now() + backoff;
+	backoff = (backoff * 2 > RECONNECT_MAX_SECONDS) ? RECONNECT_MAX_SECONDS : backoff * 2;
+	changed = true;
+}
+
+static void db_flush(void) {
+	int pending = PQflush(conn);
+	if(pending < 0) db_lost();
+	else flushing = pending > 0;
+}
+
+static void db_connect(const char *conninfo) {
+	if(conn != NULL || wall_now() < nextConnect) return;
+	conn = PQconnectStart(conninfo);
+	if(conn == NULL || PQstatus(conn) == CONNECTION_BAD) {
+		db_lost();
+		return;
+	}
+	connecting = true;
+	connectWant = PGRES_POLLING_WRITING;
+	connectStarted = wall_now();
+}
+
+// the socket is ready for the next step of connecting
+static void db_connect_poll(void) {
+	connectWant = PQconnectPoll(conn);
+	if(connectWant == PGRES_POLLING_FAILED) {
+		db_lost();
+		return;
+	}
+	if(connectWant != PGRES_POLLING_OK) return;
+	connecting = false;
+	if(PQsetnonblocking(conn, 1) != 0 || PQsendQuery(conn, "LISTEN " DB_NOTIFY_CHANNEL ";") == 0) {
+		db_lost();
+		return;
+	}
+	inFlight = QUERY_LISTEN;
+	backoff = 1;
+	reloadStatus = true;
+	reloadTotals = true;
+	changed = true;
+	printf("CONNECTED: %s\n", PQdb(conn));
+	db_flush();
+}
+
+// PQconnectPoll has no timeout of its own (connect_timeout only applies to PQconnectdb)
+static void db_connect_timeout(void) {
+	if(!connecting || wall_now() - connectStarted < WEB_CONNECT_TIMEOUT_SECONDS) return;
+	fprintf(stderr, "WEB: no connection to the database after %d s\n", WEB_CONNECT_TIMEOUT_SECONDS);
+	// nothing went wrong that libpq could say
+	PQfinish(conn);
+	conn = NULL;
+	db_lost();
+}
+
+static void db_next_query(void) {
+	if(conn == NULL || connecting || inFlight != QUERY_NONE) return;
+	const char *sql = NULL;
+	if(reloadTotals) {
+		sql = DASHBOARD_TOTALS_SQL;
+		inFlight = QUERY_TOTALS;
+		reloadTotals = false;
+	} else if(reloadStatus && !liveStatus.live) {
+		sql = DASHBOARD_STATUS_SQL;
+		inFlight = QUERY_STATUS;
+		reloadStatus = false;
+	}
+	if(sql == NULL) return;
+	queries++;
+	if(PQsendQuery(conn, sql) == 0) {
+		db_lost();
+		return;
+	}
+	db_flush();
+}
+
+static void take_rows(PGresult *res) {
+	if(inFlight == QUERY_TOTALS) dashboard_take_totals(&bays, res, config.bay_count);
+	else if(!liveStatus.live) dashboard_take_status(&bays, res, config.bay_count, wall_now());
+	changed = true;
+}
+
+static void db_input(void) {
+	if(PQconsumeInput(conn) == 0) {
+		db_lost();
+		return;
+	}
+	while(inFlight != QUERY_NONE && !PQisBusy(conn)) {
+		PGresult *res = PQgetResult(conn);
+		if(res == NULL) {
+			inFlight = QUERY_NONE;
+			break;
+		}
+		if(inFlight == QUERY_LISTEN) {
+			bool listening = PQresultStatus(res) == PGRES_COMMAND_OK;
+			PQclear(res);
+			if(!listening) {
+				db_lost();
+				return;
+			}
+			continue;
+		}
+		take_rows(res);
+		PQclear(res);
+	}
+
+	PGnotify *notify;
+	while((notify = PQnotifies(conn)) != NULL) {
+		struct dashboard_notify note;
+		switch(dashboard_parse_notify(notify->extra, config.bay_count, &note)) {
+			case DASHBOARD_NOTIFY_RELOAD:
+				reloadStatus = true;
+				reloadTotals = true;
+				break;
+			case DASHBOARD_NOTIFY_STATUS:
+				if(!liveStatus.live) {
+					dashboard_apply_notify(&bays, &note);
+					changed = true;
+				}
+				break;
+			case DASHBOARD_NOTIFY_TOTALS:
+				// a session or maintenance insert moved the totals
+				reloadTotals = true;
+				break;
+			case DASHBOARD_NOTIFY_NONE:
+				break;
+		}
+		PQfreemem(notify);
+	}
+}
+
+// the snapshot only changes when the monitor published a change
+static void read_live(bool checkAlive) {
+	switch(dashboard_live_read(&liveStatus, checkAlive)) {
+		case DASHBOARD_LIVE_CHANGED:
+			dashboard_live_apply(&liveStatus, &bays, config.bay_count, wall_now());
+			changed = true;
+			break;
+		case DASHBOARD_LIVE_GONE:
+			// whatever bay_status says has to be asked again once the segment goes
+			reloadStatus = true;
+			changed = true;
+			break;
+		case DASHBOARD_LIVE_SAME:
+			break;
+	}
+}
+
+int main(int argc, char **argv) {
+	const char *configPath = NULL;
+	const char *conninfo = "user=washman password=cotton dbname=carwash";
+	const char *address = "8080";
+
+	int opt;
+	while((opt = getopt(argc, argv, "f:d:l:h")) != -1) {
+		switch(opt) {
+			case 'f': configPath = optarg; break;
+			case 'd': conninfo = optarg; break;
+			case 'l': address = optarg; break;
+			default:
+				fprintf(stderr, "usage: %s [-f config] [-d conninfo] [-l [host:]port]\n", argv[0]);
+				exit(opt == 'h' ? 0 : 1);
+		}
+	}
+	if(config_load(configPath, &config) < 0) exit(1);
+
+	int listenFd = service_listen_tcp("WEB", address, "0.0.0.0", 16);
+	if(listenFd < 0) exit(1);
+	int i;
+	for(i = 0; i < WEB_MAX_CLIENTS; i++) clients[i].fd = -1;
+
+	// no SA_RESTART, so poll returns on SIGINT
+	struct sigaction action = {.sa_handler = sig_handler};
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	printf("LISTENING: %s\n", address);
+
+	struct pollfd pfds[2 + WEB_MAX_CLIENTS];
+	int slots[2 + WEB_MAX_CLIENTS];
+	time_t lastSecond = 0;
+	while(!stopProgram) {
+		time_t now = time(NULL);
+		// once a second: is the monitor still there, is the database, does anyone need a keepalive
+		bool second = now != lastSecond;
+		lastSecond = now;
+		read_live(second);
+		if(second) {
+			db_connect(conninfo);
+			db_connect_timeout();
+			keepalive(now);
+		}
+		db_next_query();
+		if(changed) {
+			changed = false;
+			build_snapshot(conn != NULL && !connecting);
+			publish(now);
+		}
+
+		int n = 0, dbSlot = -1;
+		pfds[n++] = (struct pollfd){listenFd, POLLIN, 0};
+		if(conn != NULL) {
+			dbSlot = n;
+			short events = POLLIN | (flushing ? POLLOUT : 0);
+			if(connecting) events = (connectWant == PGRES_POLLING_READING) ? POLLIN : POLLOUT;
+			pfds[n++] = (struct pollfd){PQsocket(conn), events, 0};
+		}
+		for(i = 0; i < WEB_MAX_CLIENTS; i++) {
+			struct client *c = &clients[i];
+			if(c->fd < 0) continue;
+			if(now - c->lastProgress > WEB_STALL_SECONDS && (c->sent < c->outLength || !c->events)) {
+				drop(c);
+				continue;
+			}
+			slots[n] = i;
+			pfds[n++] = (struct pollfd){c->fd, POLLIN | (c->sent < c->outLength ? POLLOUT : 0), 0};
+		}
+		if(poll(pfds, n, WEB_LIVE_POLL_MS) < 0) {
+			if(errno == EINTR) continue;
+			perror("poll");
+			break;
+		}
+
+		now = time(NULL);
+		if(pfds[0].revents & POLLIN) accept_client(listenFd, now);
+		if(dbSlot >= 0 && connecting) {
+			if(pfds[dbSlot].revents != 0) db_connect_poll();
+		} else if(dbSlot >= 0) {
+			if(pfds[dbSlot].revents & POLLOUT) db_flush();
+			if(conn != NULL && (pfds[dbSlot].revents & ~POLLOUT)) db_input();
+		}
+		for(i = (dbSlot >= 0) ? 2 : 1; i < n; i++) {
+			struct client *c = &clients[slots[i]];
+			if(c->fd < 0 || pfds[i].revents == 0) continue;
+			if(pfds[i].revents & POLLOUT) {
+				if(pump(c, now) < 0) {
+					drop(c);
+					continue;
+				}
+			}
+			if(pfds[i].revents & (POLLIN | POLLHUP | POLLERR)) client_read(c, now);
+		}
+	}
+
+	for(i = 0; i < WEB_MAX_CLIENTS; i++) {
+		if(clients[i].fd >= 0) drop(&clients[i]);
+	}
+	close(listenFd);
+	if(conn != NULL) PQfinish(conn);
+	dashboard_live_close(&liveStatus);
+	printf("WEB: %" PRIu64 " requests, %" PRIu64 " snapshots built, %" PRIu64 " events sent, %" PRIu64 " skipped for slow viewers, %" PRIu64 " database queries\n",
+		requests, snapshots, eventsSent, eventsSkipped, queries);
+	return 0;
+}